@@ -4,26 +4,77 @@
 /// To build the code, assuming that you have V-Ray Next for 3ds Max 2019 and MSVS 2017, open a MSVS command-line
 /// prompt (x64 native tools command-line prompt), go to the folder where this file is located and type
 ///
-/// cl metalness.cpp /I "c:\Program Files\Chaos Group\V-Ray\3ds Max 2019\include" /link kernel32.lib user32.lib gdi32.lib
+/// cl metalness.cpp metalness_core.cpp metalness_expression.cpp metalness_ggx.cpp metalness_shadergen.cpp metalness_materialx.cpp metalness_report.cpp /I "c:\Program Files\Chaos Group\V-Ray\3ds Max 2019\include" /link kernel32.lib user32.lib gdi32.lib
+///
+/// The program can also be built as a headless command-line tool that fits metals given on the command line,
+/// in files or on the standard input, without opening a window; run it with --help for the options. This is
+/// the default on platforms other than Windows, where the V-Ray SDK is replaced by the small portable layer
+/// in vray_compat.h. On Linux, type
+///
+/// g++ -O2 -std=c++14 metalness.cpp metalness_core.cpp metalness_expression.cpp metalness_ggx.cpp metalness_shadergen.cpp metalness_materialx.cpp metalness_report.cpp -o metalness -pthread
+///
+/// On Windows, add /DMETALNESS_HEADLESS to the command line above for a headless build, and
+/// /DMETALNESS_NO_VRAY_SDK to build without the V-Ray SDK.
+///
+/// Add -DMETALNESS_TRACE (or /DMETALNESS_TRACE) to record the time spent in each stage, for each metal and
+/// thread, as a Chrome trace; see metalness_trace.h and the --trace option. On Linux, add -DMETALNESS_PERF
+/// to also count cycles, instructions and cache misses per stage; see metalness_perf.h and the --perf option.
+///
+/// The Fresnel curves and the fitting are in metalness_core.h; they are also available to other programs
+/// as a library with a C API, see metalness_api.h.
+
+#if !defined(_WIN32) && !defined(METALNESS_HEADLESS)
+#define METALNESS_HEADLESS
+#endif
 
+#ifndef METALNESS_HEADLESS
 #include <windows.h>
+#endif
 #include <stdio.h>
 
 #include <math.h>
-
-#include "utils.h"
-#include "misc_ray.h"
-
-using namespace VUtils;
+#include <stdlib.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metalness_core.h"
+#include "metalness_shadergen.h"
+#include "metalness_expression.h"
+#include "metalness_ggx.h"
+#include "metalness_materialx.h"
+#include "metalness_models.h"
+#include "metalness_perf.h"
+#include "metalness_report.h"
+#include "metalness_trace.h"
 
 int bwidth=800;
 int bheight=800;
 
+/// The models that are compared with the complex Fresnel curve besides the built-in ones. Add a model
+/// derived from FresnelModel here to get its fit, its curve in the graphs and its error column.
+typedef ModelSet<GeneralizedSchlickModel> ExtraModels;
+
+#ifndef METALNESS_HEADLESS
 HINSTANCE hInst; // this process' instance
 HWND hWndMain; // handle of main window
+#endif
 
 RGB32 *buf=NULL;
 
+// The parts of buf that were drawn into since it was last cleared. For each row, all drawn pixels
+// are in the span between dirtyMinX and dirtyMaxX inclusive; rows with nothing drawn have an empty span.
+int *dirtyMinX=NULL;
+int *dirtyMaxX=NULL;
+int dirtyMinY=0; ///< The first row with a non-empty span.
+int dirtyMaxY=-1; ///< The last row with a non-empty span.
+
 void putPixel(float x, float y, const Color &c) {
 	int xs=fast_floor(x*bwidth);
 	int ys=bheight-1-fast_floor(y*(bheight-1));
@@ -35,359 +86,254 @@ void putPixel(float x, float y, const Color &c) {
 		return;
 
 	buf[ys*bwidth+xs]=c.toRGB32();
-}
-
-/// The formula that the VRayMtl material uses to compute metallic Fresnel.
-/// @param base The base color.
-/// @param reflection The reflection color.
-/// @param ior The index of refraction.
-/// @param cs The cosine between the viewing angle and the surface normal.
-/// @return The reflection strength.
-Color getVRayMetallicFresnel(const Color &base, const Color &reflection, float ior, float cs) {
-	const simd::Vector3f viewDir(sqrtf(1.0f-cs*cs), 0.0f, -cs);
-	const simd::Vector3f normal(0.0f, 0.0f, 1.0f);
-
-	bool internalRefl=false;
-	const simd::Vector3f refractDir=getRefractDir(viewDir, normal, ior, internalRefl);
-
-	const float f=getFresnelCoeff(viewDir, normal, refractDir, ior);
-	return base*(1.0f-f)+reflection*f;
-}
-
-float n_min(float r) { 
-   return (1-r)/(1+r);
-}
-
-float n_max(float r) {
-return (1+sqrt(r))/(1-sqrt(r)); 
-}
-
-float get_n(float r, float g) {
-   return n_min(r)*g + (1-g)*n_max(r);
-}
-
-float get_k2(float r, float n) {
-   float nr = (n+1)*(n+1)*r-(n-1)*(n-1);
-   return nr/(1-r ); 
-}
 
-float get_r(float n, float k) {
-   return ((n-1)*(n-1)+k*k)/((n+1)*(n+1)+k*k);
+	if (xs<dirtyMinX[ys]) dirtyMinX[ys]=xs;
+	if (xs>dirtyMaxX[ys]) dirtyMaxX[ys]=xs;
+	if (ys<dirtyMinY) dirtyMinY=ys;
+	if (ys>dirtyMaxY) dirtyMaxY=ys;
 }
 
-float get_g(float n, float k) {
-   float r = get_r(n,k);
-   return (n_max(r)-n)/(n_max(r)-n_min(r)); 
+/// Mark the whole of buf as drawn into, so that the next clearDirtySpans() call clears all of it.
+/// Used when buf is first allocated.
+void markAllDirty(void) {
+	for (int y=0; y<bheight; y++) {
+		dirtyMinX[y]=0;
+		dirtyMaxX[y]=bwidth-1;
+	}
+	dirtyMinY=0;
+	dirtyMaxY=bheight-1;
 }
 
-/// Compute artist-friendly reflection strength from base and grazing angle strength. Works by trying
-/// to estimate the n and k values with some plausible formula, and then using those n and k values to
-/// compute the Fresnel effect.
-/// @param r The base reflection strength (when looking directly at the surface along the normal).
-/// @param g The reflection strength at 90 degrees.
-/// @param c The cosine between the viewing direction and the surface normal.
-/// @return A suitable reflection strength.
-float olefresnel(float r, float g, float c) { 
-   // clamp parameters
-   float _r = clamp(r, 0.0f, 0.99f); 
-   // compute n and k
-   float n = get_n(_r,g);
-   float k2 = get_k2(_r,n);
-
-   float rs_num = n*n + k2 - 2*n*c + c*c; 
-   float rs_den = n*n + k2 + 2*n*c + c*c;
-   float rs = rs_num/rs_den;
-   
-   float rp_num = (n*n + k2)*c*c - 2*n*c + 1; 
-   float rp_den = (n*n + k2)*c*c + 2*n*c + 1;
-   float rp = rp_num / rp_den ;
-   
-   return 0.5f*(rs+rp);
+/// Clear buf to black. Only the spans that were drawn into since the last clear are touched, so the
+/// cost depends on how much was drawn and not on the size of the buffer.
+void clearDirtySpans(void) {
+	for (int y=dirtyMinY; y<=dirtyMaxY; y++) {
+		if (dirtyMinX[y]<=dirtyMaxX[y])
+			memset(buf+y*bwidth+dirtyMinX[y], 0, sizeof(RGB32)*(dirtyMaxX[y]-dirtyMinX[y]+1));
+		dirtyMinX[y]=bwidth;
+		dirtyMaxX[y]=-1;
+	}
+	dirtyMinY=bheight;
+	dirtyMaxY=-1;
 }
 
-/// Artist-Friendly Metallic Fresnel by Ole Gulbrandsen, for comparison purposes against
-/// our implementation. Works by trying to estimate the n and k values with some plausible
-/// formula and then using those n and k values to compute the Fresnel effect. See
-/// http://jcgt.org/published/0003/04/03/paper.pdf for more information.
-/// @param base The base color.
-/// @param reflection The grazing angle reflection color (usually white).
-/// @param cos_theta Angle between the viewing direction and the surface normal.
-Color getOleMetallicFresnel(const Color &base, const Color &reflection, float cos_theta) {
-	Color result = Color(
-      olefresnel(base.r, reflection.r, cos_theta),
-      olefresnel(base.g, reflection.g, cos_theta),
-      olefresnel(base.b, reflection.b, cos_theta)
-   );
-	return result;
+/// Draw a line between two points. The coordinates are in the same [0, 1] range as for putPixel().
+/// @param x0 The x coordinate of the start point.
+/// @param y0 The y coordinate of the start point.
+/// @param x1 The x coordinate of the end point.
+/// @param y1 The y coordinate of the end point.
+/// @param c The color of the line.
+/// @param dashLength If positive, only every other run of dashLength pixels along the x axis
+/// is drawn, which gives a dashed line; 0 means a solid line.
+void putLine(float x0, float y0, float x1, float y1, const Color &c, int dashLength) {
+	// Step by about half a pixel along the longer axis so that the line has no gaps.
+	const float dx=fabsf(x1-x0)*float(bwidth);
+	const float dy=fabsf(y1-y0)*float(bheight);
+	const int numSteps=int(2.0f*(dx>dy? dx : dy))+1;
+	for (int i=0; i<=numSteps; i++) {
+		const float t=float(i)/float(numSteps);
+		const float x=x0+(x1-x0)*t;
+		const float y=y0+(y1-y0)*t;
+		if (dashLength>0 && ((fast_floor(x*bwidth)/dashLength)&1)!=0)
+			continue;
+		putPixel(x, y, c);
+	}
 }
 
-float getOleEdgeFloat(float n, float r) {
-	float g_num = ((1 + sqrt(r)) / (1 - sqrt(r))) - n;
-	float g_den = ((1 + sqrt(r)) / (1 - sqrt(r))) - ((1 - r) / (1 + r));
-	float g = g_num / g_den;
-	return g;
+/// Draw the red/green/blue components of a color curve between two points.
+void putColorGraphSegment(float x0, const Color &c0, float x1, const Color &c1, float f, int dashLength) {
+	putLine(x0, c0.r, x1, c1.r, Color(1.0f, f, f), dashLength);
+	putLine(x0, c0.g, x1, c1.g, Color(f, 1.0f, f), dashLength);
+	putLine(x0, c0.b, x1, c1.b, Color(f, f, 1.0f), dashLength);
 }
 
-/// Artist-Friendly Metallic Fresnel by Ole Gulbrandsen, Creates the edgeTint (g)
-/// formula uses the base and n to derive the edgetint
-/// see formula 15 in https://jcgt.org/published/0003/04/03/paper.pdf
-/// @param base is the reflectivity(r) in gulbrandsen
-/// @param n the n value
-Color getOleEdgeTint(const Color &base, const Color &n) {
-	Color result = Color(
-		getOleEdgeFloat(n.r, base.r),
-		getOleEdgeFloat(n.g, base.g),
-		getOleEdgeFloat(n.b, base.b)
-	);
-	return result;
+/// Compute the VRayMtl settings for a metal preset and sample the reflectance curves that are compared.
+/// @param preset The metal preset.
+/// @param curves The compared reflectance curves for the preset.
+/// @param samples Adaptively placed samples of all curves, dense enough for drawing them at the
+/// current bwidth and bheight.
+/// @param extraFit The fitted parameters and average errors of the ExtraModels.
+/// @param result The computed settings and average errors.
+void computePreset(const MetalPreset &preset, PresetCurves &curves, std::vector<CurveSample> &samples, ExtraModels::Fit &extraFit, PresetResult &result) {
+	METALNESS_TRACE_SCOPE_DETAIL("computePreset", preset.name);
+
+	fitMetal(preset.n, preset.k, curves);
+
+	// Sample the actual complex Fresnel reflectance, the Ole, F82-tint and VRayMtl versions, with
+	// more samples where the curves bend. The tolerance keeps the curves within about a quarter
+	// of a pixel from the straight lines between the samples.
+	sampleCurvesAdaptive(curves, 0.5f/float(bwidth), 1.0f-0.5f/float(bwidth), 0.25f/float(bheight), 4, 14, samples);
+
+	// Compute the average errors for the VRayMtl, Ole and F82-tint versions and the Schlick and
+	// Lazanyi-Schlick approximations from the same samples.
+	const double vrayErrorSqr=getAverageErrorSqr(samples, &CurveSample::vray, &CurveSample::complex);
+	const double oleErrorSqr=getAverageErrorSqr(samples, &CurveSample::ole, &CurveSample::complex);
+	const double f82ErrorSqr=getAverageErrorSqr(samples, &CurveSample::f82, &CurveSample::complex);
+	const double schlickErrorSqr=getAverageErrorSqr(samples, &CurveSample::schlick, &CurveSample::complex);
+	const double lazanyiErrorSqr=getAverageErrorSqr(samples, &CurveSample::lazanyi, &CurveSample::complex);
+
+	result.name=preset.name;
+	result.n=preset.n;
+	result.k=preset.k;
+	result.base=curves.base;
+	result.reflection=curves.reflection;
+	result.ior=curves.ior;
+	result.edgeTint=curves.edgeTint;
+	result.vrayError=sqrt(vrayErrorSqr);
+	result.oleError=sqrt(oleErrorSqr);
+	result.f82Error=sqrt(f82ErrorSqr);
+	result.schlickError=sqrt(schlickErrorSqr);
+	result.lazanyiError=sqrt(lazanyiErrorSqr);
+
+	// Fit the extra models and compare them at the same samples.
+	std::vector<float> x(samples.size());
+	std::vector<Color> complex(samples.size());
+	for (size_t i=0; i<samples.size(); i++) {
+		x[i]=samples[i].x;
+		complex[i]=samples[i].complex;
+	}
+	ExtraModels::fit(preset.n, preset.k, FitOptions(), extraFit);
+	ExtraModels::computeErrors(preset.n, preset.k, &x[0], &complex[0], int(x.size()), extraFit);
+	ExtraModels::setResultErrors(extraFit, result);
 }
 
-/// Compute reflection strength from complex index of refraction for one wavelength.
-/// @param n The n value.
-/// @param k The k value.
-/// @param c The cosine between the viewing direction and the surface normal.
-float complexFresnel(float n, float k, float c) {
-	float k2=k*k;
-	float rs_num = n*n + k2 - 2*n*c + c*c;
-	float rs_den = n*n + k2 + 2*n*c + c*c;
-	float rs = rs_num/ rs_den ;
-
-	float rp_num = (n*n + k2)*c*c - 2*n*c + 1;
-	float rp_den = (n*n + k2)*c*c + 2*n*c + 1;
-	float rp = rp_num/ rp_den ;
-
-	return clamp(0.5f*(rs+rp), 0.0f, 1.0f);
-}
+#ifndef METALNESS_HEADLESS
 
-/// Complex Fresnel for color n and k values for three wavelengths.
-/// @param n The n values.
-/// @param k The k values.
-/// @param cs The cosine between the viewing direction and the surface normal.
-Color getComplexFresnel(const Color &n, const Color &k, float cs) {
-	Color result(
-		complexFresnel(n[0], k[0], cs),
-		complexFresnel(n[1], k[1], cs),
-		complexFresnel(n[2], k[2], cs)
-	);
-	return result;
-}
+/// Plot the sampled curves of a preset: the VRayMtl metallic Fresnel with solid graphs, the Ole metallic
+/// Fresnel with short dashed graphs, the F82-tint metallic Fresnel with dotted graphs and the actual
+/// complex Fresnel reflectance with long dashed graphs, and the legend.
+/// @param samples The samples of the curves from computePreset().
+/// @param legend The color of the legend.
+void plotCurves(const std::vector<CurveSample> &samples, const Color &legend) {
+	METALNESS_TRACE_SCOPE("plotCurves");
+	METALNESS_PERF_STAGE("rasterization");
 
-/// A metal preset with n and k values for three wavelengths (0.65, 0.55, 0.45 micrometers).
-struct MetalPreset {
-	char name[512]; ///< The name of the preset.
-	Color n, k; ///< n and k values for red/green/blue wavelengths (0.65, 0.55, 0.45 micrometers).
-};
+	for (size_t i=1; i<samples.size(); i++) {
+		const CurveSample &a=samples[i-1];
+		const CurveSample &b=samples[i];
 
-enum MetalPresetName {
-	metalPreset_silver=0,
-	metalPreset_gold,
-	metalPreset_copper,
-	metalPreset_aluminum,
-	metalPreset_chromium,
-	metalPreset_lead,
-	metalPreset_platinum,
-	metalPreset_titanium,
-	metalPreset_tungsten,
-	metalPreset_iron,
-	metalPreset_vanadium,
-	metalPreset_zinc,
-	metalPreset_nickel,
-	metalPreset_mercury,
-	metalPreset_cobalt,
-
-	metalPreset_last,
-};
+		// Plot the VRayMtl metallic Fresnel with solid graphs for red/green/blue.
+		putColorGraphSegment(a.x, a.vray, b.x, b.vray, 0.6f, 0);
 
-/// Some presets derived from https://refractiveindex.info by sampling the n and k values
-/// at 0.65, 0.55, 0.45 micrometers.
-MetalPreset metalPresets[metalPreset_last]={
-	{ "Silver", Color(0.052225f, 0.059582f, 0.040000f), Color(4.4094f, 3.5974f, 2.6484f) },
-	{ "Gold", Color(0.15557f, 0.42415f, 1.3831f), Color(3.6024f, 2.4721f, 1.9155f) },
-	{ "Copper", Color(0.23780f, 1.0066f, 1.2404f), Color(3.6264f, 2.5823f, 2.3929f) },
-	{ "Aluminum", Color(1.5580f, 1.0152f, 0.63324f), Color(7.7124f, 6.6273f, 5.4544f) },
-	{ "Chromium", Color(3.1071f, 3.1812f, 2.3230f), Color(3.3314f, 3.3291f, 3.1350f) },
-	{ "Lead", Color(2.5750f, 2.5444f, 2.1038f), Color(4.1612f, 4.1823f, 4.1890f) },
-	{ "Platinum", Color(0.47475f, 0.46521f, 0.63275f), Color(6.3329f, 5.1073f, 3.7481f) },
-	{ "Titanium", Color(0.25300f, 0.28822f, 0.52181f), Color(5.2796f, 4.2122f, 3.0367f) },
-	{ "Tungsten", Color(0.92074f, 1.3437f, 2.2323f), Color(6.8595f, 5.2293f, 5.1461f) },
-	{ "Iron", Color(1.8247f, 1.2246f, 1.0205f), Color(7.6326f, 5.9377f, 4.3952f) },
-	{ "Vanadium", Color(0.43109f, 0.60711f, 0.91187f), Color(5.5575f, 4.5217f, 3.6035f) },
-	{ "Zinc", Color(1.2338f, 0.92943f, 0.67767f), Color(5.8730f, 4.9751f, 4.0122f) },
-	{ "Nickel", Color(1.3726f, 1.0753f, 1.1336f), Color(6.6273f, 5.1763f, 3.7544f) },
-	{ "Mercury", Color(2.0733f, 1.5523f, 1.0606f), Color(5.3383f, 4.6510f, 3.8628f) },
-	{ "Cobalt", Color(2.2371f, 2.0524f, 1.7365f), Color(4.2357f, 3.8242f, 3.2745f) }
-};
+		// Plot the Ole metallic Fresnel with short dashed graphs for red/green/blue
+		putColorGraphSegment(a.x, a.ole, b.x, b.ole, 0.4f, 3);
 
-/// Given n and k values, find the best VRayMtl IOR value that will give the closest match to the
-/// actual complex reflectance curve.
-/// @param n The n values for red/green/blue.
-/// @param k The k values for red/green/blue.
-/// @return An IOR value for the VRayMtl material that is the closest fit to the actual
-/// complex reflectance curve. Computed by sampling all IOR values between 1.001f and 10.0f,
-/// and for each IOR value, computing the difference between the VRayMtl metallic Fresnel reflectance
-/// curve, and the actual complex reflectance curve.
-float findIOR(const Color &n, const Color &k) {
-	float bestIOR=-1.0f;
-	float bestResult=1e18f;
-
-	// Compute the reflectance at 90 degrees.
-	Color reflection=getComplexFresnel(n, k, 0.0f);
-	
-	// Compute the reflectance when looking directly at the surface along the normal.
-	Color base=getComplexFresnel(n, k, 1.0f);
-
-	// Step through all IOR values between 1.001f and 10.0f and find the best match.
-	// For each value, sample the VRayMtl metallic reflectance curve and the actual complex
-	// Fresnel reflectance curve for different viewing angles and compute the average difference.
-	// The best IOR value is the one with minimal differences between the VRayMtl curve and the
-	// actual complex Fresnel curve.
-	for (float ior=1.001f; ior<10.0f; ior+=0.001f) {
-		double sum=0.0f;
-		for (int xs=1; xs<200; xs++) {
-			// Compute a viewing angle.
-			float x=(float) xs/(float) 200;
-
-			// Compute the VRayMtl reflectance
-			Color vrayMetallicFresnel=getVRayMetallicFresnel(base, reflection, ior, x);
-			
-			// Compute the actual complex Fresnel reflectance.
-			Color complexFresnel=getComplexFresnel(n, k, x);
-
-			// Accumulate the difference.
-			sum+=(vrayMetallicFresnel-complexFresnel).lengthSqr();
-		}
+		// Plot the F82-tint metallic Fresnel with dotted graphs for red/green/blue
+		putColorGraphSegment(a.x, a.f82, b.x, b.f82, 0.2f, 1);
 
-		// If result is better than what we have so far, save it.
-		if (sum<bestResult) {
-			bestResult=float(sum);
-			bestIOR=ior;
-		}
+		// Plot the actual complex Fresnel reflectance with long dashed graphs for red/green/blue
+		putColorGraphSegment(a.x, a.complex, b.x, b.complex, 0.0f, 10);
 	}
 
-	// Return the best result that we found.
-	return bestIOR;
+	// Draw the legend.
+	putColorGraphSegment(0.00625f, legend, 0.06875f, legend, 0.6f, 0);
+	putColorGraphSegment(0.31875f, legend, 0.38125f, legend, 0.4f, 3);
+	putColorGraphSegment(0.56875f, legend, 0.63125f, legend, 0.0f, 10);
+	putColorGraphSegment(0.81875f, legend, 0.88125f, legend, 0.2f, 1);
 }
 
-void putColorGraph(float x, const Color &c, float f) {
-	putPixel(x, c.r, Color(1.0f, f, f));
-	putPixel(x, c.g, Color(f, 1.0f, f));
-	putPixel(x, c.b, Color(f, f, 1.0f));
+/// Plot the curves of the ExtraModels at the samples of the other curves, with longer dashes for each
+/// further model, and their legend in a second row.
+/// @param curves The compared reflectance curves for the preset.
+/// @param extraFit The fitted parameters of the ExtraModels.
+/// @param samples The samples of the curves from computePreset().
+/// @param legend The color of the legend.
+void plotExtraModelCurves(const PresetCurves &curves, const ExtraModels::Fit &extraFit, const std::vector<CurveSample> &samples, const Color &legend) {
+	METALNESS_TRACE_SCOPE("plotExtraModelCurves");
+	METALNESS_PERF_STAGE("rasterization");
+
+	std::vector<float> x(samples.size());
+	for (size_t i=0; i<samples.size(); i++)
+		x[i]=samples[i].x;
+
+	std::vector<Color> values(samples.size());
+	for (int j=0; j<ExtraModels::numModels; j++) {
+		const int dashLength=5+2*j;
+		ExtraModels::evalBatch(j, curves.n, curves.k, extraFit, &x[0], int(x.size()), &values[0]);
+		for (size_t i=1; i<samples.size(); i++)
+			putColorGraphSegment(x[i-1], values[i-1], x[i], values[i], 0.8f, dashLength);
+
+		const float legendX=0.00625f+0.25f*float(j%4);
+		putColorGraphSegment(legendX, legend*0.5f, legendX+0.0625f, legend*0.5f, 0.8f, dashLength);
+	}
 }
 
 /// Go through all metalPresets and fill in a CSV file with the computed IOR values and average errors
 /// between the actual complex Fresnel curve and the VRayMtl metallic Fresnel vs Old Gulbrandsen's metallic Fresnel
-/// respectively. Also draws the reflectance curves for the actual complex Fresnel, the VRayMtl metallic Fresnel
-/// and the artist-friendly metallic Fresnel version by Ole Gulbrandsen.
+/// vs the F82-tint metallic Fresnel respectively. Also draws the reflectance curves for the actual complex Fresnel,
+/// the VRayMtl metallic Fresnel, the artist-friendly metallic Fresnel version by Ole Gulbrandsen and the F82-tint
+/// metallic Fresnel. At the end, a swatch table image
+/// with the results and a matrix with the errors of all models are written next to the CSV file.
 DWORD WINAPI renderCycle(LPVOID param) {
 	HWND hWnd=(HWND) param;
+	METALNESS_TRACE_THREAD_NAME("render");
 
 	RGB32 *cbuf=new RGB32[bwidth*bheight];
+	dirtyMinX=new int[bheight];
+	dirtyMaxX=new int[bheight];
 	buf=cbuf;
+	markAllDirty();
 
 	// A CSV file for the results. Change the path as needed.
 	FILE *fp=fopen("d:/temp/metal_presets.csv", "wt");
-	if (fp) fprintf(fp, "Name, Diffuse red, Diffuse green, Diffuse blue, Reflection red, Reflection green, Reflection blue, IOR, Color (web sRGB), V-Ray error, Ole error\n");
+	if (fp) writeCSVHeader(fp, ", ", ExtraModels::getLabels(), ExtraModels::numModels);
 
 	Color legend(0.1f, 0.09f, 0.08f);
 
-	for (int presetIdx=0; presetIdx<metalPreset_last; presetIdx++) {
-		FillMemory(cbuf, sizeof(RGB32)*bwidth*bheight, 0x00);
-
-		Color n=metalPresets[presetIdx].n;
-		Color k=metalPresets[presetIdx].k;
-
-		// The 90 degrees reflection color for the n and k values.
-		Color reflection=getComplexFresnel(n, k, 0.0f);
-		
-		// The base reflection color when looking directly at the surface along the normal.
-		Color base=getComplexFresnel(n, k, 1.0f);
+	PresetResult results[metalPreset_last];
+	PresetCurves curves[metalPreset_last];
+	ExtraModels::Fit extraFits[metalPreset_last];
+	std::vector<CurveSample> samples;
 
-		// The edgetint (g) for gulbrandsen fresnel
-		Color edgeTint = getOleEdgeTint(base, n);
-
-		// Find an IOR value for the VRayMtl material for these n and k values.
-		float ior=findIOR(n, k);
-		
-		// Compute the base color in sRGB display color space so that colors can be picked from
-		// the web page, f.e. with the 3ds Max color picker tool, which will do the inverse sRGB conversion
-		// automatically.
-		Color base_sRGB=base;
-		base_sRGB.encodeToSRGB();
-
-		bool fastQuit=false;
-		double oleErrorSqr=0.0f; // Error between the actual complex Fresnel curve and the Ole version.
-		double vrayErrorSqr=0.0f; // Error between the actual complex Fresnel curve and the VRayMtl version.
-
-		// Draw graphs of the actual complex Fresnel reflectance, the Ole version and the VRayMtl version.
-		int N=(bwidth*2);
-		for (int xs=1; xs<N; xs++) {
-			float x=float(xs)/float(N);
-
-			// Get the VRayMtl metallic Fresnel value based on the computed best IOR.
-			Color vrayMetallicFresnel=getVRayMetallicFresnel(base, reflection, ior, x);
-			
-			// Get the Ole metallic Fresnel version based only on the colors.
-			Color oleMetallicFresnel=getOleMetallicFresnel(base, edgeTint, x);
-
-			// Get the actual complex Fresnel value based on the n and k values.
-			Color complexFresnel=getComplexFresnel(n, k, x);
-
-			// Plot the VRayMtl metallic Fresnel with solid graphs for red/green/blue.
-			putColorGraph(x, vrayMetallicFresnel, 0.6f);
-			if (xs>10 && xs<110) {
-				putColorGraph(x, legend, 0.6f);
-			}
-
-			// Plot the Ole metallic Fresnel with short dashed graphs for red/green/blue
-			if (((xs/6)&1)==0) {
-				putColorGraph(x, oleMetallicFresnel, 0.4f);
-				if (xs>510 && xs<610) {
-					putColorGraph(x, legend, 0.4f);
-				}
-			}
-
-			// Plot the actual complex Fresnel reflectance with long dashed graphs for red/green/blue
-			if (((xs/20)&1)==0) {
-				putColorGraph(x, complexFresnel, 0.0f);
-				if (xs>910 && xs<1010) {
-					putColorGraph(x, legend, 0.0f);
-				}
-			}
-
-			// Accumulate the average error for the VRayMtl and Ole versions.
-			vrayErrorSqr+=(vrayMetallicFresnel-complexFresnel).lengthSqr();
-			oleErrorSqr+=(oleMetallicFresnel-complexFresnel).lengthSqr();
-		}
+	for (int presetIdx=0; presetIdx<metalPreset_last; presetIdx++) {
+		METALNESS_TRACE_SCOPE_DETAIL("preset", metalPresets[presetIdx].name);
+		clearDirtySpans();
 
-		// Compute the average errors.
-		vrayErrorSqr/=float(N);
-		oleErrorSqr/=float(N);
+		computePreset(metalPresets[presetIdx], curves[presetIdx], samples, extraFits[presetIdx], results[presetIdx]);
 
-		double vrayError=sqrt(vrayErrorSqr);
-		double oleError=sqrt(oleErrorSqr);
+		// Draw graphs of the actual complex Fresnel reflectance, the Ole, F82-tint and VRayMtl versions,
+		// and of the extra models.
+		plotCurves(samples, legend);
+		plotExtraModelCurves(curves[presetIdx], extraFits[presetIdx], samples, legend);
 
 		// Print the data into the CSV file.
-		if (fp) fprintf(
-			fp,
-			"%s, %g, %g, %g, %g, %g, %g, %g, %x, %g, %g\n",
-			metalPresets[presetIdx].name,
-			floorf(base.r*255.0f), floorf(base.g*255.0f), floorf(base.b*255.0f),
-			floorf(reflection.r*255.0f), floorf(reflection.g*255.0f), floorf(reflection.b*255.0f),
-			ior,
-			int(base_sRGB.toRGB32()),
-			vrayError, oleError
-		);
+		if (fp) writeCSVLine(fp, results[presetIdx]);
 
 		InvalidateRect(hWnd, NULL, FALSE);
 		PostMessage(hWnd, WM_PAINT, 0, 0);
 		
 		// Wait a bit so that the graph is visible before moving on to the next preset.
-		msSleep(100);
+		{
+			METALNESS_TRACE_SCOPE("sleep");
+			msSleep(100);
+		}
 	}
 
 	if (fp)
 		fclose(fp);
 
+	// Draw the swatch table with all results into an image. Change the path as needed.
+	saveSwatchTable("d:/temp/metal_presets.bmp", results, metalPreset_last);
+
+	// Compare all models for all presets in one pass. Change the path as needed.
+	FILE *errorMatrixFile=fopen("d:/temp/metal_presets_errors.csv", "wt");
+	if (errorMatrixFile) {
+		const char *names[metalPreset_last];
+		for (int presetIdx=0; presetIdx<metalPreset_last; presetIdx++)
+			names[presetIdx]=metalPresets[presetIdx].name;
+		std::vector<CurveModel> models;
+		findCurveModels("all", models);
+		double errors[curveModel_last*metalPreset_last];
+		computeErrorMatrix(curves, metalPreset_last, &models[0], int(models.size()), FitOptions().numUniformSamples, errors, 0);
+		writeErrorMatrix(errorMatrixFile, names, metalPreset_last, &models[0], int(models.size()), errors);
+		fclose(errorMatrixFile);
+	}
+
+#ifdef METALNESS_TRACE
+	// Write the timeline of the whole cycle. Change the path as needed.
+	saveChromeTrace("d:/temp/metal_presets_trace.json");
+#endif
+
 	return 0;
 }
 
@@ -471,7 +417,698 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdLi
 	PostThreadMessage(renderThreadID, WM_QUIT, 0, 0);
 	WaitForSingleObject(hRenderThread, 10000);
 	delete[] buf;
+	delete[] dirtyMinX;
+	delete[] dirtyMaxX;
 
 	CloseHandle(hRenderThread);
 	return int(msg.wParam);
 }  
+
+#else // METALNESS_HEADLESS
+
+/// Output formats of the command-line tool.
+enum OutputFormat {
+	outputFormat_csv=0, ///< The same columns as the CSV file of the GUI version.
+	outputFormat_tsv, ///< The same columns, separated by tabs.
+	outputFormat_json, ///< JSON Lines: one object per metal, with full precision values.
+};
+
+/// A metal to fit, from the command line or from an input file, and its results once fitted.
+struct FitJob {
+	std::string name; ///< The name of the metal.
+	Color n, k; ///< The n and k values for red/green/blue.
+	PresetResult result; ///< The fitted settings; result.name is not set.
+	PresetCurves curves; ///< The fitted settings of all models, for the error matrix.
+	ExtraModels::Fit extraFit; ///< The fitted parameters and errors of the ExtraModels.
+	std::vector<double> extraErrors; ///< The errors of the ExtraModels followed by those of the formulas.
+};
+
+/// Fits metals on a pool of worker threads while the input is still being read, and returns the
+/// results in input order as soon as they are ready.
+class FitPipeline {
+public:
+	/// Start the worker threads.
+	/// @param options The options for fitting and computing the errors.
+	/// @param expressions User-defined formulas that are fitted and compared besides the models; they must
+	/// stay valid while the pipeline runs.
+	/// @param numThreads The number of worker threads; 0 means one per logical processor.
+	FitPipeline(const FitOptions &options, const std::vector<FresnelExpression> &expressions, int numThreads):options(options), expressions(expressions), numJobs(0), nextResult(0), inputDone(false) {
+		if (numThreads<=0)
+			numThreads=int(std::thread::hardware_concurrency());
+		if (numThreads<1)
+			numThreads=1;
+		maxPendingJobs=numThreads*16;
+		for (int i=0; i<numThreads; i++)
+			workers.push_back(std::thread(&FitPipeline::workerThread, this));
+	}
+
+	~FitPipeline(void) {
+		finishInput();
+		for (size_t i=0; i<workers.size(); i++)
+			workers[i].join();
+	}
+
+	/// Queue a metal for fitting. Blocks while too many jobs are waiting for a worker.
+	void addJob(const FitJob &job) {
+		std::unique_lock<std::mutex> lock(mutex);
+		jobQueueChanged.wait(lock, [this]() { return int(jobs.size())<maxPendingJobs; });
+		jobs.push_back(std::make_pair(numJobs++, job));
+		METALNESS_TRACE_COUNTER("queued jobs", jobs.size());
+		jobQueueChanged.notify_all();
+	}
+
+	/// Signal that no more jobs will be added.
+	void finishInput(void) {
+		std::lock_guard<std::mutex> lock(mutex);
+		inputDone=true;
+		jobQueueChanged.notify_all();
+		resultAdded.notify_all();
+	}
+
+	/// Wait for the result of the next job in input order.
+	/// @return false if all jobs have been returned and the input is finished.
+	bool getNextResult(FitJob &job) {
+		std::unique_lock<std::mutex> lock(mutex);
+		resultAdded.wait(lock, [this]() { return results.count(nextResult)!=0 || (inputDone && nextResult==numJobs); });
+		if (results.count(nextResult)==0)
+			return false;
+
+		job=results[nextResult];
+		results.erase(nextResult++);
+		return true;
+	}
+
+private:
+	void workerThread(void) {
+		METALNESS_TRACE_THREAD_NAME("fit worker");
+		while (true) {
+			std::pair<int, FitJob> item;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobQueueChanged.wait(lock, [this]() { return !jobs.empty() || inputDone; });
+				if (jobs.empty())
+					return;
+				item=jobs.front();
+				jobs.pop_front();
+				jobQueueChanged.notify_all();
+			}
+
+			fitJob(item.second);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			results[item.first]=item.second;
+			resultAdded.notify_all();
+		}
+	}
+
+	/// Fit the metal of a job and compute the errors.
+	void fitJob(FitJob &job) const {
+		METALNESS_TRACE_SCOPE_DETAIL("fitJob", job.name.c_str());
+
+		PresetCurves &curves=job.curves;
+		fitMetal(job.n, job.k, curves, options);
+
+		job.result.name=NULL;
+		job.result.n=job.n;
+		job.result.k=job.k;
+		job.result.base=curves.base;
+		job.result.reflection=curves.reflection;
+		job.result.ior=curves.ior;
+		job.result.edgeTint=curves.edgeTint;
+
+		CurveErrors errors;
+		computeCurveErrors(curves, options, errors);
+		job.result.vrayError=errors.vray;
+		job.result.oleError=errors.ole;
+		job.result.f82Error=errors.f82;
+		job.result.schlickError=errors.schlick;
+		job.result.lazanyiError=errors.lazanyi;
+
+		ExtraModels::fit(job.n, job.k, options, job.extraFit);
+		ExtraModels::computeErrors(curves, options, job.extraFit);
+		job.extraErrors.assign(job.extraFit.errors, job.extraFit.errors+ExtraModels::numModels);
+
+		for (size_t i=0; i<expressions.size(); i++) {
+			Color params[maxModelParams];
+			fitExpression(expressions[i], job.n, job.k, params, options);
+			job.extraErrors.push_back(computeExpressionError(expressions[i], curves, params, options));
+		}
+	}
+
+	const FitOptions options;
+	const std::vector<FresnelExpression> &expressions;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobQueueChanged; ///< Signaled when jobs are added or taken.
+	std::condition_variable resultAdded; ///< Signaled when a result is ready or the input is finished.
+	std::deque<std::pair<int, FitJob> > jobs; ///< Jobs waiting for a worker, with their input index.
+	std::map<int, FitJob> results; ///< Finished jobs that were not returned yet, by input index.
+	int maxPendingJobs; ///< The maximum number of jobs waiting for a worker.
+	int numJobs; ///< The number of jobs added so far.
+	int nextResult; ///< The input index of the next result to return.
+	bool inputDone; ///< True after finishInput().
+};
+
+/// Parse a line with an optional name, followed by the n values and the k values for red, green and
+/// blue, separated by spaces, tabs or commas.
+/// @param line The line to parse.
+/// @param job Receives the name and the n and k values. If the line has no name, the name is not changed.
+/// @param error Receives a description of the problem with a malformed line.
+/// @return 1 if the line was parsed, 0 for empty and comment lines (starting with '#'), and -1 for
+/// malformed lines and for values that are not finite, n values that are not positive and negative k
+/// values.
+int parseMetalLine(const char *line, FitJob &job, std::string &error) {
+	std::vector<std::string> tokens;
+	std::string token;
+	for (const char *c=line; ; c++) {
+		if (*c=='\0' || *c==' ' || *c=='\t' || *c==',' || *c=='\r' || *c=='\n') {
+			if (!token.empty())
+				tokens.push_back(token);
+			token.clear();
+			if (*c=='\0')
+				break;
+		} else {
+			token+=*c;
+		}
+	}
+
+	if (tokens.empty() || tokens[0][0]=='#')
+		return 0;
+	if (tokens.size()<6) {
+		error="expected [name] n_red n_green n_blue k_red k_green k_blue";
+		return -1;
+	}
+
+	// Everything before the last six values is the name.
+	const size_t numNameTokens=tokens.size()-6;
+	float values[6];
+	for (int i=0; i<6; i++) {
+		const char *str=tokens[numNameTokens+i].c_str();
+		char *end=NULL;
+		values[i]=strtof(str, &end);
+		if (end==str || *end!='\0') {
+			error="expected [name] n_red n_green n_blue k_red k_green k_blue";
+			return -1;
+		}
+		if (!isfinite(values[i])) {
+			error=std::string("the values must be finite, got ")+str;
+			return -1;
+		}
+		if ((i<3 && values[i]<=0.0f) || values[i]<0.0f) {
+			error=std::string((i<3)? "the n values must be positive" : "the k values must not be negative")+", got "+str;
+			return -1;
+		}
+	}
+
+	if (numNameTokens>0) {
+		job.name=tokens[0];
+		for (size_t i=1; i<numNameTokens; i++)
+			job.name+=" "+tokens[i];
+	}
+	job.n=Color(values[0], values[1], values[2]);
+	job.k=Color(values[3], values[4], values[5]);
+	return 1;
+}
+
+/// Read metals from a file, one per line (see parseMetalLine()), and add them to the pipeline.
+/// Lines without a name are named after the file and the line number.
+/// @param fileName The file name, or "-" for the standard input.
+/// @return false if the file could not be opened or lines were skipped because they were malformed.
+bool readMetals(const char *fileName, FitPipeline &pipeline) {
+	const bool isStdin=(strcmp(fileName, "-")==0);
+	FILE *fp=isStdin? stdin : fopen(fileName, "rt");
+	if (!fp) {
+		fprintf(stderr, "Cannot open %s\n", fileName);
+		return false;
+	}
+
+	char line[4096];
+	int lineNumber=0;
+	bool ok=true;
+	while (fgets(line, sizeof(line), fp)) {
+		lineNumber++;
+
+		FitJob job;
+		char defaultName[64];
+		snprintf(defaultName, sizeof(defaultName), "%s:%d", isStdin? "stdin" : "line", lineNumber);
+		job.name=defaultName;
+
+		std::string error;
+		const int res=parseMetalLine(line, job, error);
+		if (res>0) {
+			pipeline.addJob(job);
+		} else if (res<0) {
+			fprintf(stderr, "%s:%d: %s, skipping the line\n", fileName, lineNumber, error.c_str());
+			ok=false;
+		}
+	}
+
+	if (!isStdin)
+		fclose(fp);
+	return ok;
+}
+
+void printUsage(void) {
+	fprintf(stderr,
+		"Usage: metalness [options] [input files]\n"
+		"\n"
+		"Fits VRayMtl settings (base and reflection colors, IOR) to the n and k values of metals and writes\n"
+		"the settings and the errors against the complex Fresnel curve, one line per metal. Results are written\n"
+		"in input order as soon as they are ready, so the tool can be used in pipelines.\n"
+		"\n"
+		"Inputs, processed in the order given; the built-in presets are used if there are none:\n"
+		"  <file>                  Read metals from a file, one per line: [name] n_r n_g n_b k_r k_g k_b\n"
+		"                          with values separated by spaces, tabs or commas; '#' starts a comment line.\n"
+		"  -                       Read metals from the standard input in the same format.\n"
+		"  --nk \"[name] n_r n_g n_b k_r k_g k_b\"\n"
+		"                          Fit a single metal.\n"
+		"  --presets               Fit the built-in presets.\n"
+		"\n"
+		"Malformed lines and values (n must be positive, k must not be negative) are reported and skipped;\n"
+		"the exit code is then 1, after all other inputs were processed.\n"
+		"\n"
+		"Options:\n"
+		"  --solver brute|coarse   The IOR search: all steps of 0.001 (default, reproduces the published\n"
+		"                          table), or steps of 0.01 refined with steps of 0.001 (about 9x faster).\n"
+		"  --ior-samples <n>       Number of viewing angles compared in the IOR search (default 200).\n"
+		"  --sampling adaptive|uniform\n"
+		"                          Sampling of the curves for the errors (default adaptive).\n"
+		"  --tolerance <t>         Tolerance for adaptive sampling (default %g).\n"
+		"  --error-samples <n>     Number of samples for uniform sampling (default 1600).\n"
+		"  --model-fit closed|lsq  How the Ole, F82-tint, Schlick and Lazanyi-Schlick models are fitted: with\n"
+		"                          the edge tint of formula 15 of Ole Gulbrandsen's paper and matched along\n"
+		"                          the normal and at about 82 degrees (default), or refined by least squares\n"
+		"                          over all angles.\n"
+		"  --threads <n>           Number of worker threads; 0 means one per processor (default 0).\n"
+		"  --format csv|tsv|json   Output format (default csv); json writes one object per line.\n"
+		"  --output <file>         Write the results to a file instead of the standard output.\n"
+		"  --swatches <file>       Also write a swatch table with all results as a BMP image.\n"
+		"  --shader <file>         Also write shader code with the results as constants and functions that\n"
+		"                          evaluate the curves; the language is taken from the file extension.\n"
+		"  --shader-language cpp|glsl|hlsl|osl\n"
+		"                          The language for --shader if the extension is not .h, .cpp, .glsl, .hlsl or .osl.\n"
+		"  --materialx <file>      Also write a MaterialX document with Standard Surface and OpenPBR Surface\n"
+		"                          materials; the base and specular colors are the reflectivity and the fitted\n"
+		"                          edge tint of Ole Gulbrandsen's model for Standard Surface and are fitted to\n"
+		"                          the F82-tint model for OpenPBR Surface.\n"
+		"  --materialx-models standard|openpbr|all\n"
+		"                          The materials for --materialx (default all).\n"
+		"  --formula \"<name>: <formula>\"\n"
+		"                          Also fit and compare a formula of n, k, the cosine c and fitted parameters,\n"
+		"                          f.e. \"schlick5: param f0=((n-1)^2+k^2)/((n+1)^2+k^2) in [0, 1]; f0+(1-f0)*(1-c)^5\";\n"
+		"                          see metalness_expression.h. Can be given several times.\n"
+		"  --error-matrix <file>   Also write a CSV file with the error of each model for each metal, computed\n"
+		"                          in one pass with uniform sampling and the --error-samples setting.\n"
+		"  --error-matrix-models <list>\n"
+		"                          Comma separated models for --error-matrix: vray, ole, f82, schlick,\n"
+		"                          lazanyi or all (default all).\n"
+		"  --albedo <file>         Also write a CSV file with the directional albedo of a GGX microfacet surface\n"
+		"                          for each metal, viewing angle and roughness, with the complex Fresnel curve\n"
+		"                          and with each model; see metalness_ggx.h.\n"
+		"  --albedo-errors <file>  Also write a CSV file with the root mean square albedo error of each model for\n"
+		"                          each metal, the rough surface counterpart of --error-matrix.\n"
+		"  --compensation <file>   Also write a binary LUT with the multiple scattering energy compensation\n"
+		"                          tables of a GGX microfacet surface and the average Fresnel reflectance of\n"
+		"                          each metal and model; see writeEnergyCompensationLUT() in metalness_ggx.h.\n"
+		"  --albedo-size <n>       The number of viewing angles and of roughness values of the albedo and\n"
+		"                          compensation tables (default %d).\n"
+		"  --albedo-samples <n>    The number of quasi-Monte Carlo samples for each table entry and of\n"
+		"                          cosines for the average Fresnel reflectance (default %d).\n"
+		"  --trace <file>          Write a Chrome trace with the time of each stage, metal and thread, and\n"
+		"                          print a summary; needs a build with METALNESS_TRACE defined.\n"
+		"  --perf <file>           Write the hardware performance counters of the IOR search, the curve\n"
+		"                          evaluation and the rasterization as JSON; needs a Linux build with\n"
+		"                          METALNESS_PERF defined.\n"
+		"  --help                  Show this help.\n",
+		defaultCurveTolerance, AlbedoTableOptions().numCosines, AlbedoTableOptions().numSamples
+	);
+}
+
+/// Headless entry point: a command-line tool that fits metals from the command line, files or the
+/// standard input and writes the results as CSV, TSV or JSON.
+int main(int argc, char *argv[]) {
+	FitOptions options;
+	int numThreads=0;
+	OutputFormat format=outputFormat_csv;
+	const char *outputFileName=NULL;
+	const char *swatchesFileName=NULL;
+	const char *shaderFileName=NULL;
+	const char *shaderLanguageName=NULL;
+	const char *materialXFileName=NULL;
+	int materialXModels=materialXModels_all;
+	std::vector<FresnelExpression> expressions;
+	const char *errorMatrixFileName=NULL;
+	std::vector<CurveModel> errorMatrixModels;
+	findCurveModels("all", errorMatrixModels);
+	const char *albedoFileName=NULL;
+	const char *albedoErrorsFileName=NULL;
+	const char *compensationFileName=NULL;
+	AlbedoTableOptions albedoOptions;
+#ifdef METALNESS_TRACE
+	const char *traceFileName=NULL;
+#endif
+#if defined(METALNESS_PERF) && defined(__linux__)
+	const char *perfFileName=NULL;
+#endif
+
+	// The inputs, in command-line order: "--nk", "--presets" or a file name, with an argument for "--nk".
+	std::vector<std::pair<std::string, std::string> > inputs;
+
+	for (int i=1; i<argc; i++) {
+		const std::string arg=argv[i];
+		const bool hasValue=(i+1<argc);
+		const char *value=hasValue? argv[i+1] : "";
+
+		if (arg=="--help" || arg=="-h") {
+			printUsage();
+			return 0;
+		} else if (arg=="--presets") {
+			inputs.push_back(std::make_pair(arg, std::string()));
+			continue;
+		} else if (arg.size()<2 || arg[0]!='-' || arg[1]!='-') {
+			inputs.push_back(std::make_pair(std::string("--file"), arg));
+			continue;
+		}
+
+		if (!hasValue) {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return 1;
+		}
+		i++;
+
+		if (arg=="--nk") {
+			inputs.push_back(std::make_pair(arg, std::string(value)));
+		} else if (arg=="--solver") {
+			if (strcmp(value, "brute")==0) options.solver=iorSolver_bruteForce;
+			else if (strcmp(value, "coarse")==0) options.solver=iorSolver_coarseToFine;
+			else { fprintf(stderr, "Unknown solver %s\n", value); return 1; }
+		} else if (arg=="--ior-samples") {
+			options.numIORSamples=clamp(atoi(value), 2, maxIORSamples);
+		} else if (arg=="--sampling") {
+			if (strcmp(value, "adaptive")==0) options.errorSampling=curveSampling_adaptive;
+			else if (strcmp(value, "uniform")==0) options.errorSampling=curveSampling_uniform;
+			else { fprintf(stderr, "Unknown sampling %s\n", value); return 1; }
+		} else if (arg=="--tolerance") {
+			options.tolerance=float(atof(value));
+		} else if (arg=="--error-samples") {
+			options.numUniformSamples=atoi(value);
+		} else if (arg=="--model-fit") {
+			if (strcmp(value, "closed")==0) options.modelFit=modelFit_closedForm;
+			else if (strcmp(value, "lsq")==0) options.modelFit=modelFit_leastSquares;
+			else { fprintf(stderr, "Unknown model fit %s\n", value); return 1; }
+		} else if (arg=="--threads") {
+			numThreads=atoi(value);
+		} else if (arg=="--format") {
+			if (strcmp(value, "csv")==0) format=outputFormat_csv;
+			else if (strcmp(value, "tsv")==0) format=outputFormat_tsv;
+			else if (strcmp(value, "json")==0) format=outputFormat_json;
+			else { fprintf(stderr, "Unknown format %s\n", value); return 1; }
+		} else if (arg=="--output") {
+			outputFileName=value;
+		} else if (arg=="--swatches") {
+			swatchesFileName=value;
+		} else if (arg=="--shader") {
+			shaderFileName=value;
+		} else if (arg=="--shader-language") {
+			shaderLanguageName=value;
+		} else if (arg=="--materialx") {
+			materialXFileName=value;
+		} else if (arg=="--materialx-models") {
+			if (!findMaterialXModels(value, materialXModels)) { fprintf(stderr, "Unknown MaterialX models %s\n", value); return 1; }
+		} else if (arg=="--formula") {
+			const char *colon=strchr(value, ':');
+			if (!colon || colon==value) { fprintf(stderr, "Expected \"<name>: <formula>\" for --formula\n"); return 1; }
+			std::string error;
+			expressions.push_back(FresnelExpression());
+			if (!expressions.back().compile(std::string(value, colon).c_str(), colon+1, error)) {
+				fprintf(stderr, "Cannot compile formula %s: %s\n", expressions.back().getName(), error.c_str());
+				return 1;
+			}
+		} else if (arg=="--error-matrix") {
+			errorMatrixFileName=value;
+		} else if (arg=="--error-matrix-models") {
+			if (!findCurveModels(value, errorMatrixModels)) { fprintf(stderr, "Unknown models %s\n", value); return 1; }
+		} else if (arg=="--albedo") {
+			albedoFileName=value;
+		} else if (arg=="--albedo-errors") {
+			albedoErrorsFileName=value;
+		} else if (arg=="--compensation") {
+			compensationFileName=value;
+		} else if (arg=="--albedo-size") {
+			albedoOptions.numCosines=albedoOptions.numRoughness=clamp(atoi(value), 1, 1024);
+		} else if (arg=="--albedo-samples") {
+			albedoOptions.numSamples=clamp(atoi(value), 1, 1<<20);
+		} else if (arg=="--trace") {
+#ifdef METALNESS_TRACE
+			traceFileName=value;
+#else
+			fprintf(stderr, "--trace needs a build with METALNESS_TRACE defined\n");
+			return 1;
+#endif
+		} else if (arg=="--perf") {
+#if defined(METALNESS_PERF) && defined(__linux__)
+			perfFileName=value;
+#else
+			fprintf(stderr, "--perf needs a Linux build with METALNESS_PERF defined\n");
+			return 1;
+#endif
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+	}
+
+	ShaderLanguage shaderLanguage=shaderLanguage_cpp;
+	if (shaderFileName && !findShaderLanguage(shaderLanguageName? shaderLanguageName : shaderFileName, shaderLanguage)) {
+		fprintf(stderr, "Unknown shader language for %s; use --shader-language\n", shaderLanguageName? shaderLanguageName : shaderFileName);
+		return 1;
+	}
+
+	if (inputs.empty())
+		inputs.push_back(std::make_pair(std::string("--presets"), std::string()));
+
+	FILE *fp=stdout;
+	if (outputFileName) {
+		fp=fopen(outputFileName, "wt");
+		if (!fp) {
+			fprintf(stderr, "Cannot open %s for writing\n", outputFileName);
+			return 1;
+		}
+	}
+
+	METALNESS_TRACE_THREAD_NAME("main");
+	FitPipeline pipeline(options, expressions, numThreads);
+
+	// Read the inputs on a separate thread, so that results are written while the input is still
+	// coming in, f.e. from a pipe.
+	bool inputOk=true;
+	std::thread reader([&inputs, &pipeline, &inputOk]() {
+		METALNESS_TRACE_THREAD_NAME("reader");
+		for (size_t i=0; i<inputs.size(); i++) {
+			const std::string &type=inputs[i].first;
+			if (type=="--presets") {
+				for (int presetIdx=0; presetIdx<metalPreset_last; presetIdx++) {
+					FitJob job;
+					job.name=metalPresets[presetIdx].name;
+					job.n=metalPresets[presetIdx].n;
+					job.k=metalPresets[presetIdx].k;
+					pipeline.addJob(job);
+				}
+			} else if (type=="--nk") {
+				FitJob job;
+				job.name="metal";
+				std::string error;
+				if (parseMetalLine(inputs[i].second.c_str(), job, error)>0) {
+					pipeline.addJob(job);
+				} else {
+					fprintf(stderr, "Cannot parse --nk \"%s\": %s\n", inputs[i].second.c_str(), error.empty()? "no values" : error.c_str());
+					inputOk=false;
+				}
+			} else if (!readMetals(inputs[i].second.c_str(), pipeline)) {
+				inputOk=false;
+			}
+		}
+		pipeline.finishInput();
+	});
+
+	// The extra error columns: the ExtraModels and then the formulas.
+	std::vector<const char*> extraNames(ExtraModels::getNames(), ExtraModels::getNames()+ExtraModels::numModels);
+	std::vector<const char*> extraLabels(ExtraModels::getLabels(), ExtraModels::getLabels()+ExtraModels::numModels);
+	for (size_t i=0; i<expressions.size(); i++) {
+		extraNames.push_back(expressions[i].getName());
+		extraLabels.push_back(expressions[i].getName());
+	}
+	const int numExtraModels=int(extraNames.size());
+	auto setExtraErrors=[&extraNames, &extraLabels, numExtraModels](const FitJob &fitJob, PresetResult &result) {
+		result.numExtraModels=numExtraModels;
+		result.extraModelNames=numExtraModels>0? &extraNames[0] : NULL;
+		result.extraModelLabels=numExtraModels>0? &extraLabels[0] : NULL;
+		result.extraErrors=numExtraModels>0? &fitJob.extraErrors[0] : NULL;
+	};
+
+	if (format==outputFormat_csv) writeCSVHeader(fp, ", ", numExtraModels>0? &extraLabels[0] : NULL, numExtraModels);
+	else if (format==outputFormat_tsv) writeCSVHeader(fp, "\t", numExtraModels>0? &extraLabels[0] : NULL, numExtraModels);
+
+	std::deque<FitJob> allResults;
+	FitJob job;
+	while (pipeline.getNextResult(job)) {
+		job.result.name=job.name.c_str();
+		setExtraErrors(job, job.result);
+		if (format==outputFormat_csv) writeCSVLine(fp, job.result);
+		else if (format==outputFormat_tsv) writeCSVLine(fp, job.result, "\t");
+		else writeJSONLine(fp, job.result);
+		fflush(fp);
+
+		if (swatchesFileName || shaderFileName || materialXFileName || errorMatrixFileName || albedoFileName || albedoErrorsFileName || compensationFileName)
+			allResults.push_back(job);
+	}
+	reader.join();
+
+	if (fp!=stdout)
+		fclose(fp);
+
+	std::vector<PresetResult> results(allResults.size());
+	for (size_t i=0; i<allResults.size(); i++) {
+		results[i]=allResults[i].result;
+		results[i].name=allResults[i].name.c_str();
+		setExtraErrors(allResults[i], results[i]);
+	}
+
+	if (swatchesFileName && !saveSwatchTable(swatchesFileName, results.empty()? NULL : &results[0], int(results.size()))) {
+		fprintf(stderr, "Cannot write %s\n", swatchesFileName);
+		return 1;
+	}
+
+	if (shaderFileName) {
+		FILE *shaderFile=fopen(shaderFileName, "wt");
+		if (!shaderFile) {
+			fprintf(stderr, "Cannot write %s\n", shaderFileName);
+			return 1;
+		}
+		writeShaderCode(shaderFile, shaderLanguage, results.empty()? NULL : &results[0], int(results.size()));
+		fclose(shaderFile);
+	}
+
+	if (materialXFileName) {
+		FILE *materialXFile=fopen(materialXFileName, "wt");
+		if (!materialXFile) {
+			fprintf(stderr, "Cannot write %s\n", materialXFileName);
+			return 1;
+		}
+		writeMaterialX(materialXFile, results.empty()? NULL : &results[0], int(results.size()), materialXModels, numThreads);
+		fclose(materialXFile);
+	}
+
+	if (errorMatrixFileName) {
+		FILE *errorMatrixFile=fopen(errorMatrixFileName, "wt");
+		if (!errorMatrixFile) {
+			fprintf(stderr, "Cannot write %s\n", errorMatrixFileName);
+			return 1;
+		}
+		const int count=int(results.size());
+		const int numModels=int(errorMatrixModels.size());
+		std::vector<const char*> names(count);
+		std::vector<PresetCurves> curves(count);
+		for (int i=0; i<count; i++) {
+			names[i]=results[i].name;
+			curves[i]=allResults[i].curves;
+		}
+		std::vector<double> errors(numModels*count);
+		if (count>0)
+			computeErrorMatrix(&curves[0], count, &errorMatrixModels[0], numModels, options.numUniformSamples, &errors[0], numThreads);
+		writeErrorMatrix(errorMatrixFile, count>0? &names[0] : NULL, count, &errorMatrixModels[0], numModels, count>0? &errors[0] : NULL);
+		fclose(errorMatrixFile);
+	}
+
+	if (albedoFileName || albedoErrorsFileName) {
+		FILE *albedoFile=NULL;
+		if (albedoFileName) {
+			albedoFile=fopen(albedoFileName, "wt");
+			if (!albedoFile) {
+				fprintf(stderr, "Cannot write %s\n", albedoFileName);
+				return 1;
+			}
+			writeAlbedoTableHeader(albedoFile);
+		}
+
+		// The tables of one metal at a time are kept; the entries of each are computed in parallel.
+		const int count=int(results.size());
+		std::vector<const char*> names(count);
+		std::vector<double> errors(curveModel_last*count);
+		AlbedoTables tables;
+		for (int i=0; i<count; i++) {
+			names[i]=results[i].name;
+			computeAlbedoTables(allResults[i].curves, albedoOptions, tables, numThreads);
+			if (albedoFile)
+				writeAlbedoTables(albedoFile, names[i], tables);
+
+			double metalErrors[curveModel_last];
+			getAlbedoErrors(tables, metalErrors);
+			for (int m=0; m<curveModel_last; m++)
+				errors[m*count+i]=metalErrors[m];
+		}
+		if (albedoFile)
+			fclose(albedoFile);
+
+		if (albedoErrorsFileName) {
+			FILE *albedoErrorsFile=fopen(albedoErrorsFileName, "wt");
+			if (!albedoErrorsFile) {
+				fprintf(stderr, "Cannot write %s\n", albedoErrorsFileName);
+				return 1;
+			}
+			std::vector<CurveModel> models;
+			findCurveModels("all", models);
+			writeErrorMatrix(albedoErrorsFile, count>0? &names[0] : NULL, count, &models[0], curveModel_last, count>0? &errors[0] : NULL);
+			fclose(albedoErrorsFile);
+		}
+	}
+
+	if (compensationFileName) {
+		FILE *compensationFile=fopen(compensationFileName, "wb");
+		if (!compensationFile) {
+			fprintf(stderr, "Cannot write %s\n", compensationFileName);
+			return 1;
+		}
+		const int count=int(results.size());
+		std::vector<const char*> names(count);
+		std::vector<PresetCurves> curves(count);
+		for (int i=0; i<count; i++) {
+			names[i]=results[i].name;
+			curves[i]=allResults[i].curves;
+		}
+		EnergyCompensationTables tables;
+		computeEnergyCompensationTables(albedoOptions, tables, numThreads);
+		std::vector<AverageFresnel> averages(count);
+		if (count>0)
+			computeAverageFresnel(&curves[0], count, albedoOptions.numSamples, &averages[0], numThreads);
+		writeEnergyCompensationLUT(compensationFile, tables, count>0? &names[0] : NULL, count>0? &averages[0] : NULL, count);
+		fclose(compensationFile);
+	}
+
+#ifdef METALNESS_TRACE
+	if (traceFileName) {
+		if (!saveChromeTrace(traceFileName)) {
+			fprintf(stderr, "Cannot write %s\n", traceFileName);
+			return 1;
+		}
+		writeTraceSummary(stderr);
+	}
+#endif
+
+#if defined(METALNESS_PERF) && defined(__linux__)
+	if (perfFileName) {
+		FILE *perfFile=fopen(perfFileName, "wt");
+		if (!perfFile) {
+			fprintf(stderr, "Cannot write %s\n", perfFileName);
+			return 1;
+		}
+		writePerfReport(perfFile);
+		fclose(perfFile);
+	}
+#endif
+
+	return inputOk? 0 : 1;
+}
+
+#endif // METALNESS_HEADLESS
@@ -0,0 +1,215 @@
+/// @file Implementation of the C API in metalness_api.h on top of metalness_core.h.
+
+#ifndef METALNESS_BUILD_LIBRARY
+#define METALNESS_BUILD_LIBRARY
+#endif
+
+#include <limits.h>
+
+#include "metalness_api.h"
+#include "metalness_core.h"
+
+static Color toColor(const metalness_rgb &c) {
+	return Color(c.r, c.g, c.b);
+}
+
+static metalness_rgb toRGB(const Color &c) {
+	metalness_rgb result;
+	result.r=c.r;
+	result.g=c.g;
+	result.b=c.b;
+	return result;
+}
+
+int metalness_api_version(void) {
+	return METALNESS_API_VERSION;
+}
+
+float metalness_complex_fresnel(float n, float k, float cos_theta) {
+	return complexFresnel(n, k, cos_theta);
+}
+
+float metalness_ole_fresnel(float r, float g, float cos_theta) {
+	return olefresnel(r, g, cos_theta);
+}
+
+float metalness_vray_fresnel(float base, float reflection, float ior, float cos_theta) {
+	const float f=getVRayFresnelCoeff(ior, cos_theta);
+	return base*(1.0f-f)+reflection*f;
+}
+
+int metalness_complex_fresnel_batch(const float *n, const float *k, const float *cos_theta, float *result, size_t count, int num_threads) {
+	if (!n || !k || !cos_theta || !result)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			result[i]=complexFresnel(n[i], k[i], cos_theta[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_ole_fresnel_batch(const float *r, const float *g, const float *cos_theta, float *result, size_t count, int num_threads) {
+	if (!r || !g || !cos_theta || !result)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			result[i]=olefresnel(r[i], g[i], cos_theta[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_vray_fresnel_batch(const float *base, const float *reflection, const float *ior, const float *cos_theta, float *result, size_t count, int num_threads) {
+	if (!base || !reflection || !ior || !cos_theta || !result)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			result[i]=metalness_vray_fresnel(base[i], reflection[i], ior[i], cos_theta[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_ole_from_nk(float n, float k, float *r, float *g) {
+	if (!r || !g)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	*r=get_r(n, k);
+	*g=get_g(n, k);
+	return METALNESS_OK;
+}
+
+int metalness_nk_from_ole(float r, float g, float *n, float *k) {
+	if (!n || !k)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	// Same clamping as in olefresnel().
+	const float _r=clamp(r, 0.0f, 0.99f);
+	*n=get_n(_r, g);
+	const float k2=get_k2(_r, *n);
+	*k=(k2>0.0f)? sqrtf(k2) : 0.0f;
+	return METALNESS_OK;
+}
+
+int metalness_ole_edge_tint(const metalness_rgb *base, const metalness_rgb *n, metalness_rgb *edge_tint) {
+	if (!base || !n || !edge_tint)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	*edge_tint=toRGB(getOleEdgeTint(toColor(*base), toColor(*n)));
+	return METALNESS_OK;
+}
+
+int metalness_find_ior(const metalness_rgb *n, const metalness_rgb *k, float *ior) {
+	if (!n || !k || !ior)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	*ior=findIOR(toColor(*n), toColor(*k));
+	return METALNESS_OK;
+}
+
+int metalness_find_ior_batch(const metalness_rgb *n, const metalness_rgb *k, float *ior, size_t count, int num_threads) {
+	if (!n || !k || !ior || count>size_t(INT_MAX))
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelFor(int(count), num_threads, [=](int i) {
+		ior[i]=findIOR(toColor(n[i]), toColor(k[i]));
+	});
+	return METALNESS_OK;
+}
+
+int metalness_ole_from_nk_batch(const float *n, const float *k, float *r, float *g, size_t count, int num_threads) {
+	if (!n || !k || !r || !g)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			metalness_ole_from_nk(n[i], k[i], &r[i], &g[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_nk_from_ole_batch(const float *r, const float *g, float *n, float *k, size_t count, int num_threads) {
+	if (!r || !g || !n || !k)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			metalness_nk_from_ole(r[i], g[i], &n[i], &k[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_fit(const metalness_rgb *n, const metalness_rgb *k, metalness_fit_result *result) {
+	if (!n || !k || !result)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	PresetCurves curves;
+	fitMetal(toColor(*n), toColor(*k), curves);
+
+	CurveErrors errors;
+	computeCurveErrors(curves, FitOptions(), errors);
+
+	result->base=toRGB(curves.base);
+	result->reflection=toRGB(curves.reflection);
+	result->edge_tint=toRGB(curves.edgeTint);
+	result->ior=curves.ior;
+	result->vray_error=float(errors.vray);
+	result->ole_error=float(errors.ole);
+	return METALNESS_OK;
+}
+
+int metalness_fit_batch(const metalness_rgb *n, const metalness_rgb *k, metalness_fit_result *results, size_t count, int num_threads) {
+	if (!n || !k || !results || count>size_t(INT_MAX))
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	// Fitting one metal takes much longer than starting a thread, so each metal is a separate work item.
+	parallelFor(int(count), num_threads, [=](int i) {
+		metalness_fit(&n[i], &k[i], &results[i]);
+	});
+	return METALNESS_OK;
+}
+
+float metalness_f82_tint_fresnel(float f0, float tint, float cos_theta) {
+	return f82TintFresnel(f0, tint, cos_theta);
+}
+
+int metalness_f82_tint_fresnel_batch(const float *f0, const float *tint, const float *cos_theta, float *result, size_t count, int num_threads) {
+	if (!f0 || !tint || !cos_theta || !result)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++)
+			result[i]=f82TintFresnel(f0[i], tint[i], cos_theta[i]);
+	});
+	return METALNESS_OK;
+}
+
+int metalness_f82_tint_fit_batch(const metalness_rgb *n, const metalness_rgb *k, metalness_rgb *f0, metalness_rgb *tint, size_t count, int num_threads) {
+	if (!n || !k || !f0 || !tint)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	parallelForBlocks(count, num_threads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++) {
+			const Color nc=toColor(n[i]);
+			const Color kc=toColor(k[i]);
+			f0[i]=toRGB(getComplexFresnel(nc, kc, 1.0f));
+			tint[i]=toRGB(getF82Tint(nc, kc));
+		}
+	});
+	return METALNESS_OK;
+}
+
+int metalness_preset_count(void) {
+	return metalPreset_last;
+}
+
+int metalness_preset(int index, const char **name, metalness_rgb *n, metalness_rgb *k) {
+	if (index<0 || index>=metalPreset_last)
+		return METALNESS_ERROR_INVALID_ARGUMENT;
+
+	if (name) *name=metalPresets[index].name;
+	if (n) *n=toRGB(metalPresets[index].n);
+	if (k) *k=toRGB(metalPresets[index].k);
+	return METALNESS_OK;
+}
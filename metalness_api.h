@@ -0,0 +1,186 @@
+/// @file C API for the metalness computations: the complex, VRayMtl and Ole Gulbrandsen's metallic Fresnel
+/// curves, fitting VRayMtl settings to measured n and k values, and conversions between n and k and Ole's
+/// artist-friendly parameters. Meant for use from renderer plugins, converters and other languages.
+///
+/// All functions are reentrant and may be called concurrently from different threads. The caller owns all
+/// buffers; the functions never keep pointers to them after returning. When called with num_threads=1, the
+/// batch functions work on the calling thread and do not allocate any memory.
+///
+/// To build the library on Linux, type
+///
+/// g++ -O2 -std=c++14 -shared -fPIC metalness_api.cpp metalness_core.cpp -o libmetalness.so -pthread
+///
+/// On Windows, in a MSVS command-line prompt, type
+///
+/// cl /O2 /LD /DMETALNESS_NO_VRAY_SDK /DMETALNESS_BUILD_LIBRARY metalness_api.cpp metalness_core.cpp /Fe:metalness.dll
+///
+/// Programs that link the library statically should define METALNESS_STATIC.
+
+#ifndef METALNESS_API_H
+#define METALNESS_API_H
+
+#include <stddef.h>
+
+#if defined(METALNESS_STATIC)
+#define METALNESS_API
+#elif defined(_WIN32)
+#ifdef METALNESS_BUILD_LIBRARY
+#define METALNESS_API __declspec(dllexport)
+#else
+#define METALNESS_API __declspec(dllimport)
+#endif
+#else
+#define METALNESS_API __attribute__((visibility("default")))
+#endif
+
+/// The version of the API described by this header. Incremented only when functions are added; existing
+/// functions and structures do not change.
+#define METALNESS_API_VERSION 3
+
+/// Return codes.
+#define METALNESS_OK 0 ///< Success.
+#define METALNESS_ERROR_INVALID_ARGUMENT (-1) ///< A required pointer was NULL or an argument was out of range.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Values for the red, green and blue wavelengths (0.65, 0.55, 0.45 micrometers).
+typedef struct metalness_rgb {
+	float r, g, b;
+} metalness_rgb;
+
+/// VRayMtl settings fitted to the n and k values of a metal, along with the average errors.
+typedef struct metalness_fit_result {
+	metalness_rgb base; ///< The base reflection color, when looking directly at the surface along the normal.
+	metalness_rgb reflection; ///< The reflection color at 90 degrees.
+	metalness_rgb edge_tint; ///< The edge tint for Ole Gulbrandsen's metallic Fresnel.
+	float ior; ///< The VRayMtl IOR that best matches the complex Fresnel curve.
+	float vray_error; ///< The root mean square error of the VRayMtl metallic Fresnel curve.
+	float ole_error; ///< The root mean square error of Ole Gulbrandsen's metallic Fresnel curve.
+} metalness_fit_result;
+
+/// Return the API version of the library, METALNESS_API_VERSION at the time it was built.
+METALNESS_API int metalness_api_version(void);
+
+/// Complex Fresnel reflectance for one wavelength.
+/// @param n The n value.
+/// @param k The k value.
+/// @param cos_theta The cosine between the viewing direction and the surface normal.
+METALNESS_API float metalness_complex_fresnel(float n, float k, float cos_theta);
+
+/// Artist-friendly metallic Fresnel by Ole Gulbrandsen for one wavelength.
+/// @param r The base reflection strength (when looking directly at the surface along the normal).
+/// @param g The edge tint.
+/// @param cos_theta The cosine between the viewing direction and the surface normal.
+METALNESS_API float metalness_ole_fresnel(float r, float g, float cos_theta);
+
+/// The metallic Fresnel of the VRayMtl material for one wavelength.
+/// @param base The base color.
+/// @param reflection The reflection color.
+/// @param ior The index of refraction.
+/// @param cos_theta The cosine between the viewing direction and the surface normal.
+METALNESS_API float metalness_vray_fresnel(float base, float reflection, float ior, float cos_theta);
+
+/// Batch version of metalness_complex_fresnel(): result[i]=metalness_complex_fresnel(n[i], k[i], cos_theta[i]).
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_complex_fresnel_batch(const float *n, const float *k, const float *cos_theta, float *result, size_t count, int num_threads);
+
+/// Batch version of metalness_ole_fresnel(): result[i]=metalness_ole_fresnel(r[i], g[i], cos_theta[i]).
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_ole_fresnel_batch(const float *r, const float *g, const float *cos_theta, float *result, size_t count, int num_threads);
+
+/// Batch version of metalness_vray_fresnel():
+/// result[i]=metalness_vray_fresnel(base[i], reflection[i], ior[i], cos_theta[i]).
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_vray_fresnel_batch(const float *base, const float *reflection, const float *ior, const float *cos_theta, float *result, size_t count, int num_threads);
+
+/// Convert n and k values to Ole Gulbrandsen's base reflection strength (r) and edge tint (g).
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_ole_from_nk(float n, float k, float *r, float *g);
+
+/// Convert Ole Gulbrandsen's base reflection strength (r) and edge tint (g) to n and k values.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_nk_from_ole(float r, float g, float *n, float *k);
+
+/// Compute Ole Gulbrandsen's edge tint from the base reflection color and n values (formula 15 in
+/// https://jcgt.org/published/0003/04/03/paper.pdf).
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_ole_edge_tint(const metalness_rgb *base, const metalness_rgb *n, metalness_rgb *edge_tint);
+
+/// Find the VRayMtl IOR that gives the closest match to the complex Fresnel curve.
+/// @param ior The resulting IOR.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_find_ior(const metalness_rgb *n, const metalness_rgb *k, float *ior);
+
+/// Batch version of metalness_find_ior() for count metals.
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL or count is more than
+/// INT_MAX.
+/// @since API version 2.
+METALNESS_API int metalness_find_ior_batch(const metalness_rgb *n, const metalness_rgb *k, float *ior, size_t count, int num_threads);
+
+/// Batch version of metalness_ole_from_nk(): converts count values.
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+/// @since API version 2.
+METALNESS_API int metalness_ole_from_nk_batch(const float *n, const float *k, float *r, float *g, size_t count, int num_threads);
+
+/// Batch version of metalness_nk_from_ole(): converts count values.
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+/// @since API version 2.
+METALNESS_API int metalness_nk_from_ole_batch(const float *r, const float *g, float *n, float *k, size_t count, int num_threads);
+
+/// Fit the VRayMtl settings to the n and k values of a metal and compute the average errors of the fit.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+METALNESS_API int metalness_fit(const metalness_rgb *n, const metalness_rgb *k, metalness_fit_result *result);
+
+/// Batch version of metalness_fit() for count metals.
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL or count is more than
+/// INT_MAX.
+METALNESS_API int metalness_fit_batch(const metalness_rgb *n, const metalness_rgb *k, metalness_fit_result *results, size_t count, int num_threads);
+
+/// The F82-tint metallic Fresnel of the Autodesk Standard Surface and OpenPBR materials for one wavelength.
+/// @param f0 The reflectance along the normal (the base color).
+/// @param tint The tint at about 82 degrees (the specular color).
+/// @param cos_theta The cosine between the viewing direction and the surface normal.
+/// @since API version 3.
+METALNESS_API float metalness_f82_tint_fresnel(float f0, float tint, float cos_theta);
+
+/// Batch version of metalness_f82_tint_fresnel(): result[i]=metalness_f82_tint_fresnel(f0[i], tint[i], cos_theta[i]).
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+/// @since API version 3.
+METALNESS_API int metalness_f82_tint_fresnel_batch(const float *f0, const float *tint, const float *cos_theta, float *result, size_t count, int num_threads);
+
+/// Fit the base color and the specular color of the F82-tint metallic Fresnel to the n and k values of
+/// count metals, so that it matches the complex Fresnel curve along the normal and at about 82 degrees.
+/// @param f0 Receives the base colors.
+/// @param tint Receives the specular colors, clamped to [0, 1].
+/// @param num_threads The number of threads to use; 0 means one thread per logical processor.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if a pointer is NULL.
+/// @since API version 3.
+METALNESS_API int metalness_f82_tint_fit_batch(const metalness_rgb *n, const metalness_rgb *k, metalness_rgb *f0, metalness_rgb *tint, size_t count, int num_threads);
+
+/// Return the number of built-in metal presets.
+METALNESS_API int metalness_preset_count(void);
+
+/// Get a built-in metal preset.
+/// @param index The index of the preset, from 0 to metalness_preset_count()-1.
+/// @param name Receives a pointer to the name of the preset, which is valid for the lifetime of the library;
+/// may be NULL.
+/// @param n Receives the n values; may be NULL.
+/// @param k Receives the k values; may be NULL.
+/// @return METALNESS_OK, or METALNESS_ERROR_INVALID_ARGUMENT if the index is out of range.
+METALNESS_API int metalness_preset(int index, const char **name, metalness_rgb *n, metalness_rgb *k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // METALNESS_API_H
@@ -0,0 +1,1041 @@
+/// @file Benchmarks for the Fresnel curves and the fitting code. Run with a suite name and options:
+///
+/// metalness_bench kernels [options]
+///     Time each Fresnel kernel (scalar, color and the batch functions of the C API) and each fitting
+///     function over inputs drawn from the metal presets.
+///
+/// metalness_bench pareto [options]
+///     Run every IOR solver and error sampling configuration over the presets and random metals and
+///     report the time, the number of curve evaluations and the accuracy against a double precision
+///     reference (see metalness_reference.h), with the configurations on the Pareto front marked.
+///
+/// metalness_bench scaling [options]
+///     Run the whole pipeline of the command-line tool (fitting, error evaluation, rendering of the swatch
+///     table and output) over a large generated set of metals with 1, 2, 4, ... up to --max-threads threads
+///     and report the time of each stage with the speedup and the parallel efficiency against one thread.
+///
+/// The results of the kernels suite are written as JSON, one benchmark per line, with the time per evaluation (median, mean,
+/// standard deviation and minimum over the runs), the evaluations per second and the coefficient of
+/// variation. With --baseline, the medians are compared to a previous result file and the program exits
+/// with code 2 if any benchmark is slower by more than --max-regression, so that it can gate changes. For the
+/// scaling suite, the parallel efficiency of each stage and thread count is compared instead, so that
+/// changes that stop the pipeline from scaling are caught even if the single-thread speed is the same.
+///
+/// To build the benchmarks on Linux, type
+///
+/// g++ -O2 -std=c++14 -DMETALNESS_STATIC metalness_bench.cpp metalness_core.cpp metalness_expression.cpp metalness_ggx.cpp metalness_api.cpp metalness_report.cpp -o metalness_bench -pthread
+///
+/// On Windows, in a MSVS command-line prompt, type
+///
+/// cl /O2 /DMETALNESS_NO_VRAY_SDK /DMETALNESS_STATIC metalness_bench.cpp metalness_core.cpp metalness_expression.cpp metalness_ggx.cpp metalness_api.cpp metalness_report.cpp
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metalness_api.h"
+#include "metalness_core.h"
+#include "metalness_expression.h"
+#include "metalness_ggx.h"
+#include "metalness_models.h"
+#include "metalness_reference.h"
+#include "metalness_report.h"
+
+/// The timings of one benchmark.
+struct BenchmarkResult {
+	std::string name; ///< The name of the benchmark.
+	size_t evalsPerRun; ///< The number of evaluations in each run.
+	std::vector<double> nsPerEval; ///< The time per evaluation in nanoseconds, for each run.
+
+	double getMedian(void) const {
+		std::vector<double> sorted=nsPerEval;
+		std::sort(sorted.begin(), sorted.end());
+		const size_t count=sorted.size();
+		return (count%2)? sorted[count/2] : 0.5*(sorted[count/2-1]+sorted[count/2]);
+	}
+
+	double getMean(void) const {
+		double sum=0.0;
+		for (size_t i=0; i<nsPerEval.size(); i++)
+			sum+=nsPerEval[i];
+		return sum/double(nsPerEval.size());
+	}
+
+	double getStdDev(void) const {
+		const double mean=getMean();
+		double sum=0.0;
+		for (size_t i=0; i<nsPerEval.size(); i++)
+			sum+=(nsPerEval[i]-mean)*(nsPerEval[i]-mean);
+		return nsPerEval.size()>1? sqrt(sum/double(nsPerEval.size()-1)) : 0.0;
+	}
+
+	double getMin(void) const {
+		return *std::min_element(nsPerEval.begin(), nsPerEval.end());
+	}
+};
+
+/// Options shared by all suites.
+struct BenchmarkOptions {
+	int numRuns; ///< The number of timed runs of each benchmark, after one warm-up run.
+	size_t numInputs; ///< The number of inputs for the kernel benchmarks.
+	const char *filter; ///< Only run benchmarks with names that contain this string, if not NULL.
+	unsigned seed; ///< The seed for the random inputs.
+
+	BenchmarkOptions(void):numRuns(10), numInputs(1<<16), filter(NULL), seed(1) {}
+};
+
+/// The results of all benchmarks, and the options with which they were run.
+class BenchmarkSuite {
+public:
+	BenchmarkSuite(const BenchmarkOptions &options):options(options) {}
+
+	/// Time a benchmark, if it passes the filter.
+	/// @param name The name of the benchmark.
+	/// @param evalsPerRun The number of evaluations that one call of func does.
+	/// @param func Does the evaluations and returns a value that depends on all of them, so that the
+	/// compiler cannot skip any.
+	template<class Func>
+	void run(const char *name, size_t evalsPerRun, const Func &func) {
+		if (options.filter && !strstr(name, options.filter))
+			return;
+
+		BenchmarkResult result;
+		result.name=name;
+		result.evalsPerRun=evalsPerRun;
+
+		sink+=func(); // Warm up the caches and the branch predictors.
+		for (int run=0; run<options.numRuns; run++) {
+			const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+			sink+=func();
+			const std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+			const double ns=double(std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count());
+			result.nsPerEval.push_back(ns/double(evalsPerRun));
+		}
+
+		fprintf(stderr, "%-48s %12.2f ns/eval\n", name, result.getMedian());
+		results.push_back(result);
+	}
+
+	/// Write the results as JSON, one benchmark per line.
+	void writeJSON(FILE *fp, const char *suiteName) const {
+		fprintf(fp, "{\"suite\": \"%s\", \"runs\": %d, \"results\": [\n", suiteName, options.numRuns);
+		for (size_t i=0; i<results.size(); i++) {
+			const BenchmarkResult &r=results[i];
+			const double median=r.getMedian();
+			const double mean=r.getMean();
+			const double stdDev=r.getStdDev();
+			fprintf(fp,
+				"{\"name\": \"%s\", \"evals_per_run\": %llu, \"ns_per_eval\": %.6g, \"mean_ns\": %.6g, \"stddev_ns\": %.6g, \"min_ns\": %.6g, \"evals_per_second\": %.6g, \"cv\": %.4g}%s\n",
+				r.name.c_str(), (unsigned long long) r.evalsPerRun, median, mean, stdDev, r.getMin(), 1e9/median, mean>0.0? stdDev/mean : 0.0,
+				i+1<results.size()? "," : ""
+			);
+		}
+		fprintf(fp, "]}\n");
+	}
+
+	/// Compare the medians with a result file written by writeJSON().
+	/// @param fileName The file with the baseline results.
+	/// @param maxRegression The allowed relative slowdown, f.e. 0.1 for 10%.
+	/// @return The number of benchmarks that are slower than allowed, or -1 if the file cannot be read.
+	int compareWithBaseline(const char *fileName, double maxRegression) const {
+		FILE *fp=fopen(fileName, "rt");
+		if (!fp) {
+			fprintf(stderr, "Cannot open the baseline %s\n", fileName);
+			return -1;
+		}
+
+		int numRegressions=0;
+		char line[4096];
+		while (fgets(line, sizeof(line), fp)) {
+			char name[256];
+			double baselineNs=0.0;
+			const char *namePos=strstr(line, "\"name\": \"");
+			const char *nsPos=strstr(line, "\"ns_per_eval\": ");
+			if (!namePos || !nsPos || sscanf(namePos, "\"name\": \"%255[^\"]\"", name)!=1 || sscanf(nsPos, "\"ns_per_eval\": %lf", &baselineNs)!=1)
+				continue;
+
+			for (size_t i=0; i<results.size(); i++) {
+				if (results[i].name!=name)
+					continue;
+				const double ns=results[i].getMedian();
+				const double change=ns/baselineNs-1.0;
+				const bool regressed=(change>maxRegression);
+				fprintf(stderr, "%-48s %12.2f -> %12.2f ns/eval (%+.1f%%)%s\n", name, baselineNs, ns, change*100.0, regressed? " REGRESSION" : "");
+				if (regressed)
+					numRegressions++;
+			}
+		}
+		fclose(fp);
+		return numRegressions;
+	}
+
+	const BenchmarkOptions options;
+	std::vector<BenchmarkResult> results;
+	volatile float sink=0.0f; ///< Receives the values returned by the benchmarks.
+};
+
+/// Inputs for the kernel benchmarks, drawn from the metal presets: random preset channels with random
+/// viewing angles.
+struct KernelInputs {
+	std::vector<float> n, k; ///< n and k values of the complex Fresnel curves.
+	std::vector<float> r, g; ///< Base reflection and edge tint of Ole Gulbrandsen's Fresnel.
+	std::vector<float> base, reflection, ior; ///< The fitted VRayMtl settings.
+	std::vector<float> f0, tint; ///< The fitted F82-tint settings.
+	std::vector<float> cosTheta; ///< Viewing angle cosines in (0, 1].
+
+	std::vector<Color> nColor, kColor; ///< The n and k values of the presets, for the color kernels.
+	std::vector<Color> baseColor, reflectionColor, edgeTintColor; ///< The fitted settings of the presets.
+	std::vector<float> iorColor; ///< The fitted IOR of the presets.
+
+	void generate(size_t count, unsigned seed) {
+		// Fit all presets once.
+		PresetCurves curves[metalPreset_last];
+		Color f82Tints[metalPreset_last];
+		parallelFor(metalPreset_last, 0, [&curves](int i) {
+			fitMetal(metalPresets[i].n, metalPresets[i].k, curves[i]);
+		});
+		for (int i=0; i<metalPreset_last; i++)
+			f82Tints[i]=getF82Tint(curves[i].n, curves[i].k);
+
+		std::mt19937 rng(seed);
+		std::uniform_int_distribution<int> presetDist(0, metalPreset_last-1);
+		std::uniform_int_distribution<int> channelDist(0, 2);
+		std::uniform_real_distribution<float> cosDist(0.0f, 1.0f);
+
+		for (size_t i=0; i<count; i++) {
+			const int p=presetDist(rng);
+			const int c=channelDist(rng);
+			const PresetCurves &cv=curves[p];
+			n.push_back(cv.n[c]);
+			k.push_back(cv.k[c]);
+			r.push_back(cv.base[c]);
+			g.push_back(cv.edgeTint[c]);
+			base.push_back(cv.base[c]);
+			reflection.push_back(cv.reflection[c]);
+			ior.push_back(cv.ior);
+			f0.push_back(cv.base[c]);
+			tint.push_back(f82Tints[p][c]);
+			cosTheta.push_back(1.0f-cosDist(rng));
+
+			nColor.push_back(cv.n);
+			kColor.push_back(cv.k);
+			baseColor.push_back(cv.base);
+			reflectionColor.push_back(cv.reflection);
+			edgeTintColor.push_back(cv.edgeTint);
+			iorColor.push_back(cv.ior);
+		}
+	}
+};
+
+/// Time the Fresnel kernels and the fitting functions.
+void runKernelBenchmarks(BenchmarkSuite &suite) {
+	const size_t count=suite.options.numInputs;
+	KernelInputs in;
+	in.generate(count, suite.options.seed);
+	std::vector<float> out(count);
+
+	// Scalar kernels for one wavelength.
+	suite.run("complexFresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++)
+			sum+=complexFresnel(in.n[i], in.k[i], in.cosTheta[i]);
+		return sum;
+	});
+	suite.run("olefresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++)
+			sum+=olefresnel(in.r[i], in.g[i], in.cosTheta[i]);
+		return sum;
+	});
+	suite.run("getVRayFresnelCoeff", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++)
+			sum+=getVRayFresnelCoeff(in.ior[i], in.cosTheta[i]);
+		return sum;
+	});
+	suite.run("f82TintFresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++)
+			sum+=f82TintFresnel(in.f0[i], in.tint[i], in.cosTheta[i]);
+		return sum;
+	});
+
+	// The same curve as a formula that is compiled at run time, evaluated by the batch interpreter.
+	{
+		FresnelExpression f82Expression;
+		std::string error;
+		f82Expression.compile("f82", "param f0; param tint; clamp(f0+(1-f0)*(1-c)^5-(f0+(1-f0)*(6/7)^5)*(1-tint)/(1/7*(6/7)^6)*c*(1-c)^6, 0, 1)", error);
+		const float *params[2]={ &in.f0[0], &in.tint[0] };
+		suite.run("FresnelExpression F82-tint", count, [&]() {
+			f82Expression.evaluate(&in.n[0], &in.k[0], &in.cosTheta[0], params, int(count), &out[0]);
+			return out[count/2];
+		});
+	}
+
+	// Color kernels for red/green/blue; one evaluation is one color. All three channels go into the sum, so
+	// that the compiler cannot drop the work for green and blue.
+	suite.run("getComplexFresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++) {
+			const Color value=getComplexFresnel(in.nColor[i], in.kColor[i], in.cosTheta[i]);
+			sum+=value.r+value.g+value.b;
+		}
+		return sum;
+	});
+	suite.run("getOleMetallicFresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++) {
+			const Color value=getOleMetallicFresnel(in.baseColor[i], in.edgeTintColor[i], in.cosTheta[i]);
+			sum+=value.r+value.g+value.b;
+		}
+		return sum;
+	});
+	suite.run("getVRayMetallicFresnel", count, [&]() {
+		float sum=0.0f;
+		for (size_t i=0; i<count; i++) {
+			const Color value=getVRayMetallicFresnel(in.baseColor[i], in.reflectionColor[i], in.iorColor[i], in.cosTheta[i]);
+			sum+=value.r+value.g+value.b;
+		}
+		return sum;
+	});
+
+	// The batch functions of the C API, on one thread and on all threads.
+	const int threadCounts[]={ 1, 0 };
+	for (int t=0; t<2; t++) {
+		const int numThreads=threadCounts[t];
+		const std::string suffix=numThreads==1? " (1 thread)" : " (all threads)";
+		suite.run(("metalness_complex_fresnel_batch"+suffix).c_str(), count, [&]() {
+			metalness_complex_fresnel_batch(&in.n[0], &in.k[0], &in.cosTheta[0], &out[0], count, numThreads);
+			return out[count/2];
+		});
+		suite.run(("metalness_ole_fresnel_batch"+suffix).c_str(), count, [&]() {
+			metalness_ole_fresnel_batch(&in.r[0], &in.g[0], &in.cosTheta[0], &out[0], count, numThreads);
+			return out[count/2];
+		});
+		suite.run(("metalness_vray_fresnel_batch"+suffix).c_str(), count, [&]() {
+			metalness_vray_fresnel_batch(&in.base[0], &in.reflection[0], &in.ior[0], &in.cosTheta[0], &out[0], count, numThreads);
+			return out[count/2];
+		});
+	}
+
+	// The fitting functions, once per preset.
+	FitOptions bruteForce, coarseToFine, uniformErrors;
+	coarseToFine.solver=iorSolver_coarseToFine;
+	uniformErrors.errorSampling=curveSampling_uniform;
+
+	suite.run("findIOR (brute force)", metalPreset_last, [&]() {
+		float sum=0.0f;
+		for (int i=0; i<metalPreset_last; i++)
+			sum+=findIOR(metalPresets[i].n, metalPresets[i].k, bruteForce);
+		return sum;
+	});
+	suite.run("findIOR (coarse to fine)", metalPreset_last, [&]() {
+		float sum=0.0f;
+		for (int i=0; i<metalPreset_last; i++)
+			sum+=findIOR(metalPresets[i].n, metalPresets[i].k, coarseToFine);
+		return sum;
+	});
+
+	PresetCurves curves[metalPreset_last];
+	for (int i=0; i<metalPreset_last; i++)
+		fitMetal(metalPresets[i].n, metalPresets[i].k, curves[i], coarseToFine);
+
+	suite.run("computeCurveErrors (adaptive)", metalPreset_last, [&]() {
+		double sum=0.0;
+		for (int i=0; i<metalPreset_last; i++) {
+			CurveErrors errors;
+			computeCurveErrors(curves[i], bruteForce, errors);
+			sum+=errors.vray+errors.ole+errors.f82+errors.schlick+errors.lazanyi;
+		}
+		return float(sum);
+	});
+	suite.run("computeCurveErrors (uniform)", metalPreset_last, [&]() {
+		double sum=0.0;
+		for (int i=0; i<metalPreset_last; i++) {
+			CurveErrors errors;
+			computeCurveErrors(curves[i], uniformErrors, errors);
+			sum+=errors.vray+errors.ole+errors.f82+errors.schlick+errors.lazanyi;
+		}
+		return float(sum);
+	});
+
+	// The same errors as the uniform computeCurveErrors() in one fused pass, for one and for all models.
+	std::vector<CurveModel> allModels;
+	findCurveModels("all", allModels);
+	double matrixErrors[curveModel_last*metalPreset_last];
+	suite.run("computeErrorMatrix vray (1 thread)", metalPreset_last, [&]() {
+		computeErrorMatrix(curves, metalPreset_last, &allModels[0], 1, uniformErrors.numUniformSamples, matrixErrors, 1);
+		return float(matrixErrors[0]);
+	});
+	// A model called through the ModelSet interface against the same curve written out by hand.
+	{
+		const Color &n=metalPresets[metalPreset_gold].n, &k=metalPresets[metalPreset_gold].k;
+		Color tint;
+		F82TintModel::getInitialParams(n, k, &tint);
+		const Color f0=getComplexFresnel(n, k, 1.0f);
+		std::vector<Color> colors(count);
+		suite.run("getF82TintFresnel loop", count, [&]() {
+			for (size_t i=0; i<count; i++)
+				colors[i]=getF82TintFresnel(f0, tint, in.cosTheta[i]);
+			return colors[count/2].g;
+		});
+		suite.run("evalModelBatch F82-tint", count, [&]() {
+			evalModelBatch<F82TintModel>(n, k, &tint, &in.cosTheta[0], int(count), &colors[0]);
+			return colors[count/2].g;
+		});
+	}
+	suite.run("computeErrorMatrix all models (1 thread)", metalPreset_last, [&]() {
+		computeErrorMatrix(curves, metalPreset_last, &allModels[0], curveModel_last, uniformErrors.numUniformSamples, matrixErrors, 1);
+		double sum=0.0;
+		for (int i=0; i<curveModel_last*metalPreset_last; i++)
+			sum+=matrixErrors[i];
+		return float(sum);
+	});
+	// The GGX albedo of one metal; the unit is one sample of the microfacet normals, with all curves.
+	AlbedoTableOptions albedoOptions;
+	albedoOptions.numCosines=albedoOptions.numRoughness=16;
+	albedoOptions.numSamples=256;
+	AlbedoTables albedoTables;
+	suite.run("computeAlbedoTables 16x16x256 (1 thread)", 16*16*256, [&]() {
+		computeAlbedoTables(curves[metalPreset_gold], albedoOptions, albedoTables, 1);
+		return albedoTables.complex[0].g;
+	});
+	AverageFresnel averages[metalPreset_last];
+	suite.run("computeAverageFresnel 1024 samples (1 thread)", metalPreset_last*1024, [&]() {
+		computeAverageFresnel(curves, metalPreset_last, 1024, averages, 1);
+		return averages[metalPreset_gold].complex.g;
+	});
+	std::vector<Color> f0(count), tint(count);
+	suite.run("fitF82TintBatch (1 thread)", count, [&]() {
+		fitF82TintBatch(&in.nColor[0], &in.kColor[0], &f0[0], &tint[0], count, 1);
+		return tint[count/2].r;
+	});
+	FitOptions leastSquares;
+	leastSquares.modelFit=modelFit_leastSquares;
+	suite.run("fitF82TintBatch least squares (1 thread)", count/64, [&]() {
+		fitF82TintBatch(&in.nColor[0], &in.kColor[0], &f0[0], &tint[0], count/64, 1, leastSquares);
+		return tint[count/128].r;
+	});
+	std::vector<Color> lazanyi(LazanyiSchlickModel::numParams*(count/64));
+	suite.run("fitModelBatch Lazanyi-Schlick (1 thread)", count/64, [&]() {
+		for (size_t i=0; i<count/64; i++)
+			getLazanyiSchlickParams(in.nColor[i], in.kColor[i], &lazanyi[LazanyiSchlickModel::numParams*i]);
+		fitModelBatch<LazanyiSchlickModel>(&in.nColor[0], &in.kColor[0], &lazanyi[0], count/64, leastSquares.numIORSamples, 1);
+		return lazanyi[count/64].r;
+	});
+}
+
+/// A set of metals for the accuracy benchmarks: the presets and random n and k values in the range of
+/// real metals.
+struct MetalCorpus {
+	std::vector<Color> n, k;
+
+	void generate(int numRandom, unsigned seed) {
+		for (int i=0; i<metalPreset_last; i++) {
+			n.push_back(metalPresets[i].n);
+			k.push_back(metalPresets[i].k);
+		}
+
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> logNDist(logf(0.03f), logf(4.0f));
+		std::uniform_real_distribution<float> kDist(1.0f, 8.0f);
+		for (int i=0; i<numRandom; i++) {
+			Color nc, kc;
+			for (int c=0; c<3; c++) {
+				nc[c]=expf(logNDist(rng));
+				kc[c]=kDist(rng);
+			}
+			n.push_back(nc);
+			k.push_back(kc);
+		}
+	}
+
+	int size(void) const { return int(n.size()); }
+};
+
+/// The number of intervals for the reference integrals over the viewing angle cosines.
+const int referenceIntervals=4096;
+
+/// The root mean square difference between two curves over cosines in [0, 1] in double precision,
+/// integrated with Simpson's rule.
+/// @param func Returns the squared difference of the curves, summed over red/green/blue, for a cosine.
+template<class Func>
+double getReferenceRMS(int numIntervals, const Func &func) {
+	double sum=func(0.0)+func(1.0);
+	for (int i=1; i<numIntervals; i++)
+		sum+=func(double(i)/double(numIntervals))*((i%2)? 4.0 : 2.0);
+	return sqrt(sum/(3.0*double(numIntervals)));
+}
+
+/// The reference error of the VRayMtl metallic Fresnel curve with the given IOR for a metal.
+double getReferenceVRayError(const Color &n, const Color &k, double ior, int numIntervals=referenceIntervals) {
+	double base[3], reflection[3];
+	for (int c=0; c<3; c++) {
+		base[c]=refComplexFresnel<double>(n[c], k[c], 1.0);
+		reflection[c]=refComplexFresnel<double>(n[c], k[c], 0.0);
+	}
+	return getReferenceRMS(numIntervals, [&](double x) {
+		const double f=refVRayFresnelCoeff(ior, x);
+		double sum=0.0;
+		for (int c=0; c<3; c++) {
+			const double d=base[c]*(1.0-f)+reflection[c]*f-refComplexFresnel<double>(n[c], k[c], x);
+			sum+=d*d;
+		}
+		return sum;
+	});
+}
+
+/// The reference error of Ole Gulbrandsen's metallic Fresnel curve with the given settings for a metal.
+double getReferenceOleError(const Color &n, const Color &k, const Color &base, const Color &edgeTint) {
+	return getReferenceRMS(referenceIntervals, [&](double x) {
+		double sum=0.0;
+		for (int c=0; c<3; c++) {
+			const double d=refOleFresnel<double>(base[c], edgeTint[c], x)-refComplexFresnel<double>(n[c], k[c], x);
+			sum+=d*d;
+		}
+		return sum;
+	});
+}
+
+/// Find the IOR that minimizes the reference error of the VRayMtl metallic Fresnel curve: a scan in steps
+/// of 0.01 with a coarser integral, then a golden section search around the best step.
+double findReferenceIOR(const Color &n, const Color &k) {
+	double bestIOR=1.001, bestError=1e30;
+	for (int step=0; step<900; step++) {
+		const double ior=1.001+double(step)*0.01;
+		const double error=getReferenceVRayError(n, k, ior, 512);
+		if (error<bestError) {
+			bestError=error;
+			bestIOR=ior;
+		}
+	}
+
+	const double phi=0.5*(sqrt(5.0)-1.0);
+	double a=std::max(1.001, bestIOR-0.02), b=std::min(10.0, bestIOR+0.02);
+	double x1=b-phi*(b-a), x2=a+phi*(b-a);
+	double e1=getReferenceVRayError(n, k, x1), e2=getReferenceVRayError(n, k, x2);
+	while (b-a>1e-7) {
+		if (e1<e2) {
+			b=x2; x2=x1; e2=e1;
+			x1=b-phi*(b-a);
+			e1=getReferenceVRayError(n, k, x1);
+		} else {
+			a=x1; x1=x2; e1=e2;
+			x2=a+phi*(b-a);
+			e2=getReferenceVRayError(n, k, x2);
+		}
+	}
+	return 0.5*(a+b);
+}
+
+/// One configuration in the accuracy benchmarks, with its cost and accuracy over a corpus.
+struct ParetoPoint {
+	std::string kind; ///< "ior_solver" or "error_sampling".
+	std::string config; ///< Description of the configuration.
+	double usPerMetal; ///< Single-thread wall time per metal in microseconds.
+	double evaluationsPerMetal; ///< Curve evaluations per metal.
+	double accuracy; ///< The value that the Pareto front is computed for; lower is better.
+	std::string metrics; ///< The accuracy metrics as JSON members.
+	bool pareto; ///< True if no other point of the same kind is both faster and more accurate.
+};
+
+/// Mark the points that are not dominated by other points of the same kind.
+void markParetoFront(std::vector<ParetoPoint> &points) {
+	for (size_t i=0; i<points.size(); i++) {
+		points[i].pareto=true;
+		for (size_t j=0; j<points.size() && points[i].pareto; j++) {
+			if (i==j || points[i].kind!=points[j].kind)
+				continue;
+			const bool noWorse=(points[j].usPerMetal<=points[i].usPerMetal && points[j].accuracy<=points[i].accuracy);
+			const bool better=(points[j].usPerMetal<points[i].usPerMetal || points[j].accuracy<points[i].accuracy);
+			if (noWorse && better)
+				points[i].pareto=false;
+		}
+	}
+}
+
+/// Run all IOR solvers and error sampling configurations over the corpus and write their cost and their
+/// accuracy against the double precision reference as JSON.
+void runParetoBenchmarks(const BenchmarkOptions &options, int numRandomMetals, FILE *fp) {
+	MetalCorpus corpus;
+	corpus.generate(numRandomMetals, options.seed);
+	const int count=corpus.size();
+
+	fprintf(stderr, "Computing the reference IORs for %d metals\n", count);
+	std::vector<double> refIOR(count), refError(count);
+	parallelFor(count, 0, [&](int i) {
+		refIOR[i]=findReferenceIOR(corpus.n[i], corpus.k[i]);
+		refError[i]=getReferenceVRayError(corpus.n[i], corpus.k[i], refIOR[i]);
+	});
+
+	std::vector<ParetoPoint> points;
+	char buf[512];
+
+	// IOR solvers: the excess of the reference error at the found IOR over the error at the reference IOR
+	// is the accuracy lost by the solver.
+	const int iorSampleCounts[]={ 25, 50, 100, 200, 400, 1024 };
+	for (int solver=0; solver<iorSolver_last; solver++) {
+		for (size_t s=0; s<sizeof(iorSampleCounts)/sizeof(iorSampleCounts[0]); s++) {
+			FitOptions fitOptions;
+			fitOptions.solver=IORSolver(solver);
+			fitOptions.numIORSamples=iorSampleCounts[s];
+			// The brute force search with many samples takes minutes for large corpora.
+			if (solver==iorSolver_bruteForce && fitOptions.numIORSamples>200)
+				continue;
+
+			std::vector<float> ior(count);
+			long long numEvaluations=0;
+			const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+			for (int i=0; i<count; i++) {
+				long long metalEvaluations=0;
+				ior[i]=findIOR(corpus.n[i], corpus.k[i], fitOptions, &metalEvaluations);
+				numEvaluations+=metalEvaluations;
+			}
+			const std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+
+			double iorDevSum=0.0, iorDevMax=0.0, excessSum=0.0, excessMax=0.0;
+			for (int i=0; i<count; i++) {
+				const double iorDev=fabs(double(ior[i])-refIOR[i]);
+				const double excess=getReferenceVRayError(corpus.n[i], corpus.k[i], ior[i])-refError[i];
+				iorDevSum+=iorDev;
+				iorDevMax=std::max(iorDevMax, iorDev);
+				excessSum+=excess;
+				excessMax=std::max(excessMax, excess);
+			}
+
+			ParetoPoint point;
+			point.kind="ior_solver";
+			snprintf(buf, sizeof(buf), "%s, %d samples", solver==iorSolver_bruteForce? "brute force" : "coarse to fine", fitOptions.numIORSamples);
+			point.config=buf;
+			point.usPerMetal=double(std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count())*1e-3/double(count);
+			point.evaluationsPerMetal=double(numEvaluations)/double(count);
+			point.accuracy=excessSum/double(count);
+			snprintf(buf, sizeof(buf), "\"ior_dev_mean\": %.6g, \"ior_dev_max\": %.6g, \"excess_error_mean\": %.6g, \"excess_error_max\": %.6g",
+				iorDevSum/double(count), iorDevMax, excessSum/double(count), excessMax);
+			point.metrics=buf;
+			points.push_back(point);
+			fprintf(stderr, "%-32s %12.1f us/metal, excess error %.3g\n", point.config.c_str(), point.usPerMetal, point.accuracy);
+		}
+	}
+
+	// Error sampling: the relative deviation of the computed errors from the reference errors, for the
+	// settings of the coarse to fine fit.
+	std::vector<PresetCurves> curves(count);
+	std::vector<double> refVRayError(count), refOleError(count);
+	FitOptions coarseToFine;
+	coarseToFine.solver=iorSolver_coarseToFine;
+	parallelFor(count, 0, [&](int i) {
+		fitMetal(corpus.n[i], corpus.k[i], curves[i], coarseToFine);
+		refVRayError[i]=getReferenceVRayError(corpus.n[i], corpus.k[i], curves[i].ior);
+		refOleError[i]=getReferenceOleError(corpus.n[i], corpus.k[i], curves[i].base, curves[i].edgeTint);
+	});
+
+	std::vector<FitOptions> samplingConfigs;
+	const float tolerancePixels[]={ 16.0f, 4.0f, 1.0f, 0.25f, 0.0625f };
+	for (size_t t=0; t<sizeof(tolerancePixels)/sizeof(tolerancePixels[0]); t++) {
+		FitOptions fitOptions;
+		fitOptions.errorSampling=curveSampling_adaptive;
+		fitOptions.tolerance=tolerancePixels[t]/800.0f;
+		samplingConfigs.push_back(fitOptions);
+	}
+	const int uniformSampleCounts[]={ 50, 200, 800, 1600, 6400 };
+	for (size_t u=0; u<sizeof(uniformSampleCounts)/sizeof(uniformSampleCounts[0]); u++) {
+		FitOptions fitOptions;
+		fitOptions.errorSampling=curveSampling_uniform;
+		fitOptions.numUniformSamples=uniformSampleCounts[u];
+		samplingConfigs.push_back(fitOptions);
+	}
+
+	for (size_t c=0; c<samplingConfigs.size(); c++) {
+		const FitOptions &fitOptions=samplingConfigs[c];
+		std::vector<double> vrayError(count), oleError(count);
+		long long numSamples=0;
+
+		// Repeat the loop so that the time is measurable for the cheap configurations.
+		const int numRepeats=std::max(1, options.numRuns);
+		const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+		for (int repeat=0; repeat<numRepeats; repeat++) {
+			for (int i=0; i<count; i++) {
+				int metalSamples=0;
+				CurveErrors errors;
+				computeCurveErrors(curves[i], fitOptions, errors, &metalSamples);
+				vrayError[i]=errors.vray;
+				oleError[i]=errors.ole;
+				if (repeat==0)
+					numSamples+=metalSamples;
+			}
+		}
+		const std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+
+		double vrayDevSum=0.0, vrayDevMax=0.0, oleDevSum=0.0;
+		for (int i=0; i<count; i++) {
+			const double vrayDev=fabs(vrayError[i]-refVRayError[i])/refVRayError[i];
+			vrayDevSum+=vrayDev;
+			vrayDevMax=std::max(vrayDevMax, vrayDev);
+			oleDevSum+=fabs(oleError[i]-refOleError[i]);
+		}
+
+		ParetoPoint point;
+		point.kind="error_sampling";
+		if (fitOptions.errorSampling==curveSampling_adaptive)
+			snprintf(buf, sizeof(buf), "adaptive, tolerance %g px", fitOptions.tolerance*800.0f);
+		else
+			snprintf(buf, sizeof(buf), "uniform, %d samples", fitOptions.numUniformSamples);
+		point.config=buf;
+		point.usPerMetal=double(std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count())*1e-3/double(count*numRepeats);
+		point.evaluationsPerMetal=double(numSamples)/double(count);
+		point.accuracy=vrayDevSum/double(count);
+		snprintf(buf, sizeof(buf), "\"vray_error_rel_dev_mean\": %.6g, \"vray_error_rel_dev_max\": %.6g, \"ole_error_abs_dev_mean\": %.6g",
+			vrayDevSum/double(count), vrayDevMax, oleDevSum/double(count));
+		point.metrics=buf;
+		points.push_back(point);
+		fprintf(stderr, "%-32s %12.1f us/metal, VRay error deviation %.3g\n", point.config.c_str(), point.usPerMetal, point.accuracy);
+	}
+
+	markParetoFront(points);
+
+	fprintf(fp, "{\"suite\": \"pareto\", \"metals\": %d, \"random_metals\": %d, \"seed\": %u, \"results\": [\n", count, numRandomMetals, options.seed);
+	for (size_t i=0; i<points.size(); i++) {
+		const ParetoPoint &p=points[i];
+		fprintf(fp, "{\"kind\": \"%s\", \"name\": \"%s\", \"us_per_metal\": %.6g, \"evaluations_per_metal\": %.6g, %s, \"pareto\": %s}%s\n",
+			p.kind.c_str(), p.config.c_str(), p.usPerMetal, p.evaluationsPerMetal, p.metrics.c_str(), p.pareto? "true" : "false",
+			i+1<points.size()? "," : "");
+	}
+	fprintf(fp, "]}\n");
+}
+
+/// The stages of the end-to-end pipeline in the scaling benchmarks.
+enum ScalingStage {
+	scalingStage_fit=0, ///< Fit the VRayMtl and Ole settings of each metal.
+	scalingStage_errors, ///< Compute the errors of the fitted curves.
+	scalingStage_render, ///< Draw the swatch table pages.
+	scalingStage_output, ///< Write the CSV lines and the swatch table pages as BMP images.
+	scalingStage_total, ///< All of the above.
+
+	scalingStage_last,
+};
+
+const char *scalingStageNames[scalingStage_last]={ "fit", "errors", "render", "output", "total" };
+
+/// The number of metals in one page of the swatch table in the scaling benchmarks. The pages are drawn
+/// into the same image, so that large corpora do not need an image of their full size.
+const int scalingPageRows=256;
+
+/// The median times of the pipeline stages for one thread count, and the scaling against one thread.
+struct ScalingResult {
+	int numThreads; ///< The number of threads.
+	double seconds[scalingStage_last]; ///< The median wall time of each stage over the runs.
+	double speedup[scalingStage_last]; ///< The time with one thread divided by the time with numThreads.
+	double efficiency[scalingStage_last]; ///< The speedup divided by numThreads.
+};
+
+/// Get the median of a set of values.
+double getMedian(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	const size_t count=values.size();
+	return (count%2)? values[count/2] : 0.5*(values[count/2-1]+values[count/2]);
+}
+
+/// Run the whole pipeline of the command-line tool (fitting, error evaluation, rendering of the swatch
+/// table and output) over the presets and random metals with 1, 2, 4, ... up to maxThreads threads, and
+/// report the time of each stage with the speedup and the parallel efficiency against one thread.
+/// @param options The number of runs and the seed.
+/// @param numRandomMetals The number of random metals besides the presets.
+/// @param maxThreads The largest number of threads.
+/// @param fp The file for the JSON results.
+/// @param results Receives the results for each thread count.
+void runScalingBenchmarks(const BenchmarkOptions &options, int numRandomMetals, int maxThreads, FILE *fp, std::vector<ScalingResult> &results) {
+	MetalCorpus corpus;
+	corpus.generate(numRandomMetals, options.seed);
+	const int count=int(corpus.n.size());
+
+	std::vector<std::string> names(count);
+	std::vector<PresetResult> metals(count);
+	for (int i=0; i<count; i++) {
+		if (i<metalPreset_last) {
+			names[i]=metalPresets[i].name;
+		} else {
+			char name[32];
+			snprintf(name, sizeof(name), "Metal %d", i-metalPreset_last+1);
+			names[i]=name;
+		}
+		metals[i].name=names[i].c_str();
+		metals[i].n=corpus.n[i];
+		metals[i].k=corpus.k[i];
+	}
+
+	// The settings for batch generation: the fast solver, with the errors from uniform samples so that each
+	// metal does the same amount of work.
+	FitOptions fitOptions;
+	fitOptions.solver=iorSolver_coarseToFine;
+	fitOptions.errorSampling=curveSampling_uniform;
+
+	std::vector<PresetCurves> curves(count);
+	int tableWidth=0, tableHeight=0;
+	getSwatchTableSize(std::min(count, scalingPageRows), tableWidth, tableHeight);
+	std::vector<RGB32> table(size_t(tableWidth)*size_t(tableHeight));
+
+	std::vector<int> threadCounts;
+	for (int numThreads=1; numThreads<maxThreads; numThreads*=2)
+		threadCounts.push_back(numThreads);
+	threadCounts.push_back(maxThreads);
+
+	for (size_t t=0; t<threadCounts.size(); t++) {
+		const int numThreads=threadCounts[t];
+		std::vector<double> times[scalingStage_last];
+
+		// The first run warms up the caches and is not timed.
+		for (int run=-1; run<options.numRuns; run++) {
+			FILE *out=tmpfile();
+			if (!out) {
+				fprintf(stderr, "Cannot create a temporary file for the output stage\n");
+				return;
+			}
+
+			double seconds[scalingStage_last]={ 0.0 };
+			std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+			const auto lap=[&start, &seconds](ScalingStage stage) {
+				const std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+				seconds[stage]+=double(std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count())*1e-9;
+				start=end;
+			};
+
+			parallelFor(count, numThreads, [&](int i) {
+				fitMetal(metals[i].n, metals[i].k, curves[i], fitOptions);
+			});
+			lap(scalingStage_fit);
+
+			parallelFor(count, numThreads, [&](int i) {
+				CurveErrors errors;
+				computeCurveErrors(curves[i], fitOptions, errors);
+				metals[i].vrayError=errors.vray;
+				metals[i].oleError=errors.ole;
+				metals[i].f82Error=errors.f82;
+				metals[i].schlickError=errors.schlick;
+				metals[i].lazanyiError=errors.lazanyi;
+				metals[i].base=curves[i].base;
+				metals[i].reflection=curves[i].reflection;
+				metals[i].ior=curves[i].ior;
+				metals[i].edgeTint=curves[i].edgeTint;
+			});
+			lap(scalingStage_errors);
+
+			writeCSVHeader(out);
+			for (int page=0; page<count; page+=scalingPageRows) {
+				const int pageRows=std::min(scalingPageRows, count-page);
+				int pageWidth=0, pageHeight=0;
+				getSwatchTableSize(pageRows, pageWidth, pageHeight);
+				lap(scalingStage_output);
+
+				renderSwatchTable(&table[0], pageWidth, &metals[page], pageRows, numThreads);
+				lap(scalingStage_render);
+
+				for (int i=page; i<page+pageRows; i++)
+					writeCSVLine(out, metals[i]);
+				writeBMP(out, &table[0], pageWidth, pageHeight);
+				lap(scalingStage_output);
+			}
+			fclose(out);
+			lap(scalingStage_output);
+
+			if (run<0)
+				continue;
+			for (int stage=0; stage<scalingStage_total; stage++) {
+				times[stage].push_back(seconds[stage]);
+				seconds[scalingStage_total]+=seconds[stage];
+			}
+			times[scalingStage_total].push_back(seconds[scalingStage_total]);
+		}
+
+		ScalingResult result;
+		result.numThreads=numThreads;
+		for (int stage=0; stage<scalingStage_last; stage++) {
+			result.seconds[stage]=getMedian(times[stage]);
+			result.speedup[stage]=results.empty()? 1.0 : results[0].seconds[stage]/result.seconds[stage];
+			result.efficiency[stage]=result.speedup[stage]/double(numThreads);
+		}
+		results.push_back(result);
+
+		fprintf(stderr, "%3d threads:", numThreads);
+		for (int stage=0; stage<scalingStage_last; stage++)
+			fprintf(stderr, " %s %.1f ms (x%.2f)", scalingStageNames[stage], result.seconds[stage]*1e3, result.speedup[stage]);
+		fprintf(stderr, "\n");
+	}
+
+	fprintf(fp, "{\"suite\": \"scaling\", \"metals\": %d, \"random_metals\": %d, \"seed\": %u, \"runs\": %d, \"hardware_threads\": %u, \"results\": [\n",
+		count, numRandomMetals, options.seed, options.numRuns, std::thread::hardware_concurrency());
+	for (size_t i=0; i<results.size(); i++) {
+		const ScalingResult &r=results[i];
+		for (int stage=0; stage<scalingStage_last; stage++) {
+			fprintf(fp, "{\"threads\": %d, \"stage\": \"%s\", \"seconds\": %.6g, \"us_per_metal\": %.6g, \"speedup\": %.4g, \"efficiency\": %.4g}%s\n",
+				r.numThreads, scalingStageNames[stage], r.seconds[stage], r.seconds[stage]*1e6/double(count), r.speedup[stage], r.efficiency[stage],
+				(i+1<results.size() || stage+1<scalingStage_last)? "," : "");
+		}
+	}
+	fprintf(fp, "]}\n");
+}
+
+/// Compare the parallel efficiency of each stage and thread count with a result file written by
+/// runScalingBenchmarks(). Single-thread speed is covered by the kernels suite; this catches changes
+/// that make the pipeline stop scaling, like added locks or serial work.
+/// @param fileName The file with the baseline results.
+/// @param results The current results.
+/// @param maxRegression The allowed relative drop of the efficiency, f.e. 0.1 for 10%.
+/// @return The number of stages and thread counts that scale worse than allowed, or -1 if the file cannot be read.
+int compareScalingWithBaseline(const char *fileName, const std::vector<ScalingResult> &results, double maxRegression) {
+	FILE *fp=fopen(fileName, "rt");
+	if (!fp) {
+		fprintf(stderr, "Cannot open the baseline %s\n", fileName);
+		return -1;
+	}
+
+	int numRegressions=0;
+	char line[4096];
+	while (fgets(line, sizeof(line), fp)) {
+		int numThreads=0;
+		char stageName[64];
+		double baselineEfficiency=0.0;
+		const char *threadsPos=strstr(line, "\"threads\": ");
+		const char *stagePos=strstr(line, "\"stage\": \"");
+		const char *efficiencyPos=strstr(line, "\"efficiency\": ");
+		if (!threadsPos || !stagePos || !efficiencyPos || sscanf(threadsPos, "\"threads\": %d", &numThreads)!=1 ||
+			sscanf(stagePos, "\"stage\": \"%63[^\"]\"", stageName)!=1 || sscanf(efficiencyPos, "\"efficiency\": %lf", &baselineEfficiency)!=1)
+			continue;
+
+		// With one thread the efficiency is 1 by definition.
+		if (numThreads<=1)
+			continue;
+
+		for (size_t i=0; i<results.size(); i++) {
+			if (results[i].numThreads!=numThreads)
+				continue;
+			for (int stage=0; stage<scalingStage_last; stage++) {
+				if (strcmp(scalingStageNames[stage], stageName)!=0)
+					continue;
+				const double efficiency=results[i].efficiency[stage];
+				const double change=efficiency/baselineEfficiency-1.0;
+				const bool regressed=(change<-maxRegression);
+				fprintf(stderr, "%3d threads, %-8s efficiency %6.3f -> %6.3f (%+.1f%%)%s\n", numThreads, stageName, baselineEfficiency, efficiency, change*100.0, regressed? " REGRESSION" : "");
+				if (regressed)
+					numRegressions++;
+			}
+		}
+	}
+	fclose(fp);
+	return numRegressions;
+}
+
+void printUsage(void) {
+	fprintf(stderr,
+		"Usage: metalness_bench <suite> [options]\n"
+		"\n"
+		"Suites:\n"
+		"  kernels                 The Fresnel kernels and the fitting functions.\n"
+		"  pareto                  Time against accuracy for all IOR solvers and error sampling settings.\n"
+		"  scaling                 Speedup and parallel efficiency of the whole pipeline with 1 to N threads.\n"
+		"\n"
+		"Options:\n"
+		"  --runs <n>              Timed runs of each benchmark (default 10).\n"
+		"  --size <n>              Inputs for the kernel benchmarks (default 65536).\n"
+		"  --filter <text>         Only run benchmarks with names that contain the text.\n"
+		"  --seed <n>              Seed for the random inputs (default 1).\n"
+		"  --corpus <n>            Random metals for the pareto and scaling suites, besides the presets\n"
+		"                          (default 100 for pareto and 1000 for scaling).\n"
+		"  --max-threads <n>       Largest thread count for the scaling suite (default: logical processors).\n"
+		"  --output <file>         Write the JSON results to a file instead of the standard output.\n"
+		"  --baseline <file>       Compare with the results in a file from an earlier run.\n"
+		"  --max-regression <f>    Allowed slowdown against the baseline, or drop of the parallel efficiency\n"
+		"                          for the scaling suite, f.e. 0.1 for 10%% (default 0.1).\n"
+		"  --help                  Show this help.\n"
+		"\n"
+		"Exits with code 2 if a benchmark is slower, or scales worse, than the baseline allows.\n"
+	);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc<2 || strcmp(argv[1], "--help")==0 || strcmp(argv[1], "-h")==0) {
+		printUsage();
+		return argc<2? 1 : 0;
+	}
+
+	const std::string suiteName=argv[1];
+	BenchmarkOptions options;
+	const char *outputFileName=NULL;
+	const char *baselineFileName=NULL;
+	double maxRegression=0.1;
+	int numRandomMetals=-1;
+	int maxThreads=int(std::thread::hardware_concurrency());
+
+	for (int i=2; i<argc; i++) {
+		const std::string arg=argv[i];
+		if (i+1>=argc) {
+			fprintf(stderr, "Unknown option or missing value: %s\n", arg.c_str());
+			return 1;
+		}
+		const char *value=argv[++i];
+		if (arg=="--runs") options.numRuns=std::max(1, atoi(value));
+		else if (arg=="--size") options.numInputs=size_t(std::max(1, atoi(value)));
+		else if (arg=="--filter") options.filter=value;
+		else if (arg=="--seed") options.seed=unsigned(strtoul(value, NULL, 10));
+		else if (arg=="--output") outputFileName=value;
+		else if (arg=="--baseline") baselineFileName=value;
+		else if (arg=="--max-regression") maxRegression=atof(value);
+		else if (arg=="--corpus") numRandomMetals=std::max(0, atoi(value));
+		else if (arg=="--max-threads") maxThreads=atoi(value);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (suiteName!="kernels" && suiteName!="pareto" && suiteName!="scaling") {
+		fprintf(stderr, "Unknown suite %s\n", suiteName.c_str());
+		printUsage();
+		return 1;
+	}
+
+	FILE *fp=outputFileName? fopen(outputFileName, "wt") : stdout;
+	if (!fp) {
+		fprintf(stderr, "Cannot open %s for writing\n", outputFileName);
+		return 1;
+	}
+
+	if (numRandomMetals<0)
+		numRandomMetals=(suiteName=="scaling")? 1000 : 100;
+	maxThreads=std::max(1, maxThreads);
+
+	BenchmarkSuite suite(options);
+	std::vector<ScalingResult> scalingResults;
+	if (suiteName=="kernels") {
+		runKernelBenchmarks(suite);
+		suite.writeJSON(fp, suiteName.c_str());
+	} else if (suiteName=="pareto") {
+		runParetoBenchmarks(options, numRandomMetals, fp);
+	} else {
+		runScalingBenchmarks(options, numRandomMetals, maxThreads, fp, scalingResults);
+	}
+	if (fp!=stdout)
+		fclose(fp);
+
+	if (baselineFileName) {
+		const int numRegressions=(suiteName=="scaling")?
+			compareScalingWithBaseline(baselineFileName, scalingResults, maxRegression) :
+			suite.compareWithBaseline(baselineFileName, maxRegression);
+		if (numRegressions<0)
+			return 1;
+		if (numRegressions>0) {
+			fprintf(stderr, "%d benchmarks regressed by more than %g%%\n", numRegressions, maxRegression*100.0);
+			return 2;
+		}
+	}
+	return 0;
+}
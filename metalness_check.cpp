@@ -0,0 +1,833 @@
+/// @file Accuracy checks for the Fresnel curves and the fitting code. Run with a check name and options:
+///
+/// metalness_check table [options]
+///     Regenerate the published table in example_output/metal_presets.csv with every IOR solver and every
+///     implementation of the Fresnel kernels, and compare each column with the published values. All
+///     differences larger than the tolerance of their column are reported with the metal, the column,
+///     the published and the computed values. Faster solvers and kernels must pass this check.
+///
+/// metalness_check kernels [options]
+///     Compare each float Fresnel kernel, and the batch functions of the C API, with the reference versions
+///     in metalness_reference.h evaluated in __float128 (or long double) precision, over a dense grid and
+///     random inputs in the ranges of real metals. Reports the largest error in units in the last place
+///     (ulp) and the largest absolute error of each kernel. Failing inputs are shrunk to the simplest
+///     input that still fails, to make them easy to debug.
+///
+/// The published table was computed with the errors averaged over uniformly spaced cosines, and with the
+/// reflection color (which is white for all metals) as the edge tint of Ole Gulbrandsen's metallic
+/// Fresnel, instead of the edge tint from formula 15 of the paper that fitMetal() computes now. The table
+/// check uses the same settings, so that the Ole error column is comparable.
+///
+/// The program exits with code 2 if any check fails.
+///
+/// To build the checks on Linux, type
+///
+/// g++ -O2 -std=c++14 -DMETALNESS_STATIC metalness_check.cpp metalness_core.cpp metalness_expression.cpp metalness_api.cpp metalness_report.cpp -o metalness_check -pthread
+///
+/// On Windows, in a MSVS command-line prompt, type
+///
+/// cl /O2 /DMETALNESS_NO_VRAY_SDK /DMETALNESS_STATIC metalness_check.cpp metalness_core.cpp metalness_expression.cpp metalness_api.cpp metalness_report.cpp
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "metalness_api.h"
+#include "metalness_core.h"
+#include "metalness_expression.h"
+#include "metalness_reference.h"
+#include "metalness_report.h"
+
+/// The number of uniformly spaced cosines over which the errors in the published table are averaged.
+const int tableErrorSamples=1600;
+
+/// The columns of the table after the name, in the order of the CSV file.
+enum TableColumn {
+	tableColumn_baseRed=0,
+	tableColumn_baseGreen,
+	tableColumn_baseBlue,
+	tableColumn_reflectionRed,
+	tableColumn_reflectionGreen,
+	tableColumn_reflectionBlue,
+	tableColumn_ior,
+	tableColumn_color,
+	tableColumn_vrayError,
+	tableColumn_oleError,
+
+	tableColumn_last,
+};
+
+/// The name of the tolerance that applies to each column, see ColumnTolerance.
+const char *tableColumnTolerances[tableColumn_last]={
+	"base", "base", "base", "reflection", "reflection", "reflection", "ior", "color", "vray_error", "ole_error"
+};
+
+/// The allowed difference between the computed and the published values of a group of columns.
+struct ColumnTolerance {
+	const char *name; ///< The name of the tolerance, used with the --tolerance option.
+	double value; ///< The allowed difference.
+	bool relative; ///< If true, the difference is relative to the published value.
+	const char *description; ///< A description for the usage text.
+};
+
+/// The default tolerances. The colors are 8-bit values and must match exactly. The IOR is searched in
+/// steps of 0.001 and must be the same step. The errors are printed with 6 significant digits, and may
+/// differ by a little more than the rounding for kernels that evaluate the curves in other precisions.
+ColumnTolerance columnTolerances[]={
+	{ "base", 0.0, false, "8-bit base color components" },
+	{ "reflection", 0.0, false, "8-bit reflection color components" },
+	{ "ior", 1e-4, false, "the IOR" },
+	{ "color", 0.0, false, "the sRGB color, as a number" },
+	{ "vray_error", 1e-4, true, "the V-Ray error, relative" },
+	{ "ole_error", 1e-4, true, "the Ole error, relative" },
+};
+
+const int numColumnTolerances=int(sizeof(columnTolerances)/sizeof(columnTolerances[0]));
+
+/// Find the tolerance with the given name.
+/// @return The tolerance, or NULL if there is none with that name.
+ColumnTolerance* findColumnTolerance(const char *name) {
+	for (int i=0; i<numColumnTolerances; i++) {
+		if (strcmp(columnTolerances[i].name, name)==0)
+			return &columnTolerances[i];
+	}
+	return NULL;
+}
+
+/// One row of the table, as read from a CSV file.
+struct TableRow {
+	std::string name; ///< The name of the metal.
+	double values[tableColumn_last]; ///< The values of the other columns.
+};
+
+/// Parse a line of a CSV file written by writeCSVLine(). The columns after the Ole error, for models
+/// that the published table does not have, are ignored.
+/// @return true if the line has all columns of the published table.
+bool parseTableRow(const char *line, TableRow &row) {
+	std::vector<std::string> fields;
+	std::string field;
+	for (const char *c=line; ; c++) {
+		if (*c==',' || *c=='\n' || *c=='\r' || *c=='\0') {
+			const size_t start=field.find_first_not_of(" \t");
+			const size_t end=field.find_last_not_of(" \t");
+			fields.push_back(start==std::string::npos? std::string() : field.substr(start, end-start+1));
+			field.clear();
+			if (*c!=',')
+				break;
+		} else {
+			field+=*c;
+		}
+	}
+	if (int(fields.size())<tableColumn_last+1)
+		return false;
+
+	row.name=fields[0];
+	for (int column=0; column<tableColumn_last; column++) {
+		const char *text=fields[column+1].c_str();
+		char *end=NULL;
+		row.values[column]=(column==tableColumn_color)? double(strtol(text, &end, 16)) : strtod(text, &end);
+		if (end==text || *end)
+			return false;
+	}
+	return true;
+}
+
+/// Read all rows of a CSV file, skipping the header line.
+/// @return false if the file cannot be read.
+bool readTable(FILE *fp, std::vector<TableRow> &rows) {
+	char line[1024];
+	bool header=true;
+	while (fgets(line, sizeof(line), fp)) {
+		if (header) {
+			header=false;
+			continue;
+		}
+		TableRow row;
+		if (parseTableRow(line, row))
+			rows.push_back(row);
+		else if (line[strspn(line, " \t\r\n")])
+			fprintf(stderr, "Cannot parse the table line: %s", line);
+	}
+	return !ferror(fp);
+}
+
+/// Compute the errors of the fitted curves like for the published table: uniformly spaced cosines, and the
+/// reflection color as the edge tint of Ole Gulbrandsen's curve.
+/// @param curves The fitted settings.
+/// @param result Receives the errors.
+void computeTableErrors(const PresetCurves &curves, PresetResult &result) {
+	PresetCurves publishedCurves=curves;
+	publishedCurves.edgeTint=curves.reflection;
+
+	FitOptions options;
+	options.errorSampling=curveSampling_uniform;
+	options.numUniformSamples=tableErrorSamples;
+	CurveErrors errors;
+	computeCurveErrors(publishedCurves, options, errors);
+	result.vrayError=errors.vray;
+	result.oleError=errors.ole;
+}
+
+/// Fill in the fitted settings of a result.
+void setFittedSettings(const PresetCurves &curves, PresetResult &result) {
+	result.base=curves.base;
+	result.reflection=curves.reflection;
+	result.ior=curves.ior;
+	result.edgeTint=curves.edgeTint;
+}
+
+/// A way to compute the table: an IOR solver together with an implementation of the Fresnel kernels.
+struct TableVariant {
+	const char *name; ///< The name of the variant.
+
+	/// Compute the table.
+	/// @param results The metals, with the name, n and k values filled in.
+	/// @param count The number of metals.
+	void (*compute)(PresetResult *results, int count);
+};
+
+/// Fit the metals with the given IOR solver and compute the errors with the color kernels of metalness_core.h.
+void computeTableWithSolver(PresetResult *results, int count, IORSolver solver) {
+	FitOptions options;
+	options.solver=solver;
+	parallelFor(count, 0, [=](int i) {
+		PresetCurves curves;
+		fitMetal(results[i].n, results[i].k, curves, options);
+		setFittedSettings(curves, results[i]);
+		computeTableErrors(curves, results[i]);
+	});
+}
+
+void computeTableBruteForce(PresetResult *results, int count) {
+	computeTableWithSolver(results, count, iorSolver_bruteForce);
+}
+
+void computeTableCoarseToFine(PresetResult *results, int count) {
+	computeTableWithSolver(results, count, iorSolver_coarseToFine);
+}
+
+/// Fit the metals with metalness_fit_batch() and compute the errors with the batch kernels of the C API,
+/// all metals, channels and cosines in one call per curve.
+void computeTableWithAPI(PresetResult *results, int count) {
+	std::vector<metalness_rgb> n(count), k(count);
+	std::vector<metalness_fit_result> fits(count);
+	for (int i=0; i<count; i++) {
+		n[i].r=results[i].n.r; n[i].g=results[i].n.g; n[i].b=results[i].n.b;
+		k[i].r=results[i].k.r; k[i].g=results[i].k.g; k[i].b=results[i].k.b;
+	}
+	metalness_fit_batch(&n[0], &k[0], &fits[0], size_t(count), 0);
+
+	const int numSamples=tableErrorSamples-1;
+	const size_t numValues=size_t(count)*3*numSamples;
+	std::vector<float> nValues(numValues), kValues(numValues), base(numValues), reflection(numValues), ior(numValues), cosTheta(numValues);
+	for (int i=0; i<count; i++) {
+		const metalness_fit_result &fit=fits[i];
+		const float channelBase[3]={ fit.base.r, fit.base.g, fit.base.b };
+		const float channelReflection[3]={ fit.reflection.r, fit.reflection.g, fit.reflection.b };
+		for (int c=0; c<3; c++) {
+			for (int s=0; s<numSamples; s++) {
+				const size_t index=(size_t(i)*3+c)*numSamples+s;
+				nValues[index]=results[i].n[c];
+				kValues[index]=results[i].k[c];
+				base[index]=channelBase[c];
+				reflection[index]=channelReflection[c];
+				ior[index]=fit.ior;
+				cosTheta[index]=float(s+1)/float(tableErrorSamples);
+			}
+		}
+	}
+
+	std::vector<float> complexCurve(numValues), vrayCurve(numValues), oleCurve(numValues);
+	metalness_complex_fresnel_batch(&nValues[0], &kValues[0], &cosTheta[0], &complexCurve[0], numValues, 0);
+	metalness_vray_fresnel_batch(&base[0], &reflection[0], &ior[0], &cosTheta[0], &vrayCurve[0], numValues, 0);
+	metalness_ole_fresnel_batch(&base[0], &reflection[0], &cosTheta[0], &oleCurve[0], numValues, 0);
+
+	for (int i=0; i<count; i++) {
+		double vrayErrorSqr=0.0, oleErrorSqr=0.0;
+		for (int s=0; s<numSamples; s++) {
+			float vraySqr=0.0f, oleSqr=0.0f;
+			for (int c=0; c<3; c++) {
+				const size_t index=(size_t(i)*3+c)*numSamples+s;
+				vraySqr+=(vrayCurve[index]-complexCurve[index])*(vrayCurve[index]-complexCurve[index]);
+				oleSqr+=(oleCurve[index]-complexCurve[index])*(oleCurve[index]-complexCurve[index]);
+			}
+			vrayErrorSqr+=vraySqr;
+			oleErrorSqr+=oleSqr;
+		}
+
+		const metalness_fit_result &fit=fits[i];
+		results[i].base=Color(fit.base.r, fit.base.g, fit.base.b);
+		results[i].reflection=Color(fit.reflection.r, fit.reflection.g, fit.reflection.b);
+		results[i].ior=fit.ior;
+		results[i].vrayError=sqrt(vrayErrorSqr/double(tableErrorSamples));
+		results[i].oleError=sqrt(oleErrorSqr/double(tableErrorSamples));
+	}
+}
+
+/// Fit the metals with the brute force solver and compute the errors with the double precision kernels
+/// of metalness_reference.h.
+void computeTableWithReference(PresetResult *results, int count) {
+	parallelFor(count, 0, [=](int i) {
+		PresetCurves curves;
+		fitMetal(results[i].n, results[i].k, curves);
+		setFittedSettings(curves, results[i]);
+
+		double vrayErrorSqr=0.0, oleErrorSqr=0.0;
+		for (int s=1; s<tableErrorSamples; s++) {
+			const double x=double(float(s)/float(tableErrorSamples));
+			for (int c=0; c<3; c++) {
+				const double complex=refComplexFresnel<double>(curves.n[c], curves.k[c], x);
+				const double vray=refVRayMetallicFresnel<double>(curves.base[c], curves.reflection[c], curves.ior, x);
+				const double ole=refOleFresnel<double>(curves.base[c], curves.reflection[c], x);
+				vrayErrorSqr+=(vray-complex)*(vray-complex);
+				oleErrorSqr+=(ole-complex)*(ole-complex);
+			}
+		}
+		results[i].vrayError=sqrt(vrayErrorSqr/double(tableErrorSamples));
+		results[i].oleError=sqrt(oleErrorSqr/double(tableErrorSamples));
+	});
+}
+
+TableVariant tableVariants[]={
+	{ "brute force solver, color kernels", computeTableBruteForce },
+	{ "coarse to fine solver, color kernels", computeTableCoarseToFine },
+	{ "C API fit, batch kernels", computeTableWithAPI },
+	{ "brute force solver, double precision kernels", computeTableWithReference },
+};
+
+const int numTableVariants=int(sizeof(tableVariants)/sizeof(tableVariants[0]));
+
+/// Regenerate the table with every variant and compare it with the published table.
+/// @param referenceFileName The CSV file with the published table.
+/// @return The number of differences that are larger than the tolerances, or -1 if the published table
+/// cannot be read.
+int checkTable(const char *referenceFileName) {
+	FILE *fp=fopen(referenceFileName, "rt");
+	if (!fp) {
+		fprintf(stderr, "Cannot open %s\n", referenceFileName);
+		return -1;
+	}
+	std::vector<TableRow> reference;
+	const bool ok=readTable(fp, reference);
+	fclose(fp);
+	if (!ok || reference.empty()) {
+		fprintf(stderr, "Cannot read the table in %s\n", referenceFileName);
+		return -1;
+	}
+
+	// Only the metals of the table are fitted; the n and k values come from the presets.
+	std::vector<PresetResult> metals;
+	for (size_t i=0; i<reference.size(); i++) {
+		int preset=0;
+		while (preset<metalPreset_last && reference[i].name!=metalPresets[preset].name)
+			preset++;
+		if (preset==metalPreset_last) {
+			fprintf(stderr, "%s is not a metal preset\n", reference[i].name.c_str());
+			return -1;
+		}
+
+		PresetResult metal=PresetResult();
+		metal.name=metalPresets[preset].name;
+		metal.n=metalPresets[preset].n;
+		metal.k=metalPresets[preset].k;
+		metals.push_back(metal);
+	}
+	const int count=int(metals.size());
+
+	int numFailures=0;
+	for (int v=0; v<numTableVariants; v++) {
+		const TableVariant &variant=tableVariants[v];
+		std::vector<PresetResult> results=metals;
+		variant.compute(&results[0], count);
+
+		// Compare what would be written to the CSV file, so that the output code is checked too.
+		FILE *table=tmpfile();
+		if (!table) {
+			fprintf(stderr, "Cannot create a temporary file\n");
+			return -1;
+		}
+		writeCSVHeader(table);
+		for (int i=0; i<count; i++)
+			writeCSVLine(table, results[i]);
+		rewind(table);
+		std::vector<TableRow> rows;
+		readTable(table, rows);
+		fclose(table);
+
+		int numVariantFailures=0;
+		double maxDiff[tableColumn_last]={ 0.0 };
+		for (int i=0; i<count; i++) {
+			if (i>=int(rows.size()) || rows[i].name!=reference[i].name) {
+				fprintf(stderr, "FAIL %s: %s: the line is missing\n", variant.name, reference[i].name.c_str());
+				numVariantFailures++;
+				continue;
+			}
+
+			for (int column=0; column<tableColumn_last; column++) {
+				const ColumnTolerance &tolerance=*findColumnTolerance(tableColumnTolerances[column]);
+				const double expected=reference[i].values[column];
+				const double actual=rows[i].values[column];
+				double diff=fabs(actual-expected);
+				if (tolerance.relative)
+					diff=(expected!=0.0)? diff/fabs(expected) : (actual!=0.0? HUGE_VAL : 0.0);
+				maxDiff[column]=std::max(maxDiff[column], diff);
+				if (diff<=tolerance.value)
+					continue;
+
+				numVariantFailures++;
+				if (column==tableColumn_color)
+					fprintf(stderr, "FAIL %s: %s: %s is %06x instead of %06x\n", variant.name, reference[i].name.c_str(), getCSVColumnTitle(column+1), int(actual), int(expected));
+				else
+					fprintf(stderr, "FAIL %s: %s: %s is %g instead of %g (%s difference %g, tolerance %g)\n", variant.name, reference[i].name.c_str(),
+						getCSVColumnTitle(column+1), actual, expected, tolerance.relative? "relative" : "absolute", diff, tolerance.value);
+			}
+		}
+
+		printf("%s %s: %d metals, largest differences:", numVariantFailures? "FAIL" : "PASS", variant.name, count);
+		for (int column=0; column<tableColumn_last; column++)
+			printf("%s %s %g", column>0? "," : "", getCSVColumnTitle(column+1), maxDiff[column]);
+		printf("\n");
+		numFailures+=numVariantFailures;
+	}
+	return numFailures;
+}
+
+/// The maximum number of parameters of a kernel.
+const int maxKernelParams=4;
+
+#ifdef METALNESS_HAS_FLOAT128
+typedef __float128 QuadFloat; ///< The most precise type for the reference kernels.
+#else
+typedef long double QuadFloat;
+#endif
+
+/// The range of a kernel parameter for the generated inputs.
+struct KernelParam {
+	const char *name; ///< The name of the parameter.
+	float minValue, maxValue; ///< The range of the parameter, inclusive.
+};
+
+/// A float kernel and its reference implementation. The inputs of a kernel are stored as maxKernelParams
+/// consecutive floats per input.
+struct KernelCheck {
+	const char *name; ///< The name of the kernel.
+	int numParams; ///< The number of parameters.
+	KernelParam params[maxKernelParams]; ///< The parameters.
+
+	/// Evaluate the kernel for many inputs.
+	void (*evaluate)(const float *inputs, float *results, size_t count);
+
+	/// Evaluate the reference in long double precision.
+	long double (*referenceLong)(const float *input);
+
+	/// Evaluate the reference in the most precise type available.
+	QuadFloat (*referenceQuad)(const float *input);
+};
+
+/// Evaluate a scalar kernel for each input.
+template<float (*kernel)(const float *input)>
+void evaluateScalarKernel(const float *inputs, float *results, size_t count) {
+	for (size_t i=0; i<count; i++)
+		results[i]=kernel(inputs+i*maxKernelParams);
+}
+
+/// Split the inputs into one array per parameter for the batch functions of the C API.
+void splitKernelInputs(const float *inputs, size_t count, int numParams, std::vector<float> *params) {
+	for (int p=0; p<numParams; p++) {
+		params[p].resize(count);
+		for (size_t i=0; i<count; i++)
+			params[p][i]=inputs[i*maxKernelParams+p];
+	}
+}
+
+float complexKernel(const float *p) { return complexFresnel(p[0], p[1], p[2]); }
+float oleKernel(const float *p) { return olefresnel(p[0], p[1], p[2]); }
+float vrayCoeffKernel(const float *p) { return getVRayFresnelCoeff(p[0], p[1]); }
+float f82TintKernel(const float *p) { return f82TintFresnel(p[0], p[1], p[2]); }
+
+template<class T> T complexReference(const float *p) { return clamp(refComplexFresnel<T>(p[0], p[1], p[2]), T(0), T(1)); }
+template<class T> T oleReference(const float *p) { return refOleFresnel<T>(p[0], p[1], p[2]); }
+template<class T> T vrayCoeffReference(const float *p) { return refVRayFresnelCoeff<T>(p[0], p[1]); }
+template<class T> T vrayReference(const float *p) { return refVRayMetallicFresnel<T>(p[0], p[1], p[2], p[3]); }
+template<class T> T f82TintReference(const float *p) { return clamp(refF82TintFresnel<T>(p[0], p[1], p[2]), T(0), T(1)); }
+
+void evaluateComplexBatch(const float *inputs, float *results, size_t count) {
+	std::vector<float> p[3];
+	splitKernelInputs(inputs, count, 3, p);
+	metalness_complex_fresnel_batch(&p[0][0], &p[1][0], &p[2][0], results, count, 0);
+}
+
+void evaluateOleBatch(const float *inputs, float *results, size_t count) {
+	std::vector<float> p[3];
+	splitKernelInputs(inputs, count, 3, p);
+	metalness_ole_fresnel_batch(&p[0][0], &p[1][0], &p[2][0], results, count, 0);
+}
+
+void evaluateVRayBatch(const float *inputs, float *results, size_t count) {
+	std::vector<float> p[4];
+	splitKernelInputs(inputs, count, 4, p);
+	metalness_vray_fresnel_batch(&p[0][0], &p[1][0], &p[2][0], &p[3][0], results, count, 0);
+}
+
+/// The F82-tint metallic Fresnel as a formula, which checks the compiler and the interpreter of
+/// metalness_expression.h against the same reference as f82TintFresnel().
+void evaluateF82TintExpression(const float *inputs, float *results, size_t count) {
+	static const FresnelExpression expression=[]() {
+		FresnelExpression result;
+		std::string error;
+		result.compile("f82", "param f0; param tint; clamp(f0+(1-f0)*(1-c)^5-(f0+(1-f0)*(6/7)^5)*(1-tint)/(1/7*(6/7)^6)*c*(1-c)^6, 0, 1)", error);
+		return result;
+	}();
+
+	std::vector<float> p[3];
+	splitKernelInputs(inputs, count, 3, p);
+	const float *params[2]={ &p[0][0], &p[1][0] };
+	expression.evaluate(&p[2][0], &p[2][0], &p[2][0], params, int(count), results);
+}
+
+#define KERNEL_REFERENCE(func) func<long double>, func<QuadFloat>
+
+/// The kernels to check, with the ranges of their parameters for real metals and VRayMtl settings.
+KernelCheck kernelChecks[]={
+	{ "complexFresnel", 3, { { "n", 0.01f, 5.0f }, { "k", 0.0f, 10.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateScalarKernel<complexKernel>, KERNEL_REFERENCE(complexReference) },
+	{ "metalness_complex_fresnel_batch", 3, { { "n", 0.01f, 5.0f }, { "k", 0.0f, 10.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateComplexBatch, KERNEL_REFERENCE(complexReference) },
+	{ "olefresnel", 3, { { "r", 0.0f, 0.99f }, { "g", 0.0f, 1.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateScalarKernel<oleKernel>, KERNEL_REFERENCE(oleReference) },
+	{ "metalness_ole_fresnel_batch", 3, { { "r", 0.0f, 0.99f }, { "g", 0.0f, 1.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateOleBatch, KERNEL_REFERENCE(oleReference) },
+	{ "getVRayFresnelCoeff", 2, { { "ior", 1.001f, 10.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateScalarKernel<vrayCoeffKernel>, KERNEL_REFERENCE(vrayCoeffReference) },
+	{ "metalness_vray_fresnel_batch", 4, { { "base", 0.0f, 1.0f }, { "reflection", 0.0f, 1.0f }, { "ior", 1.001f, 10.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateVRayBatch, KERNEL_REFERENCE(vrayReference) },
+	{ "f82TintFresnel", 3, { { "f0", 0.0f, 1.0f }, { "tint", 0.0f, 1.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateScalarKernel<f82TintKernel>, KERNEL_REFERENCE(f82TintReference) },
+	{ "FresnelExpression F82-tint", 3, { { "f0", 0.0f, 1.0f }, { "tint", 0.0f, 1.0f }, { "cos", 0.0f, 1.0f } },
+		evaluateF82TintExpression, KERNEL_REFERENCE(f82TintReference) },
+};
+
+#undef KERNEL_REFERENCE
+
+const int numKernelChecks=int(sizeof(kernelChecks)/sizeof(kernelChecks[0]));
+
+/// Options of the kernel check.
+struct KernelCheckOptions {
+	int numDense; ///< The approximate number of inputs on a regular grid over the parameter ranges.
+	int numRandom; ///< The number of random inputs.
+	unsigned seed; ///< The seed for the random inputs.
+	bool quad; ///< Use QuadFloat for the reference instead of long double.
+	double maxULP; ///< A result fails if its error is larger than this many units in the last place...
+	double maxAbsError; ///< ... and larger than this absolute error, so that cancellation near 0 is allowed.
+	const char *filter; ///< Only check kernels with names that contain this string, if not NULL.
+
+	KernelCheckOptions(void):numDense(1<<18), numRandom(1<<18), seed(1), quad(true), maxULP(16.0), maxAbsError(1e-5), filter(NULL) {}
+};
+
+/// The error of a float result against the reference.
+struct KernelError {
+	long double absError; ///< The absolute error.
+	long double ulpError; ///< The error in units in the last place of the reference rounded to float.
+};
+
+/// Compute the error of a kernel result for one input.
+KernelError getKernelError(const KernelCheck &kernel, const KernelCheckOptions &options, const float *input, float result) {
+	const long double reference=options.quad? (long double) kernel.referenceQuad(input) : kernel.referenceLong(input);
+	const float rounded=fabsf(float(reference));
+	const float ulp=(rounded<FLT_MAX)? nextafterf(rounded, INFINITY)-rounded : 0.0f;
+
+	KernelError error;
+	error.absError=fabsl((long double) result-reference);
+	error.ulpError=(ulp>0.0f)? error.absError/(long double) ulp : 0.0L;
+	if (result!=result && reference==reference)
+		error.absError=error.ulpError=HUGE_VALL;
+	return error;
+}
+
+/// Check if an error is larger than the tolerances.
+bool isKernelFailure(const KernelError &error, const KernelCheckOptions &options) {
+	return error.ulpError>options.maxULP && error.absError>options.maxAbsError;
+}
+
+/// Evaluate a kernel for one input.
+float evaluateKernel(const KernelCheck &kernel, const float *input) {
+	float result=0.0f;
+	kernel.evaluate(input, &result, 1);
+	return result;
+}
+
+/// Get the number of significant decimal digits that a value needs, up to 9.
+int getSignificantDigits(float value) {
+	for (int digits=0; digits<9; digits++) {
+		char text[32];
+		snprintf(text, sizeof(text), "%.*g", digits>0? digits : 1, value);
+		if (digits==0? (value==0.0f) : (strtof(text, NULL)==value))
+			return digits;
+	}
+	return 9;
+}
+
+/// Make a failing input simpler while it still fails: each parameter is replaced with the end of its range,
+/// 0 or 1, or rounded to fewer significant digits, whichever is the simplest value that still fails.
+/// @param kernel The kernel.
+/// @param options The tolerances.
+/// @param input The failing input; receives the simpler input.
+void shrinkKernelInput(const KernelCheck &kernel, const KernelCheckOptions &options, float *input) {
+	bool changed=true;
+	while (changed) {
+		changed=false;
+		for (int p=0; p<kernel.numParams; p++) {
+			const KernelParam &param=kernel.params[p];
+			const float value=input[p];
+
+			std::vector<float> candidates;
+			candidates.push_back(0.0f);
+			candidates.push_back(1.0f);
+			candidates.push_back(param.minValue);
+			candidates.push_back(param.maxValue);
+			for (int digits=1; digits<9; digits++) {
+				char text[32];
+				snprintf(text, sizeof(text), "%.*g", digits, value);
+				candidates.push_back(strtof(text, NULL));
+			}
+
+			for (size_t c=0; c<candidates.size(); c++) {
+				const float candidate=candidates[c];
+				if (candidate<param.minValue || candidate>param.maxValue || getSignificantDigits(candidate)>=getSignificantDigits(value))
+					continue;
+
+				float simpler[maxKernelParams];
+				memcpy(simpler, input, sizeof(simpler));
+				simpler[p]=candidate;
+				if (isKernelFailure(getKernelError(kernel, options, simpler, evaluateKernel(kernel, simpler)), options)) {
+					input[p]=candidate;
+					changed=true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/// Format the input of a kernel as a call.
+std::string formatKernelCall(const KernelCheck &kernel, const float *input) {
+	std::string call=std::string(kernel.name)+"(";
+	for (int p=0; p<kernel.numParams; p++) {
+		char text[64];
+		snprintf(text, sizeof(text), "%s%s=%.9g", p>0? ", " : "", kernel.params[p].name, input[p]);
+		call+=text;
+	}
+	return call+")";
+}
+
+/// Generate the inputs for a kernel: a regular grid over the parameter ranges, including the ends, and
+/// uniformly distributed random inputs.
+void generateKernelInputs(const KernelCheck &kernel, const KernelCheckOptions &options, std::vector<float> &inputs) {
+	const int gridSize=std::max(2, int(pow(double(options.numDense), 1.0/double(kernel.numParams))));
+	size_t numGrid=1;
+	for (int p=0; p<kernel.numParams; p++)
+		numGrid*=size_t(gridSize);
+
+	const size_t count=numGrid+size_t(options.numRandom);
+	inputs.assign(count*maxKernelParams, 0.0f);
+	for (size_t i=0; i<numGrid; i++) {
+		size_t index=i;
+		for (int p=0; p<kernel.numParams; p++) {
+			const KernelParam &param=kernel.params[p];
+			const float t=float(index%gridSize)/float(gridSize-1);
+			inputs[i*maxKernelParams+p]=(t>=1.0f)? param.maxValue : param.minValue+(param.maxValue-param.minValue)*t;
+			index/=gridSize;
+		}
+	}
+
+	std::mt19937 rng(options.seed);
+	for (size_t i=numGrid; i<count; i++) {
+		for (int p=0; p<kernel.numParams; p++) {
+			std::uniform_real_distribution<float> dist(kernel.params[p].minValue, kernel.params[p].maxValue);
+			inputs[i*maxKernelParams+p]=dist(rng);
+		}
+	}
+}
+
+/// Compare every kernel with its reference over dense and random inputs, and report the largest errors.
+/// The worst failing input of each kernel is shrunk to a simpler one that still fails.
+/// @return The number of failing inputs over all kernels.
+long long checkKernels(const KernelCheckOptions &options) {
+#ifndef METALNESS_HAS_FLOAT128
+	if (options.quad)
+		fprintf(stderr, "__float128 is not available; the reference uses long double\n");
+#endif
+
+	long long numFailures=0;
+	for (int k=0; k<numKernelChecks; k++) {
+		const KernelCheck &kernel=kernelChecks[k];
+		if (options.filter && !strstr(kernel.name, options.filter))
+			continue;
+
+		std::vector<float> inputs;
+		generateKernelInputs(kernel, options, inputs);
+		const size_t count=inputs.size()/maxKernelParams;
+		std::vector<float> results(count);
+		kernel.evaluate(&inputs[0], &results[0], count);
+
+		// The reference is slow in quadruple precision, so it is evaluated on all threads.
+		std::vector<KernelError> errors(count);
+		parallelForBlocks(count, 0, [&](size_t start, size_t end) {
+			for (size_t i=start; i<end; i++)
+				errors[i]=getKernelError(kernel, options, &inputs[i*maxKernelParams], results[i]);
+		});
+
+		size_t worstULP=0, worstAbs=0, worstFailure=count;
+		long long numKernelFailures=0;
+		long double sumAbs=0.0L;
+		for (size_t i=0; i<count; i++) {
+			sumAbs+=errors[i].absError;
+			if (errors[i].ulpError>errors[worstULP].ulpError) worstULP=i;
+			if (errors[i].absError>errors[worstAbs].absError) worstAbs=i;
+			if (isKernelFailure(errors[i], options)) {
+				numKernelFailures++;
+				if (worstFailure==count || errors[i].absError>errors[worstFailure].absError)
+					worstFailure=i;
+			}
+		}
+
+		printf("%s %s: %llu inputs, max %.3Lg ulp at %s, max absolute error %.3Lg at %s, mean absolute error %.3Lg\n",
+			numKernelFailures? "FAIL" : "PASS", kernel.name, (unsigned long long) count,
+			errors[worstULP].ulpError, formatKernelCall(kernel, &inputs[worstULP*maxKernelParams]).c_str(),
+			errors[worstAbs].absError, formatKernelCall(kernel, &inputs[worstAbs*maxKernelParams]).c_str(),
+			sumAbs/(long double) count);
+
+		if (numKernelFailures) {
+			float input[maxKernelParams];
+			memcpy(input, &inputs[worstFailure*maxKernelParams], sizeof(input));
+			shrinkKernelInput(kernel, options, input);
+
+			const float result=evaluateKernel(kernel, input);
+			const KernelError error=getKernelError(kernel, options, input, result);
+			const long double reference=options.quad? (long double) kernel.referenceQuad(input) : kernel.referenceLong(input);
+			printf("    %lld inputs over %g ulp and %g absolute error; simplest failing input:\n", numKernelFailures, options.maxULP, options.maxAbsError);
+			printf("    %s = %.9g, reference %.12Lg, error %.3Lg ulp, %.3Lg absolute\n", formatKernelCall(kernel, input).c_str(), result, reference, error.ulpError, error.absError);
+		}
+		numFailures+=numKernelFailures;
+	}
+	return numFailures;
+}
+
+void printUsage(void) {
+	fprintf(stderr,
+		"Usage: metalness_check <check> [options]\n"
+		"\n"
+		"Checks:\n"
+		"  table                   Regenerate the published table with all IOR solvers and kernels and\n"
+		"                          compare each column with the published values.\n"
+		"  kernels                 Compare the float Fresnel kernels with a quadruple or extended precision\n"
+		"                          reference over dense and random inputs.\n"
+		"\n"
+		"Options of the table check:\n"
+		"  --reference <file>      The published table (default example_output/metal_presets.csv).\n"
+		"  --tolerance <name>=<f>  The allowed difference for a group of columns, one of:\n"
+	);
+	for (int i=0; i<numColumnTolerances; i++) {
+		const ColumnTolerance &tolerance=columnTolerances[i];
+		fprintf(stderr, "                            %-12s %s (default %g)\n", tolerance.name, tolerance.description, tolerance.value);
+	}
+	fprintf(stderr,
+		"\n"
+		"Options of the kernels check:\n"
+		"  --dense <n>             Inputs on a regular grid for each kernel (default 262144).\n"
+		"  --random <n>            Random inputs for each kernel (default 262144).\n"
+		"  --seed <n>              Seed for the random inputs (default 1).\n"
+		"  --precision quad|long   The precision of the reference: __float128 where available, or long\n"
+		"                          double (default quad).\n"
+		"  --max-ulp <f>           A result fails if it is off by more than this many units in the last\n"
+		"                          place (default 16)...\n"
+		"  --max-abs-error <f>     ... and by more than this absolute error (default 1e-5).\n"
+		"  --filter <text>         Only check kernels with names that contain the text.\n"
+		"\n"
+		"  --help                  Show this help.\n"
+		"\n"
+		"Exits with code 2 if a check fails.\n"
+	);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc<2 || strcmp(argv[1], "--help")==0 || strcmp(argv[1], "-h")==0) {
+		printUsage();
+		return argc<2? 1 : 0;
+	}
+
+	const std::string checkName=argv[1];
+	const char *referenceFileName="example_output/metal_presets.csv";
+	KernelCheckOptions kernelOptions;
+
+	for (int i=2; i<argc; i++) {
+		const std::string arg=argv[i];
+		if (i+1>=argc) {
+			fprintf(stderr, "Unknown option or missing value: %s\n", arg.c_str());
+			return 1;
+		}
+		const char *value=argv[++i];
+		if (arg=="--reference") {
+			referenceFileName=value;
+		} else if (arg=="--tolerance") {
+			const char *equals=strchr(value, '=');
+			ColumnTolerance *tolerance=equals? findColumnTolerance(std::string(value, equals).c_str()) : NULL;
+			if (!tolerance) {
+				fprintf(stderr, "Unknown tolerance %s\n", value);
+				return 1;
+			}
+			tolerance->value=atof(equals+1);
+		} else if (arg=="--dense") {
+			kernelOptions.numDense=std::max(0, atoi(value));
+		} else if (arg=="--random") {
+			kernelOptions.numRandom=std::max(0, atoi(value));
+		} else if (arg=="--seed") {
+			kernelOptions.seed=unsigned(strtoul(value, NULL, 10));
+		} else if (arg=="--precision") {
+			if (strcmp(value, "quad")==0) kernelOptions.quad=true;
+			else if (strcmp(value, "long")==0) kernelOptions.quad=false;
+			else { fprintf(stderr, "Unknown precision %s\n", value); return 1; }
+		} else if (arg=="--max-ulp") {
+			kernelOptions.maxULP=atof(value);
+		} else if (arg=="--max-abs-error") {
+			kernelOptions.maxAbsError=atof(value);
+		} else if (arg=="--filter") {
+			kernelOptions.filter=value;
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (checkName=="kernels") {
+		const long long numFailures=checkKernels(kernelOptions);
+		if (numFailures>0) {
+			fprintf(stderr, "%lld kernel results are less accurate than the tolerances\n", numFailures);
+			return 2;
+		}
+		return 0;
+	}
+
+	if (checkName!="table") {
+		fprintf(stderr, "Unknown check %s\n", checkName.c_str());
+		printUsage();
+		return 1;
+	}
+
+	const int numFailures=checkTable(referenceFileName);
+	if (numFailures<0)
+		return 1;
+	if (numFailures>0) {
+		fprintf(stderr, "%d values differ from the published table by more than the tolerances\n", numFailures);
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,492 @@
+/// @file Implementation of the functions declared in metalness_core.h.
+
+#include <string.h>
+
+#include <string>
+
+#include "metalness_core.h"
+#include "metalness_perf.h"
+#include "metalness_trace.h"
+
+/// Some presets derived from https://refractiveindex.info by sampling the n and k values
+/// at 0.65, 0.55, 0.45 micrometers.
+MetalPreset metalPresets[metalPreset_last]={
+	{ "Silver", Color(0.052225f, 0.059582f, 0.040000f), Color(4.4094f, 3.5974f, 2.6484f) },
+	{ "Gold", Color(0.15557f, 0.42415f, 1.3831f), Color(3.6024f, 2.4721f, 1.9155f) },
+	{ "Copper", Color(0.23780f, 1.0066f, 1.2404f), Color(3.6264f, 2.5823f, 2.3929f) },
+	{ "Aluminum", Color(1.5580f, 1.0152f, 0.63324f), Color(7.7124f, 6.6273f, 5.4544f) },
+	{ "Chromium", Color(3.1071f, 3.1812f, 2.3230f), Color(3.3314f, 3.3291f, 3.1350f) },
+	{ "Lead", Color(2.5750f, 2.5444f, 2.1038f), Color(4.1612f, 4.1823f, 4.1890f) },
+	{ "Platinum", Color(0.47475f, 0.46521f, 0.63275f), Color(6.3329f, 5.1073f, 3.7481f) },
+	{ "Titanium", Color(0.25300f, 0.28822f, 0.52181f), Color(5.2796f, 4.2122f, 3.0367f) },
+	{ "Tungsten", Color(0.92074f, 1.3437f, 2.2323f), Color(6.8595f, 5.2293f, 5.1461f) },
+	{ "Iron", Color(1.8247f, 1.2246f, 1.0205f), Color(7.6326f, 5.9377f, 4.3952f) },
+	{ "Vanadium", Color(0.43109f, 0.60711f, 0.91187f), Color(5.5575f, 4.5217f, 3.6035f) },
+	{ "Zinc", Color(1.2338f, 0.92943f, 0.67767f), Color(5.8730f, 4.9751f, 4.0122f) },
+	{ "Nickel", Color(1.3726f, 1.0753f, 1.1336f), Color(6.6273f, 5.1763f, 3.7544f) },
+	{ "Mercury", Color(2.0733f, 1.5523f, 1.0606f), Color(5.3383f, 4.6510f, 3.8628f) },
+	{ "Cobalt", Color(2.2371f, 2.0524f, 1.7365f), Color(4.2357f, 3.8242f, 3.2745f) }
+};
+
+/// Compute the sum of squared differences between the VRayMtl metallic Fresnel curve for the given IOR
+/// and the complex Fresnel curve sampled at cosines xs/numSamples for 0<xs<numSamples.
+static double getIORError(float ior, const Color &base, const Color &reflection, const Color *complexCurve, int numSamples) {
+	double sum=0.0f;
+	for (int xs=1; xs<numSamples; xs++) {
+		// Compute a viewing angle.
+		float x=(float) xs/(float) numSamples;
+
+		// Compute the VRayMtl reflectance
+		Color vrayMetallicFresnel=getVRayMetallicFresnel(base, reflection, ior, x);
+
+		// Accumulate the difference.
+		sum+=(vrayMetallicFresnel-complexCurve[xs]).lengthSqr();
+	}
+	return sum;
+}
+
+float findIOR(const Color &n, const Color &k, const FitOptions &options, long long *numEvaluations) {
+	METALNESS_TRACE_SCOPE("findIOR");
+	METALNESS_PERF_STAGE("findIOR sweep");
+
+	float bestIOR=-1.0f;
+	float bestResult=1e18f;
+	int numIORs=0;
+
+	// Compute the reflectance at 90 degrees.
+	Color reflection=getComplexFresnel(n, k, 0.0f);
+	
+	// Compute the reflectance when looking directly at the surface along the normal.
+	Color base=getComplexFresnel(n, k, 1.0f);
+
+	// The actual complex Fresnel reflectance does not depend on the IOR, so sample it only once.
+	const int numSamples=clamp(options.numIORSamples, 2, maxIORSamples);
+	Color complexCurve[maxIORSamples];
+	for (int xs=1; xs<numSamples; xs++)
+		complexCurve[xs]=getComplexFresnel(n, k, (float) xs/(float) numSamples);
+
+	if (options.solver==iorSolver_coarseToFine) {
+		// The error changes smoothly with the IOR, so find the best IOR in steps of 0.01 first...
+		int bestStep=0;
+		for (int step=0; step<900; step++) {
+			const float ior=1.001f+float(step)*0.01f;
+			const double sum=getIORError(ior, base, reflection, complexCurve, numSamples);
+			numIORs++;
+			if (sum<bestResult) {
+				bestResult=float(sum);
+				bestIOR=ior;
+				bestStep=step;
+			}
+		}
+
+		// ... and then in steps of 0.001 around it.
+		const float coarseIOR=1.001f+float(bestStep)*0.01f;
+		for (int step=-9; step<=9; step++) {
+			const float ior=coarseIOR+float(step)*0.001f;
+			if (step==0 || ior<1.001f || ior>=10.0f)
+				continue;
+
+			const double sum=getIORError(ior, base, reflection, complexCurve, numSamples);
+			numIORs++;
+			if (sum<bestResult) {
+				bestResult=float(sum);
+				bestIOR=ior;
+			}
+		}
+
+		if (numEvaluations)
+			*numEvaluations=(long long)(numIORs+1)*(numSamples-1);
+		return bestIOR;
+	}
+
+	// Step through all IOR values between 1.001f and 10.0f and find the best match.
+	// For each value, sample the VRayMtl metallic reflectance curve and compare it to the actual
+	// complex Fresnel reflectance curve for different viewing angles and compute the average difference.
+	// The best IOR value is the one with minimal differences between the VRayMtl curve and the
+	// actual complex Fresnel curve.
+	for (float ior=1.001f; ior<10.0f; ior+=0.001f) {
+		double sum=getIORError(ior, base, reflection, complexCurve, numSamples);
+		numIORs++;
+
+		// If result is better than what we have so far, save it.
+		if (sum<bestResult) {
+			bestResult=float(sum);
+			bestIOR=ior;
+		}
+	}
+
+	// The VRayMtl curve for each IOR value, and the complex curve once.
+	if (numEvaluations)
+		*numEvaluations=(long long)(numIORs+1)*(numSamples-1);
+
+	// Return the best result that we found.
+	return bestIOR;
+}
+
+/// Sample all reflectance curves for viewing angles between x0 and x1, placing more samples where
+/// the curves bend (mostly near grazing angles) and fewer where they are flat. Between consecutive
+/// samples, all curves are within the given tolerance from a straight line, so the same samples are
+/// used both for drawing the curves and for integrating the errors between them.
+/// @param curves The curves to sample.
+/// @param x0 The start of the interval.
+/// @param x1 The end of the interval.
+/// @param tolerance The maximum allowed deviation of the curves from a straight line between samples.
+/// @param minDepth Subdivide the interval at least 2^minDepth times, so that no features are missed.
+/// @param maxDepth Subdivide the interval at most 2^maxDepth times.
+/// @param samples The resulting samples, sorted by x.
+void sampleCurvesAdaptive(const PresetCurves &curves, float x0, float x1, float tolerance, int minDepth, int maxDepth, std::vector<CurveSample> &samples) {
+	METALNESS_TRACE_SCOPE("sampleCurvesAdaptive");
+	METALNESS_PERF_STAGE("curve evaluation");
+
+	samples.clear();
+	auto addSegment=[&samples](const CurveSample &a, const CurveSample &b) {
+		if (samples.empty())
+			samples.push_back(a);
+		samples.push_back(b);
+	};
+	forEachCurveSegment(curves, x0, x1, tolerance, minDepth, maxDepth, addSegment);
+}
+
+/// Integrate the squared difference between two of the curves with the trapezoid rule and return the
+/// average over the sampled interval.
+/// @param samples Samples returned by sampleCurvesAdaptive().
+/// @param curve Pointer to the member of CurveSample with the first curve.
+/// @param reference Pointer to the member of CurveSample with the second curve.
+double getAverageErrorSqr(const std::vector<CurveSample> &samples, Color CurveSample::*curve, Color CurveSample::*reference) {
+	METALNESS_TRACE_SCOPE("getAverageErrorSqr");
+
+	double sum=0.0;
+	double prevErrorSqr=(samples[0].*curve-samples[0].*reference).lengthSqr();
+	for (size_t i=1; i<samples.size(); i++) {
+		const double errorSqr=(samples[i].*curve-samples[i].*reference).lengthSqr();
+		sum+=(errorSqr+prevErrorSqr)*0.5*double(samples[i].x-samples[i-1].x);
+		prevErrorSqr=errorSqr;
+	}
+	return sum/double(samples.back().x-samples[0].x);
+}
+
+/// Find the minimum of a function of one variable in an interval with Brent's method, which combines
+/// parabolic interpolation with golden section steps.
+/// @param func The function, called as func(x).
+/// @param a The start of the interval.
+/// @param b The end of the interval.
+/// @param tolerance The relative tolerance for the position of the minimum.
+/// @param maxIterations The maximum number of evaluations of the function.
+/// @param minValue Receives the value of the function at the minimum.
+/// @return The position of the minimum.
+template<class Func>
+static double minimizeBrent(const Func &func, double a, double b, double tolerance, int maxIterations, double &minValue) {
+	const double goldenSection=0.3819660112501051;
+	double x=a+goldenSection*(b-a), w=x, v=x;
+	double fx=func(x), fw=fx, fv=fx;
+	double d=0.0, e=0.0;
+	for (int iteration=1; iteration<maxIterations; iteration++) {
+		const double m=0.5*(a+b);
+		const double tol1=tolerance*fabs(x)+1e-10;
+		const double tol2=2.0*tol1;
+		if (fabs(x-m)<=tol2-0.5*(b-a))
+			break;
+
+		// Try a parabola through x, w and v; fall back to a golden section step if its minimum is
+		// outside the interval or the step does not get smaller.
+		bool golden=true;
+		if (fabs(e)>tol1) {
+			const double r=(x-w)*(fx-fv);
+			double q=(x-v)*(fx-fw);
+			double p=(x-v)*q-(x-w)*r;
+			q=2.0*(q-r);
+			if (q>0.0) p=-p;
+			else q=-q;
+			const double prevE=e;
+			e=d;
+			if (fabs(p)<fabs(0.5*q*prevE) && p>q*(a-x) && p<q*(b-x)) {
+				d=p/q;
+				const double u=x+d;
+				if (u-a<tol2 || b-u<tol2)
+					d=(x<m)? tol1 : -tol1;
+				golden=false;
+			}
+		}
+		if (golden) {
+			e=(x<m)? b-x : a-x;
+			d=goldenSection*e;
+		}
+
+		const double u=(fabs(d)>=tol1)? x+d : x+(d>0.0? tol1 : -tol1);
+		const double fu=func(u);
+		if (fu<=fx) {
+			if (u<x) b=x;
+			else a=x;
+			v=w; fv=fw;
+			w=x; fw=fx;
+			x=u; fx=fu;
+		} else {
+			if (u<x) a=u;
+			else b=u;
+			if (fu<=fw || w==x) {
+				v=w; fv=fw;
+				w=u; fw=fu;
+			} else if (fu<=fv || v==x || v==w) {
+				v=u; fv=fu;
+			}
+		}
+	}
+	minValue=fx;
+	return x;
+}
+
+Color fitOleEdgeTint(const Color &n, const Color &k, const Color &base, const Color &edgeTint, int numSamples) {
+	numSamples=clamp(numSamples, 2, maxIORSamples);
+	Color result=edgeTint;
+	for (int c=0; c<3; c++) {
+		float target[maxIORSamples];
+		for (int xs=1; xs<numSamples; xs++)
+			target[xs]=complexFresnel(n[c], k[c], (float) xs/(float) numSamples);
+
+		const float r=base[c];
+		const auto getErrorSqr=[r, &target, numSamples](double g) {
+			double sum=0.0;
+			for (int xs=1; xs<numSamples; xs++) {
+				const double d=double(olefresnel(r, float(g), (float) xs/(float) numSamples))-double(target[xs]);
+				sum+=d*d;
+			}
+			return sum;
+		};
+
+		double fittedErrorSqr=0.0;
+		const double g=minimizeBrent(getErrorSqr, 0.0, 1.0, 1e-6, 64, fittedErrorSqr);
+		if (fittedErrorSqr<getErrorSqr(edgeTint[c]))
+			result[c]=float(g);
+	}
+	return result;
+}
+
+void fitMetal(const Color &n, const Color &k, PresetCurves &curves, const FitOptions &options) {
+	curves.n=n;
+	curves.k=k;
+
+	// The 90 degrees reflection color for the n and k values.
+	curves.reflection=getComplexFresnel(n, k, 0.0f);
+
+	// The base reflection color when looking directly at the surface along the normal.
+	curves.base=getComplexFresnel(n, k, 1.0f);
+
+	// The edgetint (g) for gulbrandsen fresnel
+	curves.edgeTint=getOleEdgeTint(curves.base, n);
+	if (options.modelFit==modelFit_leastSquares)
+		curves.edgeTint=fitOleEdgeTint(n, k, curves.base, curves.edgeTint, options.numIORSamples);
+
+	// Find an IOR value for the VRayMtl material for these n and k values.
+	curves.ior=findIOR(n, k, options);
+
+	// The tint for the F82-tint metallic Fresnel, from the complex curve at about 82 degrees.
+	curves.f82Tint=getF82Tint(n, k);
+	if (options.modelFit==modelFit_leastSquares)
+		fitModelBatch<F82TintModel>(&n, &k, &curves.f82Tint, 1, options.numIORSamples, 1);
+
+	// Schlick's approximation starts from the base color, and the error term of the Lazanyi-Schlick
+	// approximation from a match at about 82 and 70.5 degrees.
+	Color lazanyi[LazanyiSchlickModel::numParams];
+	getLazanyiSchlickParams(n, k, lazanyi);
+	curves.schlickF0=curves.base;
+	if (options.modelFit==modelFit_leastSquares) {
+		fitModelBatch<SchlickModel>(&n, &k, &curves.schlickF0, 1, options.numIORSamples, 1);
+		fitModelBatch<LazanyiSchlickModel>(&n, &k, lazanyi, 1, options.numIORSamples, 1);
+	}
+	curves.lazanyiF0=lazanyi[0];
+	curves.lazanyiScale=lazanyi[1];
+	curves.lazanyiExponent=lazanyi[2];
+}
+
+void computeCurveErrors(const PresetCurves &curves, const FitOptions &options, CurveErrors &errors, int *numSamples) {
+	METALNESS_TRACE_SCOPE("computeCurveErrors");
+	METALNESS_PERF_STAGE("curve evaluation");
+
+	if (options.errorSampling==curveSampling_uniform) {
+		// Average the squared errors over uniformly spaced cosines, the same way as for the published table.
+		const int numUniformSamples=(options.numUniformSamples>1)? options.numUniformSamples : 2;
+		double vrayErrorSqr=0.0, oleErrorSqr=0.0, f82ErrorSqr=0.0, schlickErrorSqr=0.0, lazanyiErrorSqr=0.0;
+		for (int xs=1; xs<numUniformSamples; xs++) {
+			const CurveSample sample=evalCurves(curves, float(xs)/float(numUniformSamples));
+			vrayErrorSqr+=(sample.vray-sample.complex).lengthSqr();
+			oleErrorSqr+=(sample.ole-sample.complex).lengthSqr();
+			f82ErrorSqr+=(sample.f82-sample.complex).lengthSqr();
+			schlickErrorSqr+=(sample.schlick-sample.complex).lengthSqr();
+			lazanyiErrorSqr+=(sample.lazanyi-sample.complex).lengthSqr();
+		}
+		errors.vray=sqrt(vrayErrorSqr/float(numUniformSamples));
+		errors.ole=sqrt(oleErrorSqr/float(numUniformSamples));
+		errors.f82=sqrt(f82ErrorSqr/float(numUniformSamples));
+		errors.schlick=sqrt(schlickErrorSqr/float(numUniformSamples));
+		errors.lazanyi=sqrt(lazanyiErrorSqr/float(numUniformSamples));
+		if (numSamples)
+			*numSamples=numUniformSamples-1;
+		return;
+	}
+
+	// Integrate the squared errors with the trapezoid rule over the segments.
+	double vraySum=0.0, oleSum=0.0, f82Sum=0.0, schlickSum=0.0, lazanyiSum=0.0;
+	int numSegments=0;
+	auto addSegment=[&vraySum, &oleSum, &f82Sum, &schlickSum, &lazanyiSum, &numSegments](const CurveSample &a, const CurveSample &b) {
+		numSegments++;
+		const double w=0.5*double(b.x-a.x);
+		vraySum+=w*((a.vray-a.complex).lengthSqr()+(b.vray-b.complex).lengthSqr());
+		oleSum+=w*((a.ole-a.complex).lengthSqr()+(b.ole-b.complex).lengthSqr());
+		f82Sum+=w*((a.f82-a.complex).lengthSqr()+(b.f82-b.complex).lengthSqr());
+		schlickSum+=w*((a.schlick-a.complex).lengthSqr()+(b.schlick-b.complex).lengthSqr());
+		lazanyiSum+=w*((a.lazanyi-a.complex).lengthSqr()+(b.lazanyi-b.complex).lengthSqr());
+	};
+
+	forEachCurveSegment(curves, curveStartX, curveEndX, options.tolerance, 4, 14, addSegment);
+
+	errors.vray=sqrt(vraySum/double(curveEndX-curveStartX));
+	errors.ole=sqrt(oleSum/double(curveEndX-curveStartX));
+	errors.f82=sqrt(f82Sum/double(curveEndX-curveStartX));
+	errors.schlick=sqrt(schlickSum/double(curveEndX-curveStartX));
+	errors.lazanyi=sqrt(lazanyiSum/double(curveEndX-curveStartX));
+	if (numSamples)
+		*numSamples=numSegments+1;
+}
+
+void fitF82TintBatch(const Color *n, const Color *k, Color *f0, Color *tint, size_t count, int numThreads, const FitOptions &options) {
+	parallelForBlocks(count, numThreads, [=](size_t start, size_t end) {
+		for (size_t i=start; i<end; i++) {
+			f0[i]=getComplexFresnel(n[i], k[i], 1.0f);
+			tint[i]=getF82Tint(n[i], k[i]);
+		}
+	});
+
+	if (options.modelFit==modelFit_leastSquares)
+		fitModelBatch<F82TintModel>(n, k, tint, count, options.numIORSamples, numThreads);
+}
+
+static const char *curveModelNames[curveModel_last]={ "vray", "ole", "f82", "schlick", "lazanyi" };
+
+const char* getCurveModelName(CurveModel model) {
+	return curveModelNames[model];
+}
+
+bool findCurveModels(const char *list, std::vector<CurveModel> &models) {
+	models.clear();
+	if (strcmp(list, "all")==0) {
+		for (int m=0; m<curveModel_last; m++)
+			models.push_back(CurveModel(m));
+		return true;
+	}
+
+	std::string name;
+	for (const char *c=list; ; c++) {
+		if (*c==',' || *c=='\0') {
+			int m=0;
+			while (m<curveModel_last && name!=curveModelNames[m])
+				m++;
+			if (m==curveModel_last)
+				return false;
+			models.push_back(CurveModel(m));
+			name.clear();
+			if (*c=='\0')
+				break;
+		} else {
+			name+=*c;
+		}
+	}
+	return true;
+}
+
+/// Evaluate the curve of a model for a block of cosines, for red, green and blue. Each loop only
+/// depends on the cosine, so the compiler can vectorize it.
+/// @param model The model.
+/// @param curves The settings of the metal.
+/// @param x The cosines.
+/// @param count The number of cosines, at most errorMatrixBlockSize.
+/// @param result Receives the reflectance for each color component and cosine.
+static void evalModelBlock(CurveModel model, const PresetCurves &curves, const float *x, int count, float result[3][errorMatrixBlockSize]) {
+	switch (model) {
+		case curveModel_vray: {
+			// The blend weight does not depend on the color, so it is computed once per cosine.
+			float f[errorMatrixBlockSize];
+			for (int i=0; i<count; i++)
+				f[i]=getVRayFresnelCoeff(curves.ior, x[i]);
+			for (int c=0; c<3; c++) {
+				const float base=curves.base[c], reflection=curves.reflection[c];
+				for (int i=0; i<count; i++)
+					result[c][i]=base*(1.0f-f[i])+reflection*f[i];
+			}
+			break;
+		}
+		case curveModel_ole:
+			for (int c=0; c<3; c++) {
+				const float r=curves.base[c], g=curves.edgeTint[c];
+				for (int i=0; i<count; i++)
+					result[c][i]=olefresnel(r, g, x[i]);
+			}
+			break;
+		case curveModel_f82:
+			for (int c=0; c<3; c++) {
+				const float f0=curves.base[c], tint=curves.f82Tint[c];
+				for (int i=0; i<count; i++)
+					result[c][i]=f82TintFresnel(f0, tint, x[i]);
+			}
+			break;
+		case curveModel_schlick:
+			for (int c=0; c<3; c++) {
+				const float f0=curves.schlickF0[c];
+				for (int i=0; i<count; i++)
+					result[c][i]=schlickFresnel(f0, x[i]);
+			}
+			break;
+		case curveModel_lazanyi:
+			for (int c=0; c<3; c++) {
+				const float f0=curves.lazanyiF0[c], a=curves.lazanyiScale[c], alpha=curves.lazanyiExponent[c];
+				for (int i=0; i<count; i++)
+					result[c][i]=lazanyiSchlickFresnel(f0, a, alpha, x[i]);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void computeErrorMatrix(const PresetCurves *curves, int count, const CurveModel *models, int numModels, int numSamples, double *errors, int numThreads) {
+	METALNESS_TRACE_SCOPE("computeErrorMatrix");
+
+	numSamples=(numSamples>1)? numSamples : 2;
+	parallelFor(count, numThreads, [=](int metal) {
+		METALNESS_PERF_STAGE("curve evaluation");
+
+		const PresetCurves &metalCurves=curves[metal];
+		for (int m=0; m<numModels; m++)
+			errors[m*count+metal]=0.0;
+
+		float x[errorMatrixBlockSize];
+		float complex[3][errorMatrixBlockSize];
+		float modelCurve[3][errorMatrixBlockSize];
+		for (int start=1; start<numSamples; start+=errorMatrixBlockSize) {
+			const int blockSize=(numSamples-start<errorMatrixBlockSize)? numSamples-start : errorMatrixBlockSize;
+			for (int i=0; i<blockSize; i++)
+				x[i]=float(start+i)/float(numSamples);
+
+			// The complex curve is the same for all models.
+			for (int c=0; c<3; c++) {
+				const float n=metalCurves.n[c], k=metalCurves.k[c];
+				for (int i=0; i<blockSize; i++)
+					complex[c][i]=complexFresnel(n, k, x[i]);
+			}
+
+			for (int m=0; m<numModels; m++) {
+				evalModelBlock(models[m], metalCurves, x, blockSize, modelCurve);
+				float sum=0.0f;
+				for (int c=0; c<3; c++) {
+					for (int i=0; i<blockSize; i++) {
+						const float d=modelCurve[c][i]-complex[c][i];
+						sum+=d*d;
+					}
+				}
+				errors[m*count+metal]+=sum;
+			}
+		}
+
+		for (int m=0; m<numModels; m++)
+			errors[m*count+metal]=sqrt(errors[m*count+metal]/double(numSamples));
+	});
+}
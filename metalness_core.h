@@ -0,0 +1,984 @@
+/// @file The Fresnel curves compared by the metalness program and the fitting of VRayMtl settings to
+/// measured n and k values of metals. This code is shared by the metalness program and the library
+/// with the C API in metalness_api.h. Nothing here uses global state, so all functions can be called
+/// concurrently from different threads.
+
+#ifndef METALNESS_CORE_H
+#define METALNESS_CORE_H
+
+#if !defined(_WIN32) && !defined(METALNESS_NO_VRAY_SDK)
+#define METALNESS_NO_VRAY_SDK
+#endif
+
+#include <math.h>
+
+#include <thread>
+#include <vector>
+
+#ifdef METALNESS_NO_VRAY_SDK
+#include "vray_compat.h"
+#else
+#include "utils.h"
+#include "misc_ray.h"
+#endif
+
+using namespace VUtils;
+
+/// The dielectric Fresnel coefficient that the VRayMtl material uses to blend between the base and
+/// the reflection colors for metals.
+/// @param ior The index of refraction.
+/// @param cs The cosine between the viewing angle and the surface normal.
+/// @return The blend weight of the reflection color.
+inline float getVRayFresnelCoeff(float ior, float cs) {
+	const simd::Vector3f viewDir(sqrtf(1.0f-cs*cs), 0.0f, -cs);
+	const simd::Vector3f normal(0.0f, 0.0f, 1.0f);
+
+	bool internalRefl=false;
+	const simd::Vector3f refractDir=getRefractDir(viewDir, normal, ior, internalRefl);
+
+	return getFresnelCoeff(viewDir, normal, refractDir, ior);
+}
+
+/// The formula that the VRayMtl material uses to compute metallic Fresnel.
+/// @param base The base color.
+/// @param reflection The reflection color.
+/// @param ior The index of refraction.
+/// @param cs The cosine between the viewing angle and the surface normal.
+/// @return The reflection strength.
+inline Color getVRayMetallicFresnel(const Color &base, const Color &reflection, float ior, float cs) {
+	const float f=getVRayFresnelCoeff(ior, cs);
+	return base*(1.0f-f)+reflection*f;
+}
+
+inline float n_min(float r) { 
+   return (1-r)/(1+r);
+}
+
+inline float n_max(float r) {
+return (1+sqrt(r))/(1-sqrt(r)); 
+}
+
+inline float get_n(float r, float g) {
+   return n_min(r)*g + (1-g)*n_max(r);
+}
+
+inline float get_k2(float r, float n) {
+   float nr = (n+1)*(n+1)*r-(n-1)*(n-1);
+   return nr/(1-r ); 
+}
+
+inline float get_r(float n, float k) {
+   return ((n-1)*(n-1)+k*k)/((n+1)*(n+1)+k*k);
+}
+
+inline float get_g(float n, float k) {
+   float r = get_r(n,k);
+   return (n_max(r)-n)/(n_max(r)-n_min(r)); 
+}
+
+/// Compute artist-friendly reflection strength from base and grazing angle strength. Works by trying
+/// to estimate the n and k values with some plausible formula, and then using those n and k values to
+/// compute the Fresnel effect.
+/// @param r The base reflection strength (when looking directly at the surface along the normal).
+/// @param g The reflection strength at 90 degrees.
+/// @param c The cosine between the viewing direction and the surface normal.
+/// @return A suitable reflection strength.
+inline float olefresnel(float r, float g, float c) { 
+   // clamp parameters
+   float _r = clamp(r, 0.0f, 0.99f); 
+   // compute n and k
+   float n = get_n(_r,g);
+   float k2 = get_k2(_r,n);
+
+   float rs_num = n*n + k2 - 2*n*c + c*c; 
+   float rs_den = n*n + k2 + 2*n*c + c*c;
+   float rs = rs_num/rs_den;
+   
+   float rp_num = (n*n + k2)*c*c - 2*n*c + 1; 
+   float rp_den = (n*n + k2)*c*c + 2*n*c + 1;
+   float rp = rp_num / rp_den ;
+   
+   return 0.5f*(rs+rp);
+}
+
+/// Artist-Friendly Metallic Fresnel by Ole Gulbrandsen, for comparison purposes against
+/// our implementation. Works by trying to estimate the n and k values with some plausible
+/// formula and then using those n and k values to compute the Fresnel effect. See
+/// http://jcgt.org/published/0003/04/03/paper.pdf for more information.
+/// @param base The base color.
+/// @param reflection The grazing angle reflection color (usually white).
+/// @param cos_theta Angle between the viewing direction and the surface normal.
+inline Color getOleMetallicFresnel(const Color &base, const Color &reflection, float cos_theta) {
+	Color result = Color(
+      olefresnel(base.r, reflection.r, cos_theta),
+      olefresnel(base.g, reflection.g, cos_theta),
+      olefresnel(base.b, reflection.b, cos_theta)
+   );
+	return result;
+}
+
+inline float getOleEdgeFloat(float n, float r) {
+	float g_num = ((1 + sqrt(r)) / (1 - sqrt(r))) - n;
+	float g_den = ((1 + sqrt(r)) / (1 - sqrt(r))) - ((1 - r) / (1 + r));
+	// For r=0, n_min(r)=n_max(r)=1, so the quotient is 0/0 and the curve does not depend on g;
+	// use the usual white edge tint.
+	if (g_den == 0.0f)
+		return 1.0f;
+	float g = g_num / g_den;
+	return g;
+}
+
+/// Artist-Friendly Metallic Fresnel by Ole Gulbrandsen, Creates the edgeTint (g)
+/// formula uses the base and n to derive the edgetint
+/// see formula 15 in https://jcgt.org/published/0003/04/03/paper.pdf
+/// @param base is the reflectivity(r) in gulbrandsen
+/// @param n the n value
+inline Color getOleEdgeTint(const Color &base, const Color &n) {
+	Color result = Color(
+		getOleEdgeFloat(n.r, base.r),
+		getOleEdgeFloat(n.g, base.g),
+		getOleEdgeFloat(n.b, base.b)
+	);
+	return result;
+}
+
+/// Compute reflection strength from complex index of refraction for one wavelength.
+/// @param n The n value.
+/// @param k The k value.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline float complexFresnel(float n, float k, float c) {
+	float k2=k*k;
+	float rs_num = n*n + k2 - 2*n*c + c*c;
+	float rs_den = n*n + k2 + 2*n*c + c*c;
+	float rs = rs_num/ rs_den ;
+
+	float rp_num = (n*n + k2)*c*c - 2*n*c + 1;
+	float rp_den = (n*n + k2)*c*c + 2*n*c + 1;
+	float rp = rp_num/ rp_den ;
+
+	return clamp(0.5f*(rs+rp), 0.0f, 1.0f);
+}
+
+/// Complex Fresnel for color n and k values for three wavelengths.
+/// @param n The n values.
+/// @param k The k values.
+/// @param cs The cosine between the viewing direction and the surface normal.
+inline Color getComplexFresnel(const Color &n, const Color &k, float cs) {
+	Color result(
+		complexFresnel(n[0], k[0], cs),
+		complexFresnel(n[1], k[1], cs),
+		complexFresnel(n[2], k[2], cs)
+	);
+	return result;
+}
+
+/// The cosine at which the F82-tint model is matched to the complex Fresnel curve; about 82 degrees.
+const float f82Cosine=1.0f/7.0f;
+
+/// Schlick's approximation of the Fresnel reflectance.
+/// @param f0 The reflectance when looking directly at the surface along the normal.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline float schlickFresnel(float f0, float c) {
+	const float m=1.0f-c;
+	const float m2=m*m;
+	return f0+(1.0f-f0)*m2*m2*m;
+}
+
+/// The F82-tint metallic Fresnel of the Autodesk Standard Surface and OpenPBR materials, by Naty Hoffman:
+/// Schlick's approximation minus a term that makes the reflectance at f82Cosine equal to the Schlick
+/// value times the tint.
+/// @param f0 The reflectance when looking directly at the surface along the normal (the base color).
+/// @param tint The tint at about 82 degrees (the specular color).
+/// @param c The cosine between the viewing direction and the surface normal.
+inline float f82TintFresnel(float f0, float tint, float c) {
+	const float mBar=1.0f-f82Cosine;
+	const float mBar2=mBar*mBar;
+	const float mBar6=mBar2*mBar2*mBar2;
+	const float b=schlickFresnel(f0, f82Cosine)*(1.0f-tint)/(f82Cosine*mBar6);
+
+	const float m=1.0f-c;
+	const float m2=m*m;
+	return clamp(schlickFresnel(f0, c)-b*c*m2*m2*m2, 0.0f, 1.0f);
+}
+
+/// The F82-tint metallic Fresnel for red/green/blue.
+/// @param f0 The base color.
+/// @param tint The specular color.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline Color getF82TintFresnel(const Color &f0, const Color &tint, float c) {
+	return Color(
+		f82TintFresnel(f0.r, tint.r, c),
+		f82TintFresnel(f0.g, tint.g, c),
+		f82TintFresnel(f0.b, tint.b, c)
+	);
+}
+
+/// Find the tint of the F82-tint metallic Fresnel for n and k values, so that the curve matches the complex
+/// Fresnel curve exactly along the normal and at f82Cosine. The base color is getComplexFresnel(n, k, 1.0f).
+/// The tint is clamped to [0, 1], the range of the specular color of the materials.
+/// @param n The n values.
+/// @param k The k values.
+inline Color getF82Tint(const Color &n, const Color &k) {
+	const Color f0=getComplexFresnel(n, k, 1.0f);
+	const Color f82=getComplexFresnel(n, k, f82Cosine);
+	Color tint;
+	for (int i=0; i<3; i++) {
+		const float schlick=schlickFresnel(f0[i], f82Cosine);
+		tint[i]=schlick>0.0f? clamp(f82[i]/schlick, 0.0f, 1.0f) : 1.0f;
+	}
+	return tint;
+}
+
+/// The maximum number of parameters of a model for fitModelBatch().
+const int maxModelParams=3;
+
+/// The base class of the models of one wavelength for fitModelBatch() and ModelSet (see metalness_models.h),
+/// with static dispatch to the model class Derived, which declares:
+///
+/// static const int numParams; The number of parameters, at most maxModelParams.
+/// static const char* getName(void); A short name for the command line and the JSON keys.
+/// static const char* getLabel(void); The name of the model in the CSV header.
+/// Derived(float n, float k); Set up the model for the n and k values of one wavelength.
+/// float evalValue(const float *params, float c) const; Return the reflectance for the cosine c.
+/// static float getMinParam(int i), getMaxParam(int i); The range of parameter i.
+/// static void getInitialParams(const Color &n, const Color &k, Color *params); A closed form fit for
+///     red/green/blue, which is the starting point of the least squares fit.
+///
+/// A model with analytic derivatives also declares float eval(const float *params, float c, float *gradient) const,
+/// which hides the one here that computes them with central differences. A model with a number of parameters
+/// or ranges that are only known at run time declares getNumParams(), getMinParam() and getMaxParam() as
+/// non-static members instead, and may declare evalSamples() to evaluate many cosines at once.
+template<class Derived>
+struct FresnelModel {
+	/// The number of parameters.
+	int getNumParams(void) const {
+		return Derived::numParams;
+	}
+
+	/// The reflectance at cosines xs/numSamples for 0<xs<numSamples and its derivatives by the parameters.
+	/// @param params The parameters.
+	/// @param numSamples The number of intervals between the cosines, at most maxIORSamples.
+	/// @param values Receives the reflectance at index xs.
+	/// @param gradients Receives the derivatives at index xs.
+	void evalSamples(const float *params, int numSamples, float *values, float (*gradients)[maxModelParams]) const {
+		const Derived &model=static_cast<const Derived&>(*this);
+		for (int xs=1; xs<numSamples; xs++)
+			values[xs]=model.eval(params, (float) xs/(float) numSamples, gradients[xs]);
+	}
+
+	/// The reflectance for the cosine c and its derivatives by the parameters.
+	float eval(const float *params, float c, float *gradient) const {
+		const Derived &model=static_cast<const Derived&>(*this);
+		const int numParams=model.getNumParams();
+		float p[maxModelParams];
+		for (int i=0; i<numParams; i++)
+			p[i]=params[i];
+		for (int i=0; i<numParams; i++) {
+			const float h=1e-3f*((fabsf(params[i])>1.0f)? fabsf(params[i]) : 1.0f);
+			p[i]=params[i]+h;
+			const float f1=model.evalValue(p, c);
+			p[i]=params[i]-h;
+			const float f0=model.evalValue(p, c);
+			p[i]=params[i];
+			gradient[i]=(f1-f0)/(2.0f*h);
+		}
+		return model.evalValue(params, c);
+	}
+};
+
+/// The F82-tint metallic Fresnel for one wavelength as a model for fitModelBatch(), with the tint as the
+/// only parameter. The base color f0 stays the complex Fresnel reflectance along the normal.
+struct F82TintModel: FresnelModel<F82TintModel> {
+	static const int numParams=1;
+
+	float f0; ///< The reflectance along the normal.
+	float tintScale; ///< The derivative of the reflectance by the tint, divided by c*(1-c)^6.
+
+	F82TintModel(float n, float k) {
+		const float mBar=1.0f-f82Cosine;
+		const float mBar2=mBar*mBar;
+		f0=complexFresnel(n, k, 1.0f);
+		tintScale=schlickFresnel(f0, f82Cosine)/(f82Cosine*mBar2*mBar2*mBar2);
+	}
+
+	/// The reflectance for the cosine c and its derivative by the tint.
+	float eval(const float *params, float c, float *gradient) const {
+		const float m=1.0f-c;
+		const float m2=m*m;
+		gradient[0]=tintScale*c*m2*m2*m2;
+		return f82TintFresnel(f0, params[0], c);
+	}
+
+	float evalValue(const float *params, float c) const {
+		return f82TintFresnel(f0, params[0], c);
+	}
+
+	/// The tint is the specular color of the materials, so it is in [0, 1].
+	static float getMinParam(int) { return 0.0f; }
+	static float getMaxParam(int) { return 1.0f; }
+
+	static const char* getName(void) { return "f82"; }
+	static const char* getLabel(void) { return "F82"; }
+	static void getInitialParams(const Color &n, const Color &k, Color *params) { params[0]=getF82Tint(n, k); }
+};
+
+/// Schlick's approximation with the error term for metals by Lazanyi and Szirmay-Kalos: Schlick's
+/// approximation minus a*c*(1-c)^alpha, which lowers the reflectance near grazing angles. The F82-tint
+/// metallic Fresnel is the special case alpha=6, with a computed from the tint; here the exponent is a
+/// parameter as well.
+/// @param f0 The reflectance when looking directly at the surface along the normal.
+/// @param a The scale of the error term.
+/// @param alpha The exponent of the error term.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline float lazanyiSchlickFresnel(float f0, float a, float alpha, float c) {
+	return clamp(schlickFresnel(f0, c)-a*c*powf(1.0f-c, alpha), 0.0f, 1.0f);
+}
+
+/// Schlick's approximation for red/green/blue.
+/// @param f0 The reflectance along the normal.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline Color getSchlickFresnel(const Color &f0, float c) {
+	return Color(schlickFresnel(f0.r, c), schlickFresnel(f0.g, c), schlickFresnel(f0.b, c));
+}
+
+/// The Lazanyi-Schlick approximation for red/green/blue.
+/// @param f0 The reflectance along the normal.
+/// @param a The scales of the error term.
+/// @param alpha The exponents of the error term.
+/// @param c The cosine between the viewing direction and the surface normal.
+inline Color getLazanyiSchlickFresnel(const Color &f0, const Color &a, const Color &alpha, float c) {
+	return Color(
+		lazanyiSchlickFresnel(f0.r, a.r, alpha.r, c),
+		lazanyiSchlickFresnel(f0.g, a.g, alpha.g, c),
+		lazanyiSchlickFresnel(f0.b, a.b, alpha.b, c)
+	);
+}
+
+/// The second cosine, besides f82Cosine, at which the closed form of the Lazanyi-Schlick approximation
+/// matches the complex Fresnel curve (about 70.5 degrees).
+const float lazanyiCosine=1.0f/3.0f;
+
+/// The range of the exponent of the error term of the Lazanyi-Schlick approximation.
+const float minLazanyiExponent=1.0f;
+const float maxLazanyiExponent=20.0f;
+
+/// Find the settings of the Lazanyi-Schlick approximation for n and k values, so that the curve matches the
+/// complex Fresnel curve exactly along the normal, at f82Cosine and at lazanyiCosine. Where that needs an
+/// exponent outside of [minLazanyiExponent, maxLazanyiExponent], the exponent is 6, as in the F82-tint
+/// model, and only f82Cosine is matched. Unlike the tint of getF82Tint(), the scale is not clamped.
+/// @param n The n values.
+/// @param k The k values.
+/// @param params Receives f0, the scale and the exponent.
+inline void getLazanyiSchlickParams(const Color &n, const Color &k, Color *params) {
+	const Color f0=getComplexFresnel(n, k, 1.0f);
+	const Color f1=getComplexFresnel(n, k, f82Cosine);
+	const Color f2=getComplexFresnel(n, k, lazanyiCosine);
+	params[0]=f0;
+	for (int i=0; i<3; i++) {
+		// The error terms d=a*c*(1-c)^alpha at the two cosines give alpha from their ratio.
+		const float d1=schlickFresnel(f0[i], f82Cosine)-f1[i];
+		const float d2=schlickFresnel(f0[i], lazanyiCosine)-f2[i];
+		const float ratio=(d1*lazanyiCosine)/(d2*f82Cosine);
+		float alpha=(ratio>0.0f)? logf(ratio)/logf((1.0f-f82Cosine)/(1.0f-lazanyiCosine)) : 0.0f;
+		if (!(alpha>=minLazanyiExponent && alpha<=maxLazanyiExponent))
+			alpha=6.0f;
+		params[1][i]=d1/(f82Cosine*powf(1.0f-f82Cosine, alpha));
+		params[2][i]=alpha;
+	}
+}
+
+/// Schlick's approximation for one wavelength as a model for fitModelBatch(), with f0 as the parameter.
+struct SchlickModel: FresnelModel<SchlickModel> {
+	static const int numParams=1;
+
+	SchlickModel(float, float) {}
+
+	/// The reflectance for the cosine c and its derivative by f0.
+	float eval(const float *params, float c, float *gradient) const {
+		const float m=1.0f-c;
+		const float m2=m*m;
+		gradient[0]=1.0f-m2*m2*m;
+		return schlickFresnel(params[0], c);
+	}
+
+	float evalValue(const float *params, float c) const {
+		return schlickFresnel(params[0], c);
+	}
+
+	static float getMinParam(int) { return 0.0f; }
+	static float getMaxParam(int) { return 1.0f; }
+
+	static const char* getName(void) { return "schlick"; }
+	static const char* getLabel(void) { return "Schlick"; }
+	static void getInitialParams(const Color &n, const Color &k, Color *params) { params[0]=getComplexFresnel(n, k, 1.0f); }
+};
+
+/// The Lazanyi-Schlick approximation for one wavelength as a model for fitModelBatch(), with f0 and the
+/// scale and the exponent of the error term as the parameters.
+struct LazanyiSchlickModel: FresnelModel<LazanyiSchlickModel> {
+	static const int numParams=3;
+
+	LazanyiSchlickModel(float, float) {}
+
+	/// The reflectance for the cosine c and its derivatives by f0, the scale and the exponent.
+	float eval(const float *params, float c, float *gradient) const {
+		const float m=1.0f-c;
+		const float m2=m*m;
+		const float term=c*powf(m, params[2]);
+		gradient[0]=1.0f-m2*m2*m;
+		gradient[1]=-term;
+		gradient[2]=(m>0.0f)? -params[1]*term*logf(m) : 0.0f;
+		return lazanyiSchlickFresnel(params[0], params[1], params[2], c);
+	}
+
+	float evalValue(const float *params, float c) const {
+		return lazanyiSchlickFresnel(params[0], params[1], params[2], c);
+	}
+
+	/// f0 is a reflectance; the scale covers the error terms of the exponents in range with some margin.
+	static float getMinParam(int i) { return (i==0)? 0.0f : (i==1)? -50.0f : minLazanyiExponent; }
+	static float getMaxParam(int i) { return (i==0)? 1.0f : (i==1)? 50.0f : maxLazanyiExponent; }
+
+	static const char* getName(void) { return "lazanyi"; }
+	static const char* getLabel(void) { return "Lazanyi"; }
+	static void getInitialParams(const Color &n, const Color &k, Color *params) { getLazanyiSchlickParams(n, k, params); }
+};
+
+/// A metal preset with n and k values for three wavelengths (0.65, 0.55, 0.45 micrometers).
+struct MetalPreset {
+	char name[512]; ///< The name of the preset.
+	Color n, k; ///< n and k values for red/green/blue wavelengths (0.65, 0.55, 0.45 micrometers).
+};
+
+enum MetalPresetName {
+	metalPreset_silver=0,
+	metalPreset_gold,
+	metalPreset_copper,
+	metalPreset_aluminum,
+	metalPreset_chromium,
+	metalPreset_lead,
+	metalPreset_platinum,
+	metalPreset_titanium,
+	metalPreset_tungsten,
+	metalPreset_iron,
+	metalPreset_vanadium,
+	metalPreset_zinc,
+	metalPreset_nickel,
+	metalPreset_mercury,
+	metalPreset_cobalt,
+
+	metalPreset_last,
+};
+
+/// Some presets derived from https://refractiveindex.info by sampling the n and k values
+/// at 0.65, 0.55, 0.45 micrometers.
+extern MetalPreset metalPresets[metalPreset_last];
+
+/// The reflectance curves that are compared for one metal preset.
+struct PresetCurves {
+	Color n, k; ///< The complex index of refraction.
+	Color base; ///< The base reflection color.
+	Color reflection; ///< The reflection color at 90 degrees.
+	Color edgeTint; ///< The edge tint for Ole Gulbrandsen's metallic Fresnel.
+	float ior; ///< The IOR for the VRayMtl metallic Fresnel.
+	Color f82Tint; ///< The tint for the F82-tint metallic Fresnel, which uses the base color as f0.
+	Color schlickF0; ///< f0 for Schlick's approximation.
+	Color lazanyiF0; ///< f0 for the Lazanyi-Schlick approximation.
+	Color lazanyiScale; ///< The scale of the error term of the Lazanyi-Schlick approximation.
+	Color lazanyiExponent; ///< The exponent of the error term of the Lazanyi-Schlick approximation.
+};
+
+/// The values of all compared reflectance curves for one viewing angle.
+struct CurveSample {
+	float x; ///< The cosine between the viewing direction and the surface normal.
+	Color vray; ///< The VRayMtl metallic Fresnel.
+	Color ole; ///< Ole Gulbrandsen's metallic Fresnel.
+	Color f82; ///< The F82-tint metallic Fresnel.
+	Color schlick; ///< Schlick's approximation.
+	Color lazanyi; ///< The Lazanyi-Schlick approximation.
+	Color complex; ///< The actual complex Fresnel.
+};
+
+/// Evaluate all reflectance curves for one viewing angle.
+inline CurveSample evalCurves(const PresetCurves &curves, float x) {
+	CurveSample sample;
+	sample.x=x;
+	sample.vray=getVRayMetallicFresnel(curves.base, curves.reflection, curves.ior, x);
+	sample.ole=getOleMetallicFresnel(curves.base, curves.edgeTint, x);
+	sample.f82=getF82TintFresnel(curves.base, curves.f82Tint, x);
+	sample.schlick=getSchlickFresnel(curves.schlickF0, x);
+	sample.lazanyi=getLazanyiSchlickFresnel(curves.lazanyiF0, curves.lazanyiScale, curves.lazanyiExponent, x);
+	sample.complex=getComplexFresnel(curves.n, curves.k, x);
+	return sample;
+}
+
+/// Return how far the sample m is from the straight line between the samples a and b, over
+/// all curves and color components.
+inline float getLinearDeviation(const CurveSample &a, const CurveSample &m, const CurveSample &b) {
+	static Color CurveSample::* const members[]={
+		&CurveSample::vray, &CurveSample::ole, &CurveSample::f82, &CurveSample::schlick, &CurveSample::lazanyi, &CurveSample::complex
+	};
+
+	const float t=(m.x-a.x)/(b.x-a.x);
+	float result=0.0f;
+	for (size_t j=0; j<sizeof(members)/sizeof(members[0]); j++) {
+		const Color d=m.*members[j]-(a.*members[j]*(1.0f-t)+b.*members[j]*t);
+		for (int i=0; i<3; i++) {
+			if (fabsf(d[i])>result) result=fabsf(d[i]);
+		}
+	}
+	return result;
+}
+
+/// Recursively subdivide the interval between the samples a and b, calling segmentFunc(a, b) for
+/// each of the resulting segments, in order.
+template<class SegmentFunc>
+void subdivideCurves(const PresetCurves &curves, const CurveSample &a, const CurveSample &b, float tolerance, int depth, int minDepth, int maxDepth, SegmentFunc &segmentFunc) {
+	const CurveSample m=evalCurves(curves, (a.x+b.x)*0.5f);
+	if (depth<maxDepth && (depth<minDepth || getLinearDeviation(a, m, b)>tolerance)) {
+		subdivideCurves(curves, a, m, tolerance, depth+1, minDepth, maxDepth, segmentFunc);
+		subdivideCurves(curves, m, b, tolerance, depth+1, minDepth, maxDepth, segmentFunc);
+	} else {
+		segmentFunc(a, m);
+		segmentFunc(m, b);
+	}
+}
+
+/// Split the viewing angles between x0 and x1 into segments, with shorter segments where the curves
+/// bend (mostly near grazing angles) and longer ones where they are flat. Within each segment, all
+/// curves are within the given tolerance from a straight line. No memory is allocated.
+/// @param curves The curves to sample.
+/// @param x0 The start of the interval.
+/// @param x1 The end of the interval.
+/// @param tolerance The maximum allowed deviation of the curves from a straight line in a segment.
+/// @param minDepth Subdivide the interval at least 2^minDepth times, so that no features are missed.
+/// @param maxDepth Subdivide the interval at most 2^maxDepth times.
+/// @param segmentFunc Called as segmentFunc(a, b) with the samples at the ends of each segment, in
+/// order of increasing x.
+template<class SegmentFunc>
+void forEachCurveSegment(const PresetCurves &curves, float x0, float x1, float tolerance, int minDepth, int maxDepth, SegmentFunc &segmentFunc) {
+	subdivideCurves(curves, evalCurves(curves, x0), evalCurves(curves, x1), tolerance, 0, minDepth, maxDepth, segmentFunc);
+}
+
+/// Sample all reflectance curves for viewing angles between x0 and x1, placing more samples where
+/// the curves bend (mostly near grazing angles) and fewer where they are flat. Between consecutive
+/// samples, all curves are within the given tolerance from a straight line, so the same samples are
+/// used both for drawing the curves and for integrating the errors between them.
+/// @param curves The curves to sample.
+/// @param x0 The start of the interval.
+/// @param x1 The end of the interval.
+/// @param tolerance The maximum allowed deviation of the curves from a straight line between samples.
+/// @param minDepth Subdivide the interval at least 2^minDepth times, so that no features are missed.
+/// @param maxDepth Subdivide the interval at most 2^maxDepth times.
+/// @param samples The resulting samples, sorted by x.
+void sampleCurvesAdaptive(const PresetCurves &curves, float x0, float x1, float tolerance, int minDepth, int maxDepth, std::vector<CurveSample> &samples);
+
+/// Integrate the squared difference between two of the curves with the trapezoid rule and return the
+/// average over the sampled interval.
+/// @param samples Samples returned by sampleCurvesAdaptive().
+/// @param curve Pointer to the member of CurveSample with the first curve.
+/// @param reference Pointer to the member of CurveSample with the second curve.
+double getAverageErrorSqr(const std::vector<CurveSample> &samples, Color CurveSample::*curve, Color CurveSample::*reference);
+
+/// The range of cosines over which the curves are compared. Exactly 90 degrees is excluded, where
+/// the VRayMtl metallic Fresnel is not well defined; the ends are at the pixel centers of an 800
+/// pixels wide graph.
+const float curveStartX=0.5f/800.0f;
+const float curveEndX=1.0f-curveStartX;
+
+/// The default tolerance for the adaptive sampling of the curves; a quarter of a pixel of an
+/// 800 pixels high graph.
+const float defaultCurveTolerance=0.25f/800.0f;
+
+/// The methods for finding the VRayMtl IOR in findIOR().
+enum IORSolver {
+	iorSolver_bruteForce=0, ///< Try all IOR values from 1.001 to 10 in steps of 0.001; this gives the published table.
+	iorSolver_coarseToFine, ///< Try steps of 0.01 first, and then steps of 0.001 around the best of those.
+
+	iorSolver_last,
+};
+
+/// How the curves are sampled when computing the errors of a fit.
+enum CurveSampling {
+	curveSampling_adaptive=0, ///< More samples where the curves bend, see forEachCurveSegment().
+	curveSampling_uniform, ///< Uniformly spaced cosines, as for the published table.
+
+	curveSampling_last,
+};
+
+/// How the settings of the models other than the VRayMtl are found: the edge tint of Ole Gulbrandsen's
+/// metallic Fresnel, the tint of the F82-tint metallic Fresnel and the Schlick and Lazanyi-Schlick
+/// approximations.
+enum ModelFit {
+	modelFit_closedForm=0, ///< Formula 15 of Ole Gulbrandsen's paper, and matches of the complex Fresnel curve along the normal and at f82Cosine.
+	modelFit_leastSquares, ///< Start from the closed forms and minimize the squared error against the complex Fresnel curve.
+
+	modelFit_last,
+};
+
+/// The maximum number of viewing angles at which findIOR() and fitModelBatch() compare the curves.
+const int maxIORSamples=1024;
+
+/// Options for fitting the VRayMtl settings to a metal and for computing the errors of the fit.
+struct FitOptions {
+	IORSolver solver; ///< The search method for the IOR.
+	int numIORSamples; ///< The IOR search and the least squares fits compare the curves at cosines i/numIORSamples for 0<i<numIORSamples.
+	ModelFit modelFit; ///< How the settings of the Ole, F82-tint, Schlick and Lazanyi-Schlick models are found.
+	CurveSampling errorSampling; ///< How the curves are sampled for the errors.
+	float tolerance; ///< The tolerance for adaptive sampling of the errors, see forEachCurveSegment().
+	int numUniformSamples; ///< For uniform sampling, the errors are averaged over cosines i/numUniformSamples.
+
+	FitOptions(void):
+		solver(iorSolver_bruteForce),
+		numIORSamples(200),
+		modelFit(modelFit_closedForm),
+		errorSampling(curveSampling_adaptive),
+		tolerance(defaultCurveTolerance),
+		numUniformSamples(1600)
+	{}
+};
+
+/// Given n and k values, find the best VRayMtl IOR value that will give the closest match to the
+/// actual complex reflectance curve.
+/// @param n The n values for red/green/blue.
+/// @param k The k values for red/green/blue.
+/// @param options The search method and the number of viewing angles to compare the curves at.
+/// @param numEvaluations If not NULL, receives the number of evaluations of the VRayMtl and the complex
+/// Fresnel curves, for benchmarks.
+/// @return An IOR value for the VRayMtl material that is the closest fit to the actual
+/// complex reflectance curve. Computed by sampling IOR values between 1.001f and 10.0f,
+/// and for each IOR value, computing the difference between the VRayMtl metallic Fresnel reflectance
+/// curve, and the actual complex reflectance curve.
+float findIOR(const Color &n, const Color &k, const FitOptions &options=FitOptions(), long long *numEvaluations=NULL);
+
+/// Fit the edge tint of Ole Gulbrandsen's metallic Fresnel to the complex Fresnel curve by least squares,
+/// for each of the red, green and blue wavelengths, with Brent's method on [0, 1]. The edge tint of
+/// formula 15, see getOleEdgeTint(), is kept for a wavelength if it fits better.
+/// @param n The n values.
+/// @param k The k values.
+/// @param base The base color.
+/// @param edgeTint The edge tint from formula 15.
+/// @param numSamples The curves are compared at cosines i/numSamples for 0<i<numSamples.
+/// @return The fitted edge tint.
+Color fitOleEdgeTint(const Color &n, const Color &k, const Color &base, const Color &edgeTint, int numSamples);
+
+/// Find the VRayMtl settings for a metal: the base and reflection colors, the IOR, and also the edge
+/// tint for Ole Gulbrandsen's metallic Fresnel, the tint for the F82-tint metallic Fresnel and the settings
+/// of the Schlick and Lazanyi-Schlick approximations.
+/// @param n The n values for red/green/blue.
+/// @param k The k values for red/green/blue.
+/// @param curves The resulting settings and the n and k values, which define all compared curves.
+/// @param options Options for the IOR search and the fits of the other models.
+void fitMetal(const Color &n, const Color &k, PresetCurves &curves, const FitOptions &options=FitOptions());
+
+/// The root mean square errors of the compared curves against the actual complex Fresnel curve.
+struct CurveErrors {
+	double vray; ///< The error of the VRayMtl metallic Fresnel curve.
+	double ole; ///< The error of Ole Gulbrandsen's metallic Fresnel curve.
+	double f82; ///< The error of the F82-tint metallic Fresnel curve.
+	double schlick; ///< The error of Schlick's approximation.
+	double lazanyi; ///< The error of the Lazanyi-Schlick approximation.
+
+	CurveErrors(void):vray(0.0), ole(0.0), f82(0.0), schlick(0.0), lazanyi(0.0) {}
+};
+
+/// Compute the average errors of the VRayMtl, Ole and F82-tint metallic Fresnel curves and of the Schlick
+/// and Lazanyi-Schlick approximations against the actual complex Fresnel curve, evaluating all curves in
+/// the same pass. No memory is allocated.
+/// @param curves The curves, f.e. from fitMetal().
+/// @param options How to sample the curves.
+/// @param errors Receives the errors.
+/// @param numSamples If not NULL, receives the number of viewing angles at which the curves were evaluated.
+void computeCurveErrors(const PresetCurves &curves, const FitOptions &options, CurveErrors &errors, int *numSamples=NULL);
+
+/// The computed settings for one metal, as written to the CSV file and the swatch table.
+struct PresetResult {
+	const char *name; ///< The name of the metal.
+	Color n, k; ///< The n and k values of the metal for red/green/blue.
+	Color base; ///< The base reflection color, when looking directly at the surface along the normal.
+	Color reflection; ///< The reflection color at 90 degrees.
+	float ior; ///< The VRayMtl IOR value that best matches the complex Fresnel curve.
+	Color edgeTint; ///< The edge tint for Ole Gulbrandsen's metallic Fresnel, see PresetCurves::edgeTint.
+	double vrayError; ///< The average error of the VRayMtl metallic Fresnel curve.
+	double oleError; ///< The average error of Ole Gulbrandsen's metallic Fresnel curve.
+	double f82Error; ///< The average error of the F82-tint metallic Fresnel curve.
+	double schlickError; ///< The average error of Schlick's approximation.
+	double lazanyiError; ///< The average error of the Lazanyi-Schlick approximation.
+	int numExtraModels; ///< The number of models of a ModelSet with errors in extraErrors, see metalness_models.h.
+	const char *const *extraModelNames; ///< The names of those models, from ModelSet::getNames().
+	const char *const *extraModelLabels; ///< The labels of those models, from ModelSet::getLabels().
+	const double *extraErrors; ///< The average errors of those models.
+
+	PresetResult(void):
+		name(NULL),
+		ior(0.0f),
+		vrayError(0.0), oleError(0.0), f82Error(0.0), schlickError(0.0), lazanyiError(0.0),
+		numExtraModels(0), extraModelNames(NULL), extraModelLabels(NULL), extraErrors(NULL)
+	{}
+};
+
+/// Call func(i) for all i in [0, count) from several threads. Each thread gets a contiguous
+/// range of indices, so the function should be safe to call concurrently for different indices.
+/// @param count The number of indices.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+/// @param func The function to call.
+template<class Func>
+void parallelFor(int count, int numThreads, const Func &func) {
+	if (numThreads<=0)
+		numThreads=int(std::thread::hardware_concurrency());
+	numThreads=clamp(numThreads, 1, count>0? count : 1);
+
+	if (numThreads==1) {
+		for (int i=0; i<count; i++)
+			func(i);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (int t=0; t<numThreads; t++) {
+		threads.push_back(std::thread([&func, count, numThreads, t]() {
+			const int start=int((long long)(count)*t/numThreads);
+			const int end=int((long long)(count)*(t+1)/numThreads);
+			for (int i=start; i<end; i++)
+				func(i);
+		}));
+	}
+	for (int t=0; t<numThreads; t++)
+		threads[t].join();
+}
+
+/// The number of consecutive elements that parallelForBlocks() gives to one thread at a time.
+const size_t parallelBlockSize=4096;
+
+/// Split the indices in [0, count) into blocks of parallelBlockSize consecutive indices and call
+/// func(start, end) for each block from several threads. The loops over a block in func can then
+/// be vectorized by the compiler.
+/// @param count The number of indices.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+/// @param func The function to call.
+template<class Func>
+void parallelForBlocks(size_t count, int numThreads, const Func &func) {
+	const int numBlocks=int((count+parallelBlockSize-1)/parallelBlockSize);
+	parallelFor(numBlocks, numThreads, [count, &func](int block) {
+		const size_t start=size_t(block)*parallelBlockSize;
+		const size_t end=(count-start<parallelBlockSize)? count : start+parallelBlockSize;
+		func(start, end);
+	});
+}
+
+/// The maximum number of Levenberg-Marquardt iterations in fitModel().
+const int maxModelFitIterations=32;
+
+/// Solve a linear system with Gaussian elimination and partial pivoting.
+/// @param a The augmented matrix, n rows of n coefficients followed by the right-hand side; it is changed.
+/// @param n The number of unknowns.
+/// @param x Receives the solution.
+/// @return false if the matrix is singular.
+inline bool solveLinearSystem(double a[maxModelParams][maxModelParams+1], int n, double *x) {
+	for (int col=0; col<n; col++) {
+		int pivot=col;
+		for (int row=col+1; row<n; row++)
+			if (fabs(a[row][col])>fabs(a[pivot][col])) pivot=row;
+		if (a[pivot][col]==0.0)
+			return false;
+		for (int j=0; j<=n; j++) {
+			const double t=a[col][j];
+			a[col][j]=a[pivot][j];
+			a[pivot][j]=t;
+		}
+		for (int row=col+1; row<n; row++) {
+			const double f=a[row][col]/a[col][col];
+			for (int j=col; j<=n; j++)
+				a[row][j]-=f*a[col][j];
+		}
+	}
+	for (int row=n-1; row>=0; row--) {
+		double sum=a[row][n];
+		for (int j=row+1; j<n; j++)
+			sum-=a[row][j]*x[j];
+		x[row]=sum/a[row][row];
+	}
+	return true;
+}
+
+/// Compute the sum of squared differences between a model and sampled values of a curve, and the normal
+/// equations J^T*J and J^T*r of the differences r by the parameters.
+template<class Model>
+double getModelErrorSqr(const Model &model, const float *target, int numSamples, const float *params, double jtj[maxModelParams][maxModelParams], double *jtr) {
+	const int numParams=model.getNumParams();
+	for (int i=0; i<numParams; i++) {
+		jtr[i]=0.0;
+		for (int j=0; j<numParams; j++)
+			jtj[i][j]=0.0;
+	}
+
+	float values[maxIORSamples];
+	float gradients[maxIORSamples][maxModelParams];
+	model.evalSamples(params, numSamples, values, gradients);
+
+	double sum=0.0;
+	for (int xs=1; xs<numSamples; xs++) {
+		const float *gradient=gradients[xs];
+		const double r=double(values[xs])-double(target[xs]);
+		sum+=r*r;
+		for (int i=0; i<numParams; i++) {
+			jtr[i]+=gradient[i]*r;
+			for (int j=0; j<numParams; j++)
+				jtj[i][j]+=double(gradient[i])*double(gradient[j]);
+		}
+	}
+	return sum;
+}
+
+/// Fit the parameters of a model for one wavelength to sampled values of the complex Fresnel curve with
+/// the Levenberg-Marquardt method, keeping them in the ranges of the model. See fitModelBatch() for the
+/// members of the model.
+/// @param model The model.
+/// @param target The complex Fresnel reflectance at cosines xs/numSamples for 0<xs<numSamples.
+/// @param numSamples The number of intervals between the cosines.
+/// @param params The starting parameters; receives the fitted parameters.
+/// @return The sum of squared differences for the fitted parameters.
+template<class Model>
+double fitModel(const Model &model, const float *target, int numSamples, float *params) {
+	const int numParams=model.getNumParams();
+	double jtj[maxModelParams][maxModelParams], jtr[maxModelParams];
+	double errorSqr=getModelErrorSqr(model, target, numSamples, params, jtj, jtr);
+
+	double lambda=1e-3;
+	for (int iteration=0; iteration<maxModelFitIterations && lambda<1e10; iteration++) {
+		// Solve (J^T*J + lambda*diag(J^T*J))*delta = -J^T*r for the step.
+		double a[maxModelParams][maxModelParams+1];
+		for (int i=0; i<numParams; i++) {
+			for (int j=0; j<numParams; j++)
+				a[i][j]=jtj[i][j]*((i==j)? 1.0+lambda : 1.0);
+			a[i][numParams]=-jtr[i];
+		}
+
+		double delta[maxModelParams];
+		float newParams[maxModelParams];
+		if (!solveLinearSystem(a, numParams, delta)) {
+			lambda*=10.0;
+			continue;
+		}
+		bool changed=false;
+		for (int i=0; i<numParams; i++) {
+			newParams[i]=clamp(params[i]+float(delta[i]), model.getMinParam(i), model.getMaxParam(i));
+			changed|=(fabsf(newParams[i]-params[i])>1e-6f*(1.0f+fabsf(params[i])));
+		}
+
+		// Steps that do not change the parameters in float precision only mean that the fit converged.
+		if (!changed)
+			break;
+
+		double newJtj[maxModelParams][maxModelParams], newJtr[maxModelParams];
+		const double newErrorSqr=getModelErrorSqr(model, target, numSamples, newParams, newJtj, newJtr);
+		if (newErrorSqr>=errorSqr) {
+			lambda*=10.0;
+			continue;
+		}
+
+		const bool converged=(errorSqr-newErrorSqr<=1e-9*errorSqr);
+		errorSqr=newErrorSqr;
+		for (int i=0; i<numParams; i++) {
+			params[i]=newParams[i];
+			jtr[i]=newJtr[i];
+			for (int j=0; j<numParams; j++)
+				jtj[i][j]=newJtj[i][j];
+		}
+		if (converged)
+			break;
+		lambda*=0.1;
+	}
+	return errorSqr;
+}
+
+/// Fit the parameters of a model to the complex Fresnel curve of one metal by least squares, for each of
+/// the red, green and blue wavelengths.
+/// @param n The n values.
+/// @param k The k values.
+/// @param params Model::numParams colors, which hold the starting parameters and receive the fitted ones.
+/// @param numSamples The curves are compared at cosines i/numSamples for 0<i<numSamples.
+template<class Model>
+void fitModelMetal(const Color &n, const Color &k, Color *params, int numSamples) {
+	numSamples=clamp(numSamples, 2, maxIORSamples);
+	float target[maxIORSamples];
+	for (int c=0; c<3; c++) {
+		for (int xs=1; xs<numSamples; xs++)
+			target[xs]=complexFresnel(n[c], k[c], (float) xs/(float) numSamples);
+
+		float p[maxModelParams];
+		for (int i=0; i<Model::numParams; i++)
+			p[i]=params[i][c];
+		fitModel(Model(n[c], k[c]), target, numSamples, p);
+		for (int i=0; i<Model::numParams; i++)
+			params[i][c]=p[i];
+	}
+}
+
+/// Fit the parameters of a model to the complex Fresnel curves of many metals by least squares, for each
+/// of the red, green and blue wavelengths, from several threads. The model is a class derived from
+/// FresnelModel.
+/// @param n The n values of the metals.
+/// @param k The k values of the metals.
+/// @param params Model::numParams colors per metal, with parameter i of metal m in params[m*Model::numParams+i].
+/// Holds the starting parameters, f.e. from a closed form fit, and receives the fitted parameters.
+/// @param count The number of metals.
+/// @param numSamples The curves are compared at cosines i/numSamples for 0<i<numSamples.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+template<class Model>
+void fitModelBatch(const Color *n, const Color *k, Color *params, size_t count, int numSamples, int numThreads) {
+	parallelForBlocks(count, numThreads, [=](size_t start, size_t end) {
+		for (size_t m=start; m<end; m++)
+			fitModelMetal<Model>(n[m], k[m], params+m*Model::numParams, numSamples);
+	});
+}
+
+/// Find the base colors and the tints of the F82-tint metallic Fresnel for many metals, see getF82Tint().
+/// @param n The n values of the metals.
+/// @param k The k values of the metals.
+/// @param f0 Receives the base colors.
+/// @param tint Receives the tints.
+/// @param count The number of metals.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+/// @param options With modelFit_leastSquares, the closed form tints are refined with fitModelBatch().
+void fitF82TintBatch(const Color *n, const Color *k, Color *f0, Color *tint, size_t count, int numThreads, const FitOptions &options=FitOptions());
+
+/// The models that computeErrorMatrix() compares with the complex Fresnel curve.
+enum CurveModel {
+	curveModel_vray=0, ///< The VRayMtl metallic Fresnel.
+	curveModel_ole, ///< Ole Gulbrandsen's metallic Fresnel.
+	curveModel_f82, ///< The F82-tint metallic Fresnel.
+	curveModel_schlick, ///< Schlick's approximation.
+	curveModel_lazanyi, ///< The Lazanyi-Schlick approximation.
+
+	curveModel_last,
+};
+
+/// Get the short name of a model, as used on the command line and in the error matrix.
+const char* getCurveModelName(CurveModel model);
+
+/// Find the models in a comma separated list of names, see getCurveModelName(), or "all".
+/// @param list The list of names.
+/// @param models Receives the models, in the order of the list.
+/// @return false if a name is not known.
+bool findCurveModels(const char *list, std::vector<CurveModel> &models);
+
+/// The number of cosines that computeErrorMatrix() evaluates at a time for one metal.
+const int errorMatrixBlockSize=64;
+
+/// Compute the errors of several models against the complex Fresnel curve for many metals in one fused
+/// pass. For each metal, the cosines are processed in blocks of errorMatrixBlockSize: the complex curve
+/// is evaluated once per block, and then each model is evaluated over the whole block in a loop that the
+/// compiler can vectorize and compared with it while the block is in the cache. The errors are the same
+/// as those of computeCurveErrors() with uniform sampling.
+/// @param curves The fitted settings of the metals, f.e. from fitMetal().
+/// @param count The number of metals.
+/// @param models The models to compare.
+/// @param numModels The number of models.
+/// @param numSamples The curves are compared at cosines i/numSamples for 0<i<numSamples.
+/// @param errors Receives numModels*count root mean square errors, with the error of model m for metal i
+/// in errors[m*count+i].
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+void computeErrorMatrix(const PresetCurves *curves, int count, const CurveModel *models, int numModels, int numSamples, double *errors, int numThreads);
+
+#endif // METALNESS_CORE_H
@@ -0,0 +1,703 @@
+/// @file Implementation of the functions declared in metalness_expression.h.
+
+#include <ctype.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metalness_expression.h"
+#include "metalness_models.h"
+#include "metalness_perf.h"
+#include "metalness_trace.h"
+
+/// The first register after the inputs; the same for all programs, so that the parameters are always
+/// in the same registers.
+const int firstFreeRegister=expressionInput_params+maxModelParams;
+
+/// The maximum nesting depth of the parentheses, function calls, signs and exponents of a formula, which
+/// bounds the recursion of the parser.
+const int maxExpressionDepth=256;
+
+/// Apply an operation to single values; used for constant folding.
+static float applyExpressionOp(int op, float a, float b, float c) {
+	switch (op) {
+		case expressionOp_add: return a+b;
+		case expressionOp_sub: return a-b;
+		case expressionOp_mul: return a*b;
+		case expressionOp_div: return a/b;
+		case expressionOp_neg: return -a;
+		case expressionOp_pow: return powf(a, b);
+		case expressionOp_sqrt: return sqrtf(a);
+		case expressionOp_exp: return expf(a);
+		case expressionOp_log: return logf(a);
+		case expressionOp_abs: return fabsf(a);
+		case expressionOp_min: return (a<b)? a : b;
+		case expressionOp_max: return (a>b)? a : b;
+		case expressionOp_clamp: return (a<b)? b : ((a>c)? c : a);
+		default: return 0.0f;
+	}
+}
+
+/// The functions that can be called in a formula.
+static const struct {
+	const char *name;
+	ExpressionOp op;
+	int numArgs;
+} expressionFunctions[]={
+	{ "sqrt", expressionOp_sqrt, 1 },
+	{ "exp", expressionOp_exp, 1 },
+	{ "log", expressionOp_log, 1 },
+	{ "abs", expressionOp_abs, 1 },
+	{ "pow", expressionOp_pow, 2 },
+	{ "min", expressionOp_min, 2 },
+	{ "max", expressionOp_max, 2 },
+	{ "clamp", expressionOp_clamp, 3 },
+};
+
+/// A value during compilation: either a constant that is not in a register yet, or a register.
+struct ExpressionOperand {
+	bool isConstant;
+	float value; ///< The value of a constant.
+	int reg; ///< The register of a value that is not a constant.
+
+	static ExpressionOperand constant(float value) {
+		ExpressionOperand operand;
+		operand.isConstant=true;
+		operand.value=value;
+		operand.reg=-1;
+		return operand;
+	}
+
+	static ExpressionOperand inRegister(int reg) {
+		ExpressionOperand operand;
+		operand.isConstant=false;
+		operand.value=0.0f;
+		operand.reg=reg;
+		return operand;
+	}
+};
+
+/// A recursive descent parser that compiles formulas to programs. The registers of intermediate values
+/// are reference counted and reused as soon as the last instruction that reads them is emitted.
+class ExpressionParser {
+public:
+	std::string error; ///< The first error.
+
+	ExpressionParser(const char *source):source(source), pos(source), program(NULL), paramNames(NULL), allowCosineAndParams(false), depth(0) {}
+
+	bool atEnd(void) {
+		skipSpace();
+		return *pos=='\0';
+	}
+
+	bool accept(char ch) {
+		skipSpace();
+		if (*pos!=ch)
+			return false;
+		pos++;
+		return true;
+	}
+
+	bool expect(char ch) {
+		if (accept(ch))
+			return true;
+		char message[64];
+		sprintf(message, "Expected '%c'", ch);
+		return fail(message);
+	}
+
+	bool acceptWord(const char *word) {
+		skipSpace();
+		const size_t length=strlen(word);
+		if (strncmp(pos, word, length)!=0 || isIdentifierChar(pos[length]))
+			return false;
+		pos+=length;
+		return true;
+	}
+
+	bool parseIdentifier(std::string &identifier) {
+		skipSpace();
+		if (!isalpha((unsigned char) *pos) && *pos!='_')
+			return fail("Expected a name");
+		const char *start=pos;
+		while (isIdentifierChar(*pos))
+			pos++;
+		identifier.assign(start, pos);
+		return true;
+	}
+
+	/// Parse a number with an optional sign, for the ranges of the parameters.
+	bool parseSignedNumber(float &value) {
+		const bool negative=accept('-');
+		if (!parseNumber(value))
+			return false;
+		if (negative)
+			value=-value;
+		return true;
+	}
+
+	bool fail(const char *message) {
+		if (error.empty()) {
+			char text[256];
+			sprintf(text, "%s at position %d", message, int(pos-source)+1);
+			error=text;
+		}
+		return false;
+	}
+
+	/// Compile an expression up to the next token that cannot continue it.
+	/// @param result Receives the program.
+	/// @param names The names of the parameters that the expression can use.
+	/// @param cosineAndParams Whether the expression can use the cosine and the parameters, or only n and k.
+	bool compileExpression(ExpressionProgram &result, const std::vector<std::string> &names, bool cosineAndParams) {
+		program=&result;
+		paramNames=&names;
+		allowCosineAndParams=cosineAndParams;
+		for (int i=0; i<maxExpressionRegisters; i++) {
+			inUse[i]=(i<firstFreeRegister);
+			refs[i]=0;
+		}
+		result=ExpressionProgram();
+		result.numRegisters=firstFreeRegister;
+
+		ExpressionOperand value;
+		if (!parseSum(value))
+			return false;
+		result.result=getRegister(value);
+		return result.result>=0;
+	}
+
+private:
+	const char *source; ///< The whole formula, for the positions in the errors.
+	const char *pos; ///< The next character to parse.
+	ExpressionProgram *program; ///< The program that is compiled.
+	const std::vector<std::string> *paramNames; ///< The parameters that the expression can use.
+	bool allowCosineAndParams; ///< Whether the expression can use the cosine and the parameters.
+	bool inUse[maxExpressionRegisters]; ///< The registers with inputs, constants or live intermediate values.
+	int depth; ///< The number of values that are being parsed, one for each nested parenthesis, function argument, sign and exponent.
+	int refs[maxExpressionRegisters]; ///< The number of references to the intermediate values.
+
+	static bool isIdentifierChar(char ch) {
+		return isalnum((unsigned char) ch) || ch=='_';
+	}
+
+	void skipSpace(void) {
+		while (isspace((unsigned char) *pos))
+			pos++;
+	}
+
+	bool parseNumber(float &value) {
+		skipSpace();
+		if (!isdigit((unsigned char) *pos) && *pos!='.')
+			return fail("Expected a number");
+		char *end=NULL;
+		value=float(strtod(pos, &end));
+		if (end==pos)
+			return fail("Expected a number");
+		pos=end;
+		return true;
+	}
+
+	/// Find a free register.
+	/// @param unused Only take a register that no instruction wrote so far, f.e. for a constant, which is
+	/// stored before the first instruction runs.
+	/// @return -1 if all registers are used.
+	int allocRegister(bool unused=false) {
+		for (int i=unused? program->numRegisters : firstFreeRegister; i<maxExpressionRegisters; i++) {
+			if (!inUse[i]) {
+				inUse[i]=true;
+				if (i>=program->numRegisters)
+					program->numRegisters=i+1;
+				return i;
+			}
+		}
+		fail("The formula is too long");
+		return -1;
+	}
+
+	/// Get the register of an operand, putting constants into registers; the same constant is only stored once.
+	/// @return -1 if all registers are used.
+	int getRegister(const ExpressionOperand &operand) {
+		if (!operand.isConstant)
+			return operand.reg;
+		for (size_t i=0; i<program->constants.size(); i++) {
+			if (program->constants[i]==operand.value)
+				return program->constantRegisters[i];
+		}
+		const int reg=allocRegister(true);
+		if (reg>=0) {
+			program->constantRegisters.push_back(reg);
+			program->constants.push_back(operand.value);
+		}
+		return reg;
+	}
+
+	/// Add a reference to an intermediate value.
+	void retain(const ExpressionOperand &operand) {
+		if (!operand.isConstant)
+			refs[operand.reg]++;
+	}
+
+	/// Remove a reference to an intermediate value and free its register after the last one.
+	void release(const ExpressionOperand &operand) {
+		if (!operand.isConstant && refs[operand.reg]>0 && --refs[operand.reg]==0)
+			inUse[operand.reg]=false;
+	}
+
+	/// Emit an instruction, or fold it into a constant if all operands are constants. The references of
+	/// the operands are released.
+	bool emit(ExpressionOp op, int numOperands, const ExpressionOperand *operands, ExpressionOperand &result) {
+		bool allConstant=true;
+		for (int i=0; i<numOperands; i++)
+			allConstant&=operands[i].isConstant;
+		if (allConstant) {
+			float values[3]={ 0.0f, 0.0f, 0.0f };
+			for (int i=0; i<numOperands; i++)
+				values[i]=operands[i].value;
+			result=ExpressionOperand::constant(applyExpressionOp(op, values[0], values[1], values[2]));
+			return true;
+		}
+
+		int regs[3]={ 0, 0, 0 };
+		for (int i=0; i<numOperands; i++) {
+			regs[i]=getRegister(operands[i]);
+			if (regs[i]<0)
+				return false;
+		}
+		for (int i=0; i<numOperands; i++)
+			release(operands[i]);
+
+		// An operand register can be reused for the result, since each instruction reads an element of
+		// its operands before it writes the same element of the result.
+		const int dst=allocRegister();
+		if (dst<0)
+			return false;
+		refs[dst]=1;
+
+		ExpressionInstruction instruction;
+		instruction.op=(unsigned char) op;
+		instruction.dst=(unsigned char) dst;
+		instruction.a=(unsigned char) regs[0];
+		instruction.b=(unsigned char) regs[1];
+		instruction.c=(unsigned char) regs[2];
+		program->code.push_back(instruction);
+		result=ExpressionOperand::inRegister(dst);
+		return true;
+	}
+
+	bool emit(ExpressionOp op, const ExpressionOperand &a, ExpressionOperand &result) {
+		return emit(op, 1, &a, result);
+	}
+
+	bool emit(ExpressionOp op, const ExpressionOperand &a, const ExpressionOperand &b, ExpressionOperand &result) {
+		const ExpressionOperand operands[2]={ a, b };
+		return emit(op, 2, operands, result);
+	}
+
+	/// Raise a value to an integer power by repeated squaring.
+	bool emitIntegerPower(const ExpressionOperand &base, int exponent, ExpressionOperand &result) {
+		if (exponent==0) {
+			release(base);
+			result=ExpressionOperand::constant(1.0f);
+			return true;
+		}
+
+		const bool negative=(exponent<0);
+		int remaining=negative? -exponent : exponent;
+		ExpressionOperand square=base;
+		bool haveResult=false;
+		while (true) {
+			if (remaining&1) {
+				retain(square);
+				if (haveResult) {
+					if (!emit(expressionOp_mul, result, square, result))
+						return false;
+				} else {
+					result=square;
+					haveResult=true;
+				}
+			}
+			remaining>>=1;
+			if (remaining==0)
+				break;
+			retain(square);
+			if (!emit(expressionOp_mul, square, square, square))
+				return false;
+		}
+		release(square);
+
+		if (negative)
+			return emit(expressionOp_div, ExpressionOperand::constant(1.0f), result, result);
+		return true;
+	}
+
+	bool parseSum(ExpressionOperand &result) {
+		if (!parseProduct(result))
+			return false;
+		while (true) {
+			ExpressionOp op;
+			if (accept('+')) op=expressionOp_add;
+			else if (accept('-')) op=expressionOp_sub;
+			else return true;
+
+			ExpressionOperand rhs;
+			if (!parseProduct(rhs) || !emit(op, result, rhs, result))
+				return false;
+		}
+	}
+
+	bool parseProduct(ExpressionOperand &result) {
+		if (!parseUnary(result))
+			return false;
+		while (true) {
+			ExpressionOp op;
+			if (accept('*')) op=expressionOp_mul;
+			else if (accept('/')) op=expressionOp_div;
+			else return true;
+
+			ExpressionOperand rhs;
+			if (!parseUnary(rhs) || !emit(op, result, rhs, result))
+				return false;
+		}
+	}
+
+	/// A value with optional signs. Every nested parenthesis, function argument, sign and exponent passes
+	/// through here, so the nesting depth is counted here.
+	bool parseUnary(ExpressionOperand &result) {
+		if (depth>=maxExpressionDepth)
+			return fail("The formula is nested too deeply");
+		depth++;
+		bool ok;
+		if (accept('-')) {
+			ExpressionOperand value;
+			ok=parseUnary(value) && emit(expressionOp_neg, value, result);
+		} else if (accept('+')) {
+			ok=parseUnary(result);
+		} else {
+			ok=parsePower(result);
+		}
+		depth--;
+		return ok;
+	}
+
+	/// A power, which binds tighter than a sign on its left and is right associative.
+	bool parsePower(ExpressionOperand &result) {
+		if (!parsePrimary(result))
+			return false;
+		if (!accept('^'))
+			return true;
+
+		ExpressionOperand exponent;
+		if (!parseUnary(exponent))
+			return false;
+		if (exponent.isConstant && exponent.value==floorf(exponent.value) && fabsf(exponent.value)<=16.0f)
+			return emitIntegerPower(result, int(exponent.value), result);
+		return emit(expressionOp_pow, result, exponent, result);
+	}
+
+	bool parsePrimary(ExpressionOperand &result) {
+		skipSpace();
+		if (isdigit((unsigned char) *pos) || *pos=='.') {
+			float value;
+			if (!parseNumber(value))
+				return false;
+			result=ExpressionOperand::constant(value);
+			return true;
+		}
+		if (accept('('))
+			return parseSum(result) && expect(')');
+
+		if (!isalpha((unsigned char) *pos) && *pos!='_')
+			return fail("Expected a value");
+		const char *start=pos;
+		std::string identifier;
+		if (!parseIdentifier(identifier))
+			return false;
+
+		if (accept('(')) {
+			for (size_t i=0; i<sizeof(expressionFunctions)/sizeof(expressionFunctions[0]); i++) {
+				if (identifier!=expressionFunctions[i].name)
+					continue;
+				ExpressionOperand args[3];
+				for (int j=0; j<expressionFunctions[i].numArgs; j++) {
+					if ((j>0 && !expect(',')) || !parseSum(args[j]))
+						return false;
+				}
+				return expect(')') && emit(expressionFunctions[i].op, expressionFunctions[i].numArgs, args, result);
+			}
+			pos=start;
+			return fail(("Unknown function "+identifier).c_str());
+		}
+
+		if (identifier=="n") {
+			result=ExpressionOperand::inRegister(expressionInput_n);
+			return true;
+		}
+		if (identifier=="k") {
+			result=ExpressionOperand::inRegister(expressionInput_k);
+			return true;
+		}
+		if (identifier=="pi") {
+			result=ExpressionOperand::constant(3.14159265f);
+			return true;
+		}
+		if (allowCosineAndParams) {
+			if (identifier=="c") {
+				result=ExpressionOperand::inRegister(expressionInput_c);
+				return true;
+			}
+			for (size_t i=0; i<paramNames->size(); i++) {
+				if (identifier==(*paramNames)[i]) {
+					result=ExpressionOperand::inRegister(expressionInput_params+int(i));
+					return true;
+				}
+			}
+		}
+		pos=start;
+		return fail(allowCosineAndParams? ("Unknown name "+identifier).c_str() : ("Only n and k can be used here, not "+identifier).c_str());
+	}
+};
+
+bool FresnelExpression::compile(const char *formulaName, const char *source, std::string &error) {
+	name=formulaName;
+	params.clear();
+	program=ExpressionProgram();
+
+	ExpressionParser parser(source);
+	std::vector<std::string> paramNames;
+	while (parser.acceptWord("param")) {
+		Param param;
+		if (!parser.parseIdentifier(param.name))
+			break;
+		bool reserved=(param.name=="n" || param.name=="k" || param.name=="c" || param.name=="pi" || param.name=="param" || param.name=="in");
+		for (size_t i=0; i<paramNames.size(); i++)
+			reserved|=(param.name==paramNames[i]);
+		if (reserved) {
+			parser.fail(("The name is already used: "+param.name).c_str());
+			break;
+		}
+		if (int(params.size())==maxModelParams) {
+			parser.fail("Too many parameters");
+			break;
+		}
+
+		if (parser.accept('=')) {
+			if (!parser.compileExpression(param.initial, paramNames, false))
+				break;
+		} else {
+			param.initial.constantRegisters.push_back(firstFreeRegister);
+			param.initial.constants.push_back(0.0f);
+			param.initial.result=firstFreeRegister;
+			param.initial.numRegisters=firstFreeRegister+1;
+		}
+
+		param.minValue=-FLT_MAX;
+		param.maxValue=FLT_MAX;
+		if (parser.acceptWord("in")) {
+			if (!parser.expect('[') || !parser.parseSignedNumber(param.minValue) || !parser.expect(',') || !parser.parseSignedNumber(param.maxValue) || !parser.expect(']'))
+				break;
+			if (param.minValue>param.maxValue) {
+				parser.fail("The range is empty");
+				break;
+			}
+		}
+		if (!parser.expect(';'))
+			break;
+
+		params.push_back(param);
+		paramNames.push_back(param.name);
+	}
+
+	if (parser.error.empty() && parser.compileExpression(program, paramNames, true) && !parser.atEnd())
+		parser.fail("Expected the end of the formula");
+
+	error=parser.error;
+	return error.empty();
+}
+
+void runExpression(const ExpressionProgram &program, const float *const *inputs, const int *strides, int numInputs, int count, float *result) {
+	float regs[maxExpressionRegisters][expressionBatchSize];
+
+	// Constants and inputs that are the same for all elements are filled in once.
+	for (size_t i=0; i<program.constants.size(); i++) {
+		float *reg=regs[program.constantRegisters[i]];
+		for (int j=0; j<expressionBatchSize; j++)
+			reg[j]=program.constants[i];
+	}
+	for (int i=0; i<numInputs; i++) {
+		if (strides[i]==0) {
+			for (int j=0; j<expressionBatchSize; j++)
+				regs[i][j]=inputs[i][0];
+		}
+	}
+
+	// Only the inputs that the program reads are copied for each batch.
+	const int numInstructions=int(program.code.size());
+	bool isRead[expressionInput_params+maxModelParams]={ false };
+	for (int i=0; i<numInstructions; i++) {
+		const ExpressionInstruction &instruction=program.code[i];
+		const int operands[3]={ instruction.a, instruction.b, instruction.c };
+		for (int j=0; j<3; j++) {
+			if (operands[j]<numInputs) isRead[operands[j]]=true;
+		}
+	}
+	if (program.result<numInputs)
+		isRead[program.result]=true;
+
+	for (int start=0; start<count; start+=expressionBatchSize) {
+		const int m=(count-start<expressionBatchSize)? count-start : expressionBatchSize;
+		for (int i=0; i<numInputs; i++) {
+			if (strides[i]!=0 && isRead[i])
+				memcpy(regs[i], inputs[i]+start, sizeof(float)*m);
+		}
+
+		for (int i=0; i<numInstructions; i++) {
+			const ExpressionInstruction &instruction=program.code[i];
+			float *d=regs[instruction.dst];
+			const float *a=regs[instruction.a];
+			const float *b=regs[instruction.b];
+			const float *c=regs[instruction.c];
+			switch (instruction.op) {
+				case expressionOp_add: for (int j=0; j<m; j++) d[j]=a[j]+b[j]; break;
+				case expressionOp_sub: for (int j=0; j<m; j++) d[j]=a[j]-b[j]; break;
+				case expressionOp_mul: for (int j=0; j<m; j++) d[j]=a[j]*b[j]; break;
+				case expressionOp_div: for (int j=0; j<m; j++) d[j]=a[j]/b[j]; break;
+				case expressionOp_neg: for (int j=0; j<m; j++) d[j]=-a[j]; break;
+				case expressionOp_pow: for (int j=0; j<m; j++) d[j]=powf(a[j], b[j]); break;
+				case expressionOp_sqrt: for (int j=0; j<m; j++) d[j]=sqrtf(a[j]); break;
+				case expressionOp_exp: for (int j=0; j<m; j++) d[j]=expf(a[j]); break;
+				case expressionOp_log: for (int j=0; j<m; j++) d[j]=logf(a[j]); break;
+				case expressionOp_abs: for (int j=0; j<m; j++) d[j]=fabsf(a[j]); break;
+				case expressionOp_min: for (int j=0; j<m; j++) d[j]=(a[j]<b[j])? a[j] : b[j]; break;
+				case expressionOp_max: for (int j=0; j<m; j++) d[j]=(a[j]>b[j])? a[j] : b[j]; break;
+				case expressionOp_clamp: for (int j=0; j<m; j++) d[j]=(a[j]<b[j])? b[j] : ((a[j]>c[j])? c[j] : a[j]); break;
+				default: break;
+			}
+		}
+
+		memcpy(result+start, regs[program.result], sizeof(float)*m);
+	}
+}
+
+void FresnelExpression::getInitialParams(const Color &n, const Color &k, Color *result) const {
+	const int strides[2]={ 0, 0 };
+	for (size_t i=0; i<params.size(); i++) {
+		for (int c=0; c<3; c++) {
+			const float *inputs[2]={ &n[c], &k[c] };
+			float value;
+			runExpression(params[i].initial, inputs, strides, 2, 1, &value);
+			result[i][c]=clamp(value, params[i].minValue, params[i].maxValue);
+		}
+	}
+}
+
+void FresnelExpression::evaluate(const float *n, const float *k, const float *c, const float *const *paramValues, int count, float *result) const {
+	const float *inputs[expressionInput_params+maxModelParams]={ n, k, c };
+	int strides[expressionInput_params+maxModelParams]={ 1, 1, 1 };
+	for (size_t i=0; i<params.size(); i++) {
+		inputs[expressionInput_params+i]=paramValues[i];
+		strides[expressionInput_params+i]=1;
+	}
+	runExpression(program, inputs, strides, expressionInput_params+int(params.size()), count, result);
+}
+
+void FresnelExpression::evaluateCurve(float n, float k, const float *paramValues, const float *c, int count, float *result) const {
+	const float *inputs[expressionInput_params+maxModelParams]={ &n, &k, c };
+	int strides[expressionInput_params+maxModelParams]={ 0, 0, 1 };
+	for (size_t i=0; i<params.size(); i++) {
+		inputs[expressionInput_params+i]=paramValues+i;
+		strides[expressionInput_params+i]=0;
+	}
+	runExpression(program, inputs, strides, expressionInput_params+int(params.size()), count, result);
+}
+
+void FresnelExpression::evaluateColors(const Color &n, const Color &k, const Color *paramValues, const float *c, int count, Color *result) const {
+	float values[expressionBatchSize];
+	for (int ch=0; ch<3; ch++) {
+		float p[maxModelParams];
+		for (size_t i=0; i<params.size(); i++)
+			p[i]=paramValues[i][ch];
+		for (int start=0; start<count; start+=expressionBatchSize) {
+			const int m=(count-start<expressionBatchSize)? count-start : expressionBatchSize;
+			evaluateCurve(n[ch], k[ch], p, c+start, m, values);
+			for (int j=0; j<m; j++)
+				result[start+j][ch]=values[j];
+		}
+	}
+}
+
+void ExpressionModel::evalSamples(const float *params, int numSamples, float *values, float (*gradients)[maxModelParams]) const {
+	const int count=numSamples-1;
+	float x[maxIORSamples];
+	for (int xs=1; xs<numSamples; xs++)
+		x[xs]=(float) xs/(float) numSamples;
+	expression.evaluateCurve(n, k, params, x+1, count, values+1);
+
+	// Central differences, with each shifted parameter evaluated for all cosines at once.
+	const int numParams=getNumParams();
+	float p[maxModelParams];
+	for (int i=0; i<numParams; i++)
+		p[i]=params[i];
+	float plus[maxIORSamples], minus[maxIORSamples];
+	for (int i=0; i<numParams; i++) {
+		const float h=1e-3f*((fabsf(params[i])>1.0f)? fabsf(params[i]) : 1.0f);
+		p[i]=params[i]+h;
+		expression.evaluateCurve(n, k, p, x+1, count, plus+1);
+		p[i]=params[i]-h;
+		expression.evaluateCurve(n, k, p, x+1, count, minus+1);
+		p[i]=params[i];
+		for (int xs=1; xs<numSamples; xs++)
+			gradients[xs][i]=(plus[xs]-minus[xs])/(2.0f*h);
+	}
+}
+
+void fitExpression(const FresnelExpression &expression, const Color &n, const Color &k, Color *params, const FitOptions &options) {
+	METALNESS_TRACE_SCOPE_DETAIL("fitExpression", expression.getName());
+
+	expression.getInitialParams(n, k, params);
+	if (options.modelFit!=modelFit_leastSquares || expression.getNumParams()==0)
+		return;
+
+	const int numSamples=clamp(options.numIORSamples, 2, maxIORSamples);
+	float target[maxIORSamples];
+	for (int c=0; c<3; c++) {
+		for (int xs=1; xs<numSamples; xs++)
+			target[xs]=complexFresnel(n[c], k[c], (float) xs/(float) numSamples);
+
+		float p[maxModelParams];
+		for (int i=0; i<expression.getNumParams(); i++)
+			p[i]=params[i][c];
+		fitModel(ExpressionModel(expression, n[c], k[c]), target, numSamples, p);
+		for (int i=0; i<expression.getNumParams(); i++)
+			params[i][c]=p[i];
+	}
+}
+
+double computeExpressionError(const FresnelExpression &expression, const PresetCurves &curves, const Color *params, const FitOptions &options) {
+	METALNESS_TRACE_SCOPE_DETAIL("computeExpressionError", expression.getName());
+	METALNESS_PERF_STAGE("curve evaluation");
+
+	if (options.errorSampling==curveSampling_uniform) {
+		const int numUniformSamples=(options.numUniformSamples>1)? options.numUniformSamples : 2;
+		double sum=0.0;
+		float x[expressionBatchSize];
+		Color values[expressionBatchSize];
+		for (int start=1; start<numUniformSamples; start+=expressionBatchSize) {
+			const int m=(numUniformSamples-start<expressionBatchSize)? numUniformSamples-start : expressionBatchSize;
+			for (int i=0; i<m; i++)
+				x[i]=float(start+i)/float(numUniformSamples);
+			expression.evaluateColors(curves.n, curves.k, params, x, m, values);
+			for (int i=0; i<m; i++)
+				sum+=(values[i]-getComplexFresnel(curves.n, curves.k, x[i])).lengthSqr();
+		}
+		return sqrt(sum/float(numUniformSamples));
+	}
+
+	std::vector<float> x;
+	std::vector<Color> complex;
+	getAdaptiveErrorSamples(curves, options, x, complex);
+	std::vector<Color> values(x.size());
+	expression.evaluateColors(curves.n, curves.k, params, &x[0], int(x.size()), &values[0]);
+	return getSampledError(&x[0], &complex[0], &values[0], int(x.size()));
+}
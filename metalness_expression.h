@@ -0,0 +1,198 @@
+/// @file User-defined Fresnel formulas that are compiled at run time, so that new curves can be compared
+/// with the complex Fresnel curve without recompiling the program. A formula is a list of parameter
+/// declarations followed by an expression, separated by semicolons, f.e.
+///
+/// param f0=((n-1)^2+k^2)/((n+1)^2+k^2) in [0, 1]; param p=5 in [1, 20]; f0+(1-f0)*(1-c)^p
+///
+/// The expression can use the n and k values of one wavelength, the cosine c between the viewing direction
+/// and the surface normal, the parameters, pi, the operators + - * / ^ and the functions sqrt, exp, log,
+/// abs, pow, min, max and clamp. The starting value of a parameter is an expression of n and k, and is 0
+/// if it is not given; the range is unbounded if it is not given. The parameters are fitted to the complex
+/// Fresnel curve like those of the built-in models.
+///
+/// The formula is compiled to instructions for a register machine, with constant folding and small integer
+/// powers expanded to multiplications. The interpreter runs each instruction over a batch of
+/// expressionBatchSize inputs in a loop that the compiler can vectorize, so the cost of decoding the
+/// instructions is shared by the whole batch.
+
+#ifndef METALNESS_EXPRESSION_H
+#define METALNESS_EXPRESSION_H
+
+#include <string>
+#include <vector>
+
+#include "metalness_core.h"
+
+/// The operations of the instructions of a compiled formula.
+enum ExpressionOp {
+	expressionOp_add=0, ///< dst=a+b
+	expressionOp_sub, ///< dst=a-b
+	expressionOp_mul, ///< dst=a*b
+	expressionOp_div, ///< dst=a/b
+	expressionOp_neg, ///< dst=-a
+	expressionOp_pow, ///< dst=pow(a, b)
+	expressionOp_sqrt, ///< dst=sqrt(a)
+	expressionOp_exp, ///< dst=exp(a)
+	expressionOp_log, ///< dst=log(a)
+	expressionOp_abs, ///< dst=abs(a)
+	expressionOp_min, ///< dst=min(a, b)
+	expressionOp_max, ///< dst=max(a, b)
+	expressionOp_clamp, ///< dst=clamp(a, b, c)
+
+	expressionOp_last,
+};
+
+/// One instruction of a compiled formula, with the indices of its registers.
+struct ExpressionInstruction {
+	unsigned char op; ///< The operation, see ExpressionOp.
+	unsigned char dst; ///< The register that receives the result.
+	unsigned char a, b, c; ///< The registers with the operands, as far as the operation uses them.
+};
+
+/// The maximum number of registers of a compiled formula, including the inputs and the constants.
+const int maxExpressionRegisters=64;
+
+/// The number of inputs that the interpreter evaluates at a time.
+const int expressionBatchSize=64;
+
+/// The registers that hold the inputs of a formula. The parameters follow in order.
+enum ExpressionInput {
+	expressionInput_n=0, ///< The n value.
+	expressionInput_k, ///< The k value.
+	expressionInput_c, ///< The cosine between the viewing direction and the surface normal.
+	expressionInput_params, ///< The first parameter.
+};
+
+/// A compiled expression: the instructions, the registers with constants and the register with the result.
+struct ExpressionProgram {
+	std::vector<ExpressionInstruction> code; ///< The instructions, in order.
+	std::vector<int> constantRegisters; ///< The registers that hold constants.
+	std::vector<float> constants; ///< The values of those constants.
+	int result; ///< The register with the result.
+	int numRegisters; ///< The number of registers used.
+
+	ExpressionProgram(void):result(0), numRegisters(0) {}
+};
+
+/// A user-defined Fresnel formula for one wavelength.
+class FresnelExpression {
+public:
+	/// Compile a formula.
+	/// @param name The name of the formula, for the CSV header and the JSON keys.
+	/// @param source The formula, see the start of this file.
+	/// @param error Receives a description of the first error, with its position in the source.
+	/// @return false if the formula has errors.
+	bool compile(const char *name, const char *source, std::string &error);
+
+	/// The name of the formula.
+	const char* getName(void) const { return name.c_str(); }
+
+	/// The number of parameters, at most maxModelParams.
+	int getNumParams(void) const { return int(params.size()); }
+
+	/// The name of a parameter.
+	const char* getParamName(int i) const { return params[i].name.c_str(); }
+
+	/// The range of a parameter.
+	float getMinParam(int i) const { return params[i].minValue; }
+	float getMaxParam(int i) const { return params[i].maxValue; }
+
+	/// The number of instructions of the compiled expression.
+	int getNumInstructions(void) const { return int(program.code.size()); }
+
+	/// Compute the starting values of the parameters for red/green/blue.
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param result Receives getNumParams() colors.
+	void getInitialParams(const Color &n, const Color &k, Color *result) const;
+
+	/// Evaluate the formula for many inputs.
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param c The cosines.
+	/// @param paramValues getNumParams() arrays with the values of the parameters.
+	/// @param count The number of inputs.
+	/// @param result Receives the values.
+	void evaluate(const float *n, const float *k, const float *c, const float *const *paramValues, int count, float *result) const;
+
+	/// Evaluate the formula for one wavelength at many cosines.
+	/// @param n The n value.
+	/// @param k The k value.
+	/// @param paramValues The values of the parameters.
+	/// @param c The cosines.
+	/// @param count The number of cosines.
+	/// @param result Receives the values.
+	void evaluateCurve(float n, float k, const float *paramValues, const float *c, int count, float *result) const;
+
+	/// Evaluate the formula for red/green/blue at many cosines.
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param paramValues getNumParams() colors with the values of the parameters.
+	/// @param c The cosines.
+	/// @param count The number of cosines.
+	/// @param result Receives the values.
+	void evaluateColors(const Color &n, const Color &k, const Color *paramValues, const float *c, int count, Color *result) const;
+
+private:
+	/// A declared parameter.
+	struct Param {
+		std::string name; ///< The name in the formula.
+		float minValue, maxValue; ///< The range.
+		ExpressionProgram initial; ///< The starting value, as an expression of n and k.
+	};
+
+	std::string name; ///< The name of the formula.
+	std::vector<Param> params; ///< The parameters, in order of declaration.
+	ExpressionProgram program; ///< The compiled expression.
+};
+
+/// Run a compiled expression for many inputs.
+/// @param program The expression.
+/// @param inputs The values of the input registers, see ExpressionInput.
+/// @param strides For each input, 1 if it has a value for each input and 0 if it has the same value for all.
+/// @param numInputs The number of input registers.
+/// @param count The number of inputs.
+/// @param result Receives the values.
+void runExpression(const ExpressionProgram &program, const float *const *inputs, const int *strides, int numInputs, int count, float *result);
+
+/// A formula for one wavelength as a model for fitModel(), see FresnelModel. The values and the
+/// derivatives by central differences are computed for all cosines at once with the interpreter.
+class ExpressionModel: public FresnelModel<ExpressionModel> {
+public:
+	ExpressionModel(const FresnelExpression &expression, float n, float k):expression(expression), n(n), k(k) {}
+
+	int getNumParams(void) const { return expression.getNumParams(); }
+	float getMinParam(int i) const { return expression.getMinParam(i); }
+	float getMaxParam(int i) const { return expression.getMaxParam(i); }
+
+	float evalValue(const float *params, float c) const {
+		float result;
+		expression.evaluateCurve(n, k, params, &c, 1, &result);
+		return result;
+	}
+
+	void evalSamples(const float *params, int numSamples, float *values, float (*gradients)[maxModelParams]) const;
+
+private:
+	const FresnelExpression &expression;
+	float n, k;
+};
+
+/// Fit the parameters of a formula to the complex Fresnel curve of one metal by least squares, starting
+/// from FresnelExpression::getInitialParams(), for each of the red, green and blue wavelengths.
+/// @param expression The formula.
+/// @param n The n values.
+/// @param k The k values.
+/// @param params Receives expression.getNumParams() colors.
+/// @param options With modelFit_closedForm, the starting values are kept.
+void fitExpression(const FresnelExpression &expression, const Color &n, const Color &k, Color *params, const FitOptions &options);
+
+/// Compute the average error of a formula against the complex Fresnel curve, the same way as
+/// computeCurveErrors().
+/// @param expression The formula.
+/// @param curves The built-in curves of the metal, f.e. from fitMetal().
+/// @param params The fitted parameters.
+/// @param options How to sample the curves.
+double computeExpressionError(const FresnelExpression &expression, const PresetCurves &curves, const Color *params, const FitOptions &options);
+
+#endif // METALNESS_EXPRESSION_H
@@ -0,0 +1,274 @@
+/// @file Implementation of the functions declared in metalness_ggx.h.
+
+#include <string.h>
+
+#include "metalness_ggx.h"
+#include "metalness_perf.h"
+#include "metalness_trace.h"
+
+/// The curves of CurveSample in the order of CurveModel.
+static Color CurveSample::* const curveModelMembers[curveModel_last]={
+	&CurveSample::vray, &CurveSample::ole, &CurveSample::f82, &CurveSample::schlick, &CurveSample::lazanyi
+};
+
+/// The smallest GGX alpha; smoother surfaces make the sampled normals numerically unstable.
+const float minGGXAlpha=1e-4f;
+
+/// A vector scaled to unit length.
+static simd::Vector3f normalize(const simd::Vector3f &v) {
+	return v*(1.0f/sqrtf(simd::dotf(v, v)));
+}
+
+/// The radical inverse of an index in base 2, the second coordinate of the Hammersley points.
+static float radicalInverse2(unsigned bits) {
+	bits=(bits<<16u) | (bits>>16u);
+	bits=((bits&0x55555555u)<<1u) | ((bits&0xAAAAAAAAu)>>1u);
+	bits=((bits&0x33333333u)<<2u) | ((bits&0xCCCCCCCCu)>>2u);
+	bits=((bits&0x0F0F0F0Fu)<<4u) | ((bits&0xF0F0F0F0u)>>4u);
+	bits=((bits&0x00FF00FFu)<<8u) | ((bits&0xFF00FF00u)>>8u);
+	return float(bits)*2.3283064365386963e-10f;
+}
+
+/// The Smith Lambda function of the GGX distribution for a direction with the cosine z to the normal.
+static float getGGXLambda(float z, float alpha) {
+	const float z2=z*z;
+	const float tan2=(1.0f-z2)/z2;
+	return 0.5f*(sqrtf(1.0f+alpha*alpha*tan2)-1.0f);
+}
+
+/// Sample a microfacet normal from the distribution of the normals that are visible from a direction.
+/// @param v The direction, in the frame of the surface normal (0, 0, 1).
+/// @param alpha The GGX alpha.
+/// @param u1 The first sample coordinate in [0, 1).
+/// @param u2 The second sample coordinate in [0, 1).
+/// @return The microfacet normal.
+static simd::Vector3f sampleGGXVisibleNormal(const simd::Vector3f &v, float alpha, float u1, float u2) {
+	// Stretch the view direction to the hemisphere configuration.
+	const simd::Vector3f vh=normalize(simd::Vector3f(alpha*v.x, alpha*v.y, v.z));
+
+	// An orthonormal basis around it.
+	const float lengthSqr=vh.x*vh.x+vh.y*vh.y;
+	const simd::Vector3f t1=(lengthSqr>0.0f)? simd::Vector3f(-vh.y, vh.x, 0.0f)*(1.0f/sqrtf(lengthSqr)) : simd::Vector3f(1.0f, 0.0f, 0.0f);
+	const simd::Vector3f t2(vh.y*t1.z-vh.z*t1.y, vh.z*t1.x-vh.x*t1.z, vh.x*t1.y-vh.y*t1.x);
+
+	// A point on the projected hemisphere.
+	const float r=sqrtf(u1);
+	const float phi=2.0f*3.14159265f*u2;
+	const float p1=r*cosf(phi);
+	const float s=0.5f*(1.0f+vh.z);
+	const float p2=(1.0f-s)*sqrtf(1.0f-p1*p1)+s*r*sinf(phi);
+
+	// Back to the ellipsoid configuration.
+	const float p3=sqrtf((1.0f-p1*p1-p2*p2>0.0f)? 1.0f-p1*p1-p2*p2 : 0.0f);
+	const simd::Vector3f nh=t1*p1+t2*p2+vh*p3;
+	return normalize(simd::Vector3f(alpha*nh.x, alpha*nh.y, (nh.z>0.0f)? nh.z : 0.0f));
+}
+
+/// Sample the reflection of a GGX microfacet surface at Hammersley points of the visible normals and call
+/// func(vDotH, weight) for each sample that reflects above the surface. The albedo with a Fresnel curve F is
+/// the average of F(vDotH)*weight over all numSamples samples, with weight=G2(v, l)/G1(v). The points are the
+/// same for all viewing directions and roughness values.
+/// @param mu The cosine between the viewing direction and the normal.
+/// @param roughness The roughness; alpha is its square.
+/// @param numSamples The number of samples.
+template<class Func>
+static void forEachGGXSample(float mu, float roughness, int numSamples, const Func &func) {
+	const float alpha=(roughness*roughness>minGGXAlpha)? roughness*roughness : minGGXAlpha;
+	const simd::Vector3f v(sqrtf(1.0f-mu*mu), 0.0f, mu);
+	const float lambdaV=getGGXLambda(mu, alpha);
+	for (int i=0; i<numSamples; i++) {
+		const simd::Vector3f h=sampleGGXVisibleNormal(v, alpha, (float(i)+0.5f)/float(numSamples), radicalInverse2(unsigned(i)));
+		const float vDotH=simd::dotf(v, h);
+		const float lz=2.0f*vDotH*h.z-v.z;
+		if (lz<=0.0f || vDotH<=0.0f)
+			continue;
+		func((vDotH<1.0f)? vDotH : 1.0f, (1.0+lambdaV)/(1.0+lambdaV+getGGXLambda(lz, alpha)));
+	}
+}
+
+void computeAlbedoTables(const PresetCurves &curves, const AlbedoTableOptions &options, AlbedoTables &tables, int numThreads) {
+	METALNESS_TRACE_SCOPE("computeAlbedoTables");
+
+	const int numCosines=(options.numCosines>0)? options.numCosines : 1;
+	const int numRoughness=(options.numRoughness>0)? options.numRoughness : 1;
+	const int numSamples=(options.numSamples>0)? options.numSamples : 1;
+	const int numEntries=numCosines*numRoughness;
+	tables.numCosines=numCosines;
+	tables.numRoughness=numRoughness;
+	tables.complex.assign(numEntries, Color(0.0f, 0.0f, 0.0f));
+	for (int m=0; m<curveModel_last; m++)
+		tables.models[m].assign(numEntries, Color(0.0f, 0.0f, 0.0f));
+
+	AlbedoTables *result=&tables;
+	parallelFor(numEntries, numThreads, [=, &curves](int entry) {
+		METALNESS_PERF_STAGE("curve evaluation");
+
+		double complexSum[3]={ 0.0, 0.0, 0.0 };
+		double modelSums[curveModel_last][3]={ { 0.0 } };
+		const float mu=getAlbedoTableCosine(entry%numCosines, numCosines);
+		const float roughness=getAlbedoTableRoughness(entry/numCosines, numRoughness);
+		forEachGGXSample(mu, roughness, numSamples, [&](float vDotH, double weight) {
+			const CurveSample sample=evalCurves(curves, vDotH);
+			for (int c=0; c<3; c++) {
+				complexSum[c]+=weight*sample.complex[c];
+				for (int m=0; m<curveModel_last; m++)
+					modelSums[m][c]+=weight*(sample.*curveModelMembers[m])[c];
+			}
+		});
+
+		for (int c=0; c<3; c++) {
+			result->complex[entry][c]=float(complexSum[c]/double(numSamples));
+			for (int m=0; m<curveModel_last; m++)
+				result->models[m][entry][c]=float(modelSums[m][c]/double(numSamples));
+		}
+	});
+}
+
+void getAlbedoErrors(const AlbedoTables &tables, double *errors) {
+	const size_t numEntries=tables.complex.size();
+	for (int m=0; m<curveModel_last; m++) {
+		double sum=0.0;
+		for (size_t i=0; i<numEntries; i++)
+			sum+=(tables.models[m][i]-tables.complex[i]).lengthSqr();
+		errors[m]=(numEntries>0)? sqrt(sum/double(numEntries)) : 0.0;
+	}
+}
+
+void computeEnergyCompensationTables(const AlbedoTableOptions &options, EnergyCompensationTables &tables, int numThreads) {
+	METALNESS_TRACE_SCOPE("computeEnergyCompensationTables");
+
+	const int numCosines=(options.numCosines>0)? options.numCosines : 1;
+	const int numRoughness=(options.numRoughness>0)? options.numRoughness : 1;
+	const int numSamples=(options.numSamples>0)? options.numSamples : 1;
+	tables.numCosines=numCosines;
+	tables.numRoughness=numRoughness;
+	tables.albedo.assign(numCosines*numRoughness, 0.0f);
+	tables.averageAlbedo.assign(numRoughness, 0.0f);
+
+	float *albedo=&tables.albedo[0];
+	parallelFor(numCosines*numRoughness, numThreads, [=](int entry) {
+		double sum=0.0;
+		forEachGGXSample(getAlbedoTableCosine(entry%numCosines, numCosines), getAlbedoTableRoughness(entry/numCosines, numRoughness), numSamples, [&sum](float, double weight) {
+			sum+=weight;
+		});
+		albedo[entry]=float(sum/double(numSamples));
+	});
+
+	// The midpoint rule over the cosines of the table.
+	for (int j=0; j<numRoughness; j++) {
+		double sum=0.0;
+		for (int i=0; i<numCosines; i++)
+			sum+=albedo[j*numCosines+i]*getAlbedoTableCosine(i, numCosines);
+		tables.averageAlbedo[j]=float(2.0*sum/double(numCosines));
+	}
+}
+
+void computeAverageFresnel(const PresetCurves *curves, int count, int numSamples, AverageFresnel *averages, int numThreads) {
+	METALNESS_TRACE_SCOPE("computeAverageFresnel");
+
+	if (numSamples<1)
+		numSamples=1;
+	parallelFor(count, numThreads, [=](int metal) {
+		METALNESS_PERF_STAGE("curve evaluation");
+
+		double complexSum[3]={ 0.0, 0.0, 0.0 };
+		double modelSums[curveModel_last][3]={ { 0.0 } };
+		for (int i=0; i<numSamples; i++) {
+			const float mu=(float(i)+0.5f)/float(numSamples);
+			const CurveSample sample=evalCurves(curves[metal], mu);
+			for (int c=0; c<3; c++) {
+				complexSum[c]+=mu*sample.complex[c];
+				for (int m=0; m<curveModel_last; m++)
+					modelSums[m][c]+=mu*(sample.*curveModelMembers[m])[c];
+			}
+		}
+
+		for (int c=0; c<3; c++) {
+			averages[metal].complex[c]=float(2.0*complexSum[c]/double(numSamples));
+			for (int m=0; m<curveModel_last; m++)
+				averages[metal].models[m][c]=float(2.0*modelSums[m][c]/double(numSamples));
+		}
+	});
+}
+
+/// Write a little-endian 32-bit unsigned integer to a file.
+static void writeLE32(FILE *fp, unsigned value) {
+	for (int i=0; i<4; i++)
+		fputc((value>>(i*8)) & 0xff, fp);
+}
+
+/// Write a float to a file as a little-endian IEEE float.
+static void writeLEFloat(FILE *fp, float value) {
+	unsigned bits;
+	memcpy(&bits, &value, sizeof(bits));
+	writeLE32(fp, bits);
+}
+
+/// Write a string padded with zeros to a fixed length; longer strings are cut, keeping one zero.
+static void writeFixedString(FILE *fp, const char *str, int length) {
+	int i=0;
+	for (; str[i] && i<length-1; i++)
+		fputc(str[i], fp);
+	for (; i<length; i++)
+		fputc(0, fp);
+}
+
+void writeEnergyCompensationLUT(FILE *fp, const EnergyCompensationTables &tables, const char *const *names, const AverageFresnel *averages, int count) {
+	METALNESS_TRACE_SCOPE("writeEnergyCompensationLUT");
+
+	fwrite("MSLT", 1, 4, fp);
+	writeLE32(fp, 1);
+	writeLE32(fp, unsigned(tables.numCosines));
+	writeLE32(fp, unsigned(tables.numRoughness));
+	writeLE32(fp, unsigned(count));
+	writeLE32(fp, 1+curveModel_last);
+
+	writeFixedString(fp, "complex", lutCurveNameLength);
+	for (int m=0; m<curveModel_last; m++)
+		writeFixedString(fp, getCurveModelName(CurveModel(m)), lutCurveNameLength);
+
+	for (size_t i=0; i<tables.albedo.size(); i++)
+		writeLEFloat(fp, tables.albedo[i]);
+	for (int j=0; j<tables.numRoughness; j++)
+		writeLEFloat(fp, tables.averageAlbedo[j]);
+
+	for (int i=0; i<count; i++) {
+		writeFixedString(fp, names[i], lutMetalNameLength);
+		for (int m=-1; m<curveModel_last; m++) {
+			const Color &averageFresnel=(m<0)? averages[i].complex : averages[i].models[m];
+			for (int c=0; c<3; c++)
+				writeLEFloat(fp, averageFresnel[c]);
+			for (int j=0; j<tables.numRoughness; j++) {
+				const Color color=getMultipleScatteringColor(averageFresnel, tables.averageAlbedo[j]);
+				for (int c=0; c<3; c++)
+					writeLEFloat(fp, color[c]);
+			}
+		}
+	}
+}
+
+void writeAlbedoTableHeader(FILE *fp, const char *separator) {
+	const char *s=separator;
+	fprintf(fp, "Name%sCurve%sCosine%sRoughness%sRed%sGreen%sBlue\n", s, s, s, s, s, s);
+}
+
+void writeAlbedoTables(FILE *fp, const char *name, const AlbedoTables &tables, const char *separator) {
+	METALNESS_TRACE_SCOPE("writeAlbedoTables");
+
+	const char *s=separator;
+	for (int m=-1; m<curveModel_last; m++) {
+		const std::vector<Color> &table=(m<0)? tables.complex : tables.models[m];
+		const char *curveName=(m<0)? "complex" : getCurveModelName(CurveModel(m));
+		for (int j=0; j<tables.numRoughness; j++) {
+			for (int i=0; i<tables.numCosines; i++) {
+				const Color &e=table[j*tables.numCosines+i];
+				fprintf(
+					fp, "%s%s%s%s%g%s%g%s%g%s%g%s%g\n",
+					name, s, curveName, s,
+					getAlbedoTableCosine(i, tables.numCosines), s, getAlbedoTableRoughness(j, tables.numRoughness), s,
+					e.r, s, e.g, s, e.b
+				);
+			}
+		}
+	}
+}
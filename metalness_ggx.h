@@ -0,0 +1,160 @@
+/// @file Directional albedo tables of rough metals: the fraction of the light from a viewing direction that a
+/// GGX microfacet surface reflects, E(mu, roughness), for the complex Fresnel curve and for each of the fitted
+/// models. The comparisons in the rest of the program are for a perfectly smooth surface, where the whole
+/// error of a model shows up; on a rough surface, each viewing direction sees a range of microfacet angles, so
+/// the errors of the models average out in part. The tables show how much of the error is left.
+///
+/// The integral over the microfacet normals is computed with quasi-Monte Carlo sampling of the distribution of
+/// visible normals (Eric Heitz, "Sampling the GGX Distribution of Visible Normals", JCGT 2018) with the
+/// height-correlated Smith masking-shadowing term. All models are evaluated for the same sampled directions,
+/// so their differences are not hidden by sampling noise.
+///
+/// The single scattering microfacet model loses the energy of the light that is reflected more than once
+/// between the microfacets, so rough metals become too dark. The file also computes the tables for the
+/// energy compensation of Christopher Kulla and Alejandro Conty ("Revisiting Physically Based Shading at
+/// Imageworks", SIGGRAPH 2017), which adds a multiple scattering lobe
+///
+/// f_ms(mu_o, mu_i)=(1-E(mu_o))*(1-E(mu_i))/(pi*(1-E_avg))*F_ms
+///
+/// where E is the albedo with a Fresnel reflectance of 1, E_avg its cosine-weighted average and F_ms the
+/// color of the lobe, which depends on the average F_avg of the Fresnel curve and so on the model; see
+/// getMultipleScatteringColor(). writeEnergyCompensationLUT() stores the tables of all metals and models in
+/// one binary file for a renderer.
+
+#ifndef METALNESS_GGX_H
+#define METALNESS_GGX_H
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "metalness_core.h"
+
+/// The sizes of the directional albedo tables.
+struct AlbedoTableOptions {
+	int numCosines; ///< The number of cosines mu between the viewing direction and the normal, at the cell centers of [0, 1].
+	int numRoughness; ///< The number of roughness values, at the cell centers of [0, 1]; the GGX alpha is the square of the roughness.
+	int numSamples; ///< The number of quasi-Monte Carlo samples of the microfacet normals for each table entry.
+
+	AlbedoTableOptions(void):numCosines(32), numRoughness(32), numSamples(512) {}
+};
+
+/// The directional albedo of one metal for red/green/blue, with the entry for cosine i and roughness j at
+/// index j*numCosines+i.
+struct AlbedoTables {
+	int numCosines; ///< The number of cosines.
+	int numRoughness; ///< The number of roughness values.
+	std::vector<Color> complex; ///< With the complex Fresnel curve.
+	std::vector<Color> models[curveModel_last]; ///< With the Fresnel curves of the models, see CurveModel.
+
+	AlbedoTables(void):numCosines(0), numRoughness(0) {}
+};
+
+/// The cosine of a column of the tables.
+inline float getAlbedoTableCosine(int i, int numCosines) {
+	return (float(i)+0.5f)/float(numCosines);
+}
+
+/// The roughness of a row of the tables.
+inline float getAlbedoTableRoughness(int j, int numRoughness) {
+	return (float(j)+0.5f)/float(numRoughness);
+}
+
+/// Compute the directional albedo of a GGX microfacet metal with the complex Fresnel curve and with each model.
+/// The table entries are computed in parallel.
+/// @param curves The fitted settings of the metal, f.e. from fitMetal().
+/// @param options The sizes of the tables.
+/// @param tables Receives the tables.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+void computeAlbedoTables(const PresetCurves &curves, const AlbedoTableOptions &options, AlbedoTables &tables, int numThreads);
+
+/// Compute the root mean square differences between the albedo of each model and the albedo with the complex
+/// Fresnel curve over all table entries; the rough surface counterparts of the errors of computeCurveErrors().
+/// @param tables The tables.
+/// @param errors Receives curveModel_last errors, see CurveModel.
+void getAlbedoErrors(const AlbedoTables &tables, double *errors);
+
+/// The tables for the energy compensation that do not depend on the metal, for the same cosines and roughness
+/// values as AlbedoTables.
+struct EnergyCompensationTables {
+	int numCosines; ///< The number of cosines.
+	int numRoughness; ///< The number of roughness values.
+	std::vector<float> albedo; ///< E(mu, roughness) with a Fresnel reflectance of 1, at index j*numCosines+i.
+	std::vector<float> averageAlbedo; ///< E_avg(roughness)=2*integral of E(mu)*mu over mu, for each roughness value.
+
+	EnergyCompensationTables(void):numCosines(0), numRoughness(0) {}
+};
+
+/// The cosine-weighted averages F_avg=2*integral of F(mu)*mu over mu of the Fresnel curves of one metal.
+struct AverageFresnel {
+	Color complex; ///< Of the complex Fresnel curve.
+	Color models[curveModel_last]; ///< Of the curves of the models, see CurveModel.
+};
+
+/// Compute the albedo of a GGX microfacet surface with a Fresnel reflectance of 1 and its averages over the
+/// viewing directions, with the same sampling as computeAlbedoTables(). The table entries are computed in
+/// parallel.
+/// @param options The sizes of the tables.
+/// @param tables Receives the tables.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+void computeEnergyCompensationTables(const AlbedoTableOptions &options, EnergyCompensationTables &tables, int numThreads);
+
+/// Compute the average Fresnel reflectance of several metals with the midpoint rule, which is the one
+/// dimensional Hammersley point set. The metals are computed in parallel.
+/// @param curves The fitted settings of the metals, f.e. from fitMetal().
+/// @param count The number of metals.
+/// @param numSamples The number of cosines.
+/// @param averages Receives count averages.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+void computeAverageFresnel(const PresetCurves *curves, int count, int numSamples, AverageFresnel *averages, int numThreads);
+
+/// The color of the multiple scattering lobe, F_avg^2*E_avg/(1-F_avg*(1-E_avg)): the light that leaves the
+/// surface after bouncing between the microfacets, as a fraction of the energy that the lobe carries with a
+/// Fresnel reflectance of 1.
+/// @param averageFresnel The average Fresnel reflectance F_avg.
+/// @param averageAlbedo The average albedo E_avg for the roughness.
+inline Color getMultipleScatteringColor(const Color &averageFresnel, float averageAlbedo) {
+	Color result;
+	for (int c=0; c<3; c++) {
+		const float f=averageFresnel[c];
+		result[c]=f*f*averageAlbedo/(1.0f-f*(1.0f-averageAlbedo));
+	}
+	return result;
+}
+
+/// The length of the names of the curves and the metals in the binary LUT files, including the terminating
+/// zeros that pad them.
+const int lutCurveNameLength=16;
+const int lutMetalNameLength=32;
+
+/// Write the energy compensation tables of several metals as a binary file. All values are little-endian
+/// 32-bit unsigned integers or IEEE floats:
+///
+/// - the characters "MSLT" and the version 1;
+/// - numCosines, numRoughness, the number of metals and the number of curves, 1+curveModel_last;
+/// - the names of the curves, complex and then the models in the order of CurveModel, lutCurveNameLength
+///   characters each;
+/// - E(mu, roughness) with the cosines varying fastest, then E_avg(roughness);
+/// - for each metal, its name in lutMetalNameLength characters and for each curve F_avg for red/green/blue
+///   followed by the color of the multiple scattering lobe for each roughness value for red/green/blue.
+///
+/// The cosines and roughness values are at the cell centers, see getAlbedoTableCosine() and
+/// getAlbedoTableRoughness(); longer names are cut.
+/// @param tables The tables of computeEnergyCompensationTables().
+/// @param names The names of the metals.
+/// @param averages The average Fresnel reflectance of the metals, see computeAverageFresnel().
+/// @param count The number of metals.
+void writeEnergyCompensationLUT(FILE *fp, const EnergyCompensationTables &tables, const char *const *names, const AverageFresnel *averages, int count);
+
+/// Write the header line of a CSV file with directional albedo tables.
+/// @param separator The separator between the columns.
+void writeAlbedoTableHeader(FILE *fp, const char *separator=", ");
+
+/// Write the tables of one metal as CSV lines: the name of the metal, the curve (complex or the name of the
+/// model), the cosine, the roughness and the albedo for red/green/blue.
+/// @param name The name of the metal.
+/// @param tables The tables.
+/// @param separator The separator between the columns.
+void writeAlbedoTables(FILE *fp, const char *name, const AlbedoTables &tables, const char *separator=", ");
+
+#endif // METALNESS_GGX_H
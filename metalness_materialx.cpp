@@ -0,0 +1,102 @@
+/// @file Implementation of the functions declared in metalness_materialx.h.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "metalness_materialx.h"
+#include "metalness_shadergen.h"
+
+bool findMaterialXModels(const char *name, int &models) {
+	if (strcmp(name, "standard")==0) models=materialXModels_standardSurface;
+	else if (strcmp(name, "openpbr")==0) models=materialXModels_openPBR;
+	else if (strcmp(name, "all")==0) models=materialXModels_all;
+	else return false;
+	return true;
+}
+
+/// Escape the characters that are not allowed in XML attribute values.
+static std::string escapeXML(const char *str) {
+	std::string result;
+	for (const char *c=str; c && *c; c++) {
+		switch (*c) {
+			case '&': result+="&amp;"; break;
+			case '<': result+="&lt;"; break;
+			case '>': result+="&gt;"; break;
+			case '"': result+="&quot;"; break;
+			default: result+=*c; break;
+		}
+	}
+	return result;
+}
+
+/// Write a color3 input of a MaterialX node.
+static void writeColorInput(FILE *fp, const char *name, const Color &c) {
+	fprintf(fp, "    <input name=\"%s\" type=\"color3\" value=\"%.6g, %.6g, %.6g\" />\n", name, c.r, c.g, c.b);
+}
+
+/// Write a float input of a MaterialX node.
+static void writeFloatInput(FILE *fp, const char *name, float value) {
+	fprintf(fp, "    <input name=\"%s\" type=\"float\" value=\"%g\" />\n", name, value);
+}
+
+/// Write a material node that uses a surface shader node.
+static void writeMaterial(FILE *fp, const std::string &materialName, const std::string &shaderName) {
+	fprintf(fp, "  <surfacematerial name=\"%s\" type=\"material\">\n", materialName.c_str());
+	fprintf(fp, "    <input name=\"surfaceshader\" type=\"surfaceshader\" nodename=\"%s\" />\n", shaderName.c_str());
+	fprintf(fp, "  </surfacematerial>\n");
+}
+
+void writeMaterialX(FILE *fp, const PresetResult *results, int count, int models, int numThreads) {
+	std::vector<const char*> names(count);
+	std::vector<Color> n(count), k(count), f0(count), tint(count);
+	for (int i=0; i<count; i++) {
+		names[i]=results[i].name;
+		n[i]=results[i].n;
+		k[i]=results[i].k;
+	}
+	if (count>0 && (models & materialXModels_openPBR))
+		fitF82TintBatch(&n[0], &k[0], &f0[0], &tint[0], size_t(count), numThreads);
+
+	std::vector<std::string> ids;
+	getMetalIdentifiers(count>0? &names[0] : NULL, count, ids);
+
+	// open_pbr_surface is part of the MaterialX 1.39 standard library.
+	fprintf(fp, "<?xml version=\"1.0\"?>\n");
+	fprintf(fp, "<materialx version=\"1.39\">\n");
+
+	for (int i=0; i<count; i++) {
+		char doc[256];
+		snprintf(doc, sizeof(doc), "n=(%g, %g, %g), k=(%g, %g, %g)", n[i].r, n[i].g, n[i].b, k[i].r, k[i].g, k[i].b);
+		const std::string docAttr=escapeXML(names[i])+": "+doc;
+
+		// Standard Surface computes its metallic Fresnel from the reflectivity and the edge tint of Ole
+		// Gulbrandsen's model, not from F82-tint.
+		if (models & materialXModels_standardSurface) {
+			const std::string shaderName="SR_"+ids[i];
+			fprintf(fp, "  <standard_surface name=\"%s\" type=\"surfaceshader\" doc=\"%s\">\n", shaderName.c_str(), docAttr.c_str());
+			writeFloatInput(fp, "base", 1.0f);
+			writeColorInput(fp, "base_color", results[i].base);
+			writeFloatInput(fp, "metalness", 1.0f);
+			writeFloatInput(fp, "specular", 1.0f);
+			writeColorInput(fp, "specular_color", results[i].edgeTint);
+			fprintf(fp, "  </standard_surface>\n");
+			writeMaterial(fp, "M_"+ids[i]+(models==materialXModels_standardSurface? "" : "_standard_surface"), shaderName);
+		}
+
+		if (models & materialXModels_openPBR) {
+			const std::string shaderName="OPBR_"+ids[i];
+			fprintf(fp, "  <open_pbr_surface name=\"%s\" type=\"surfaceshader\" doc=\"%s\">\n", shaderName.c_str(), docAttr.c_str());
+			writeFloatInput(fp, "base_weight", 1.0f);
+			writeColorInput(fp, "base_color", f0[i]);
+			writeFloatInput(fp, "base_metalness", 1.0f);
+			writeFloatInput(fp, "specular_weight", 1.0f);
+			writeColorInput(fp, "specular_color", tint[i]);
+			fprintf(fp, "  </open_pbr_surface>\n");
+			writeMaterial(fp, "M_"+ids[i]+(models==materialXModels_openPBR? "" : "_open_pbr_surface"), shaderName);
+		}
+	}
+
+	fprintf(fp, "</materialx>\n");
+}
@@ -0,0 +1,38 @@
+/// @file Export of metals as MaterialX documents for renderers that use the Autodesk Standard Surface or
+/// the OpenPBR Surface material instead of the VRayMtl. Standard Surface turns its base color and specular
+/// color into n and k with Ole Gulbrandsen's artistic IOR (the artistic_ior node of MaterialX), so it gets
+/// the fitted reflectivity and edge tint of that model. OpenPBR Surface uses the F82-tint metallic Fresnel
+/// (see f82TintFresnel() in metalness_core.h), so its base color and specular color are fitted to that
+/// model.
+
+#ifndef METALNESS_MATERIALX_H
+#define METALNESS_MATERIALX_H
+
+#include <stdio.h>
+
+#include "metalness_core.h"
+
+/// The materials to write for each metal, as flags that can be combined.
+enum MaterialXModels {
+	materialXModels_standardSurface=1, ///< Autodesk Standard Surface (standard_surface).
+	materialXModels_openPBR=2, ///< OpenPBR Surface (open_pbr_surface).
+
+	materialXModels_all=materialXModels_standardSurface | materialXModels_openPBR,
+};
+
+/// Find the MaterialX models with the given name: standard, openpbr or all.
+/// @param name The name.
+/// @param models Receives a combination of MaterialXModels flags.
+/// @return true if the name was recognized.
+bool findMaterialXModels(const char *name, int &models);
+
+/// Write a MaterialX document with a material for each metal and model. The F82-tint colors for OpenPBR
+/// Surface are fitted for all metals in one batch.
+/// @param fp The output file.
+/// @param results The fitted settings of the metals; Standard Surface uses the base color and the edge tint.
+/// @param count The number of metals.
+/// @param models A combination of MaterialXModels flags.
+/// @param numThreads The number of threads for the fitting; 0 means one thread per logical processor.
+void writeMaterialX(FILE *fp, const PresetResult *results, int count, int models, int numThreads);
+
+#endif // METALNESS_MATERIALX_H
@@ -0,0 +1,261 @@
+/// @file A registry of Fresnel models that are compared with the complex Fresnel curve besides the built-in
+/// ones. A model is a class derived from FresnelModel (see metalness_core.h) and is registered by listing it
+/// in a ModelSet, f.e. the ExtraModels type of metalness.cpp. Every registered model then gets a closed form
+/// and a least squares fit, batch evaluation, an error against the complex Fresnel curve, a curve in the
+/// graphs and a column in the CSV file. The models are called directly through templates, without virtual
+/// functions, so a registered model runs as fast as a built-in one.
+
+#ifndef METALNESS_MODELS_H
+#define METALNESS_MODELS_H
+
+#include "metalness_core.h"
+#include "metalness_trace.h"
+
+/// Evaluate a model for red/green/blue at many cosines. The model is set up once per wavelength.
+/// @param n The n values.
+/// @param k The k values.
+/// @param params Model::numParams colors with the parameters.
+/// @param x The cosines.
+/// @param count The number of cosines.
+/// @param result Receives the reflectance at each cosine.
+template<class Model>
+void evalModelBatch(const Color &n, const Color &k, const Color *params, const float *x, int count, Color *result) {
+	for (int c=0; c<3; c++) {
+		const Model model(n[c], k[c]);
+		float p[maxModelParams];
+		for (int i=0; i<Model::numParams; i++)
+			p[i]=params[i][c];
+		for (int i=0; i<count; i++)
+			result[i][c]=model.evalValue(p, x[i]);
+	}
+}
+
+/// Collect the viewing angles at which computeCurveErrors() compares the curves with adaptive sampling,
+/// and the complex Fresnel reflectance at them.
+/// @param curves The built-in curves of the metal.
+/// @param options The tolerance of the sampling.
+/// @param x Receives the cosines, in increasing order.
+/// @param complex Receives the complex Fresnel reflectance at the cosines.
+inline void getAdaptiveErrorSamples(const PresetCurves &curves, const FitOptions &options, std::vector<float> &x, std::vector<Color> &complex) {
+	x.clear();
+	complex.clear();
+	auto addSegment=[&x, &complex](const CurveSample &a, const CurveSample &b) {
+		if (x.empty()) {
+			x.push_back(a.x);
+			complex.push_back(a.complex);
+		}
+		x.push_back(b.x);
+		complex.push_back(b.complex);
+	};
+	forEachCurveSegment(curves, curveStartX, curveEndX, options.tolerance, 4, 14, addSegment);
+}
+
+/// Compute the average error of a curve against sampled values of the complex Fresnel curve with the
+/// trapezoid rule, the same way as getAverageErrorSqr().
+/// @param x The sampled cosines, in increasing order.
+/// @param complex The complex Fresnel reflectance at those cosines.
+/// @param values The values of the curve at those cosines.
+/// @param count The number of samples, at least 2.
+inline double getSampledError(const float *x, const Color *complex, const Color *values, int count) {
+	double sum=0.0;
+	double prevErrorSqr=(values[0]-complex[0]).lengthSqr();
+	for (int i=1; i<count; i++) {
+		const double errorSqr=(values[i]-complex[i]).lengthSqr();
+		sum+=(errorSqr+prevErrorSqr)*0.5*double(x[i]-x[i-1]);
+		prevErrorSqr=errorSqr;
+	}
+	return sqrt(sum/double(x[count-1]-x[0]));
+}
+
+/// An empty object that carries the type of a model to the generic lambdas of ModelList::forEach().
+template<class Model>
+struct ModelTag {
+	typedef Model Type;
+};
+
+/// A compile time list of models, with the total number of parameters and a loop over the models.
+template<class... Models>
+struct ModelList;
+
+template<>
+struct ModelList<> {
+	static const int numParams=0;
+
+	template<class Func>
+	static void forEach(const Func&, int=0, int=0) {}
+};
+
+template<class Model, class... Rest>
+struct ModelList<Model, Rest...> {
+	static const int numParams=Model::numParams+ModelList<Rest...>::numParams;
+
+	/// Call func(ModelTag<Model>(), index, paramOffset) for each model, in order, where paramOffset is the
+	/// index of the first parameter of the model in the parameters of all models.
+	template<class Func>
+	static void forEach(const Func &func, int index=0, int paramOffset=0) {
+		func(ModelTag<Model>(), index, paramOffset);
+		ModelList<Rest...>::forEach(func, index+1, paramOffset+Model::numParams);
+	}
+};
+
+/// A set of models, derived from FresnelModel, that are fitted and compared together.
+template<class... Models>
+class ModelSet {
+public:
+	static const int numModels=int(sizeof...(Models)); ///< The number of models.
+	static const int numParams=ModelList<Models...>::numParams; ///< The total number of parameters.
+
+	/// The fitted parameters of all models for one metal and their errors. The arrays have one extra
+	/// element so that they are not empty when no models are registered.
+	struct Fit {
+		Color params[numParams+1]; ///< The parameters of model j start at params[getParamOffset(j)].
+		double errors[numModels+1]; ///< The average errors against the complex Fresnel curve.
+	};
+
+	/// The short names of the models, for the command line and the JSON keys.
+	static const char *const* getNames(void) {
+		static const char *const names[]={ Models::getName()..., NULL };
+		return names;
+	}
+
+	/// The labels of the models, for the CSV header.
+	static const char *const* getLabels(void) {
+		static const char *const labels[]={ Models::getLabel()..., NULL };
+		return labels;
+	}
+
+	/// The index of the first parameter of a model in Fit::params.
+	static int getParamOffset(int model) {
+		int result=0;
+		ModelList<Models...>::forEach([model, &result](auto, int index, int paramOffset) {
+			if (index==model) result=paramOffset;
+		});
+		return result;
+	}
+
+	/// Fit all models to the complex Fresnel curve of a metal: with the closed forms of the models, refined
+	/// by least squares with modelFit_leastSquares.
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param options The fitting method and the number of viewing angles for least squares.
+	/// @param fit Receives the parameters.
+	static void fit(const Color &n, const Color &k, const FitOptions &options, Fit &fit) {
+		ModelList<Models...>::forEach([&n, &k, &options, &fit](auto tag, int, int paramOffset) {
+			typedef typename decltype(tag)::Type Model;
+			Model::getInitialParams(n, k, fit.params+paramOffset);
+			if (options.modelFit==modelFit_leastSquares)
+				fitModelMetal<Model>(n, k, fit.params+paramOffset, options.numIORSamples);
+		});
+	}
+
+	/// Evaluate one of the models for red/green/blue at many cosines, see evalModelBatch().
+	/// @param model The index of the model.
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param fit The parameters.
+	/// @param x The cosines.
+	/// @param count The number of cosines.
+	/// @param result Receives the reflectance at each cosine.
+	static void evalBatch(int model, const Color &n, const Color &k, const Fit &fit, const float *x, int count, Color *result) {
+		ModelList<Models...>::forEach([=, &n, &k, &fit](auto tag, int index, int paramOffset) {
+			typedef typename decltype(tag)::Type Model;
+			if (index==model)
+				evalModelBatch<Model>(n, k, fit.params+paramOffset, x, count, result);
+		});
+	}
+
+	/// Compute the average errors of the models against the complex Fresnel curve, the same way as
+	/// computeCurveErrors(). With adaptive sampling, the models are compared at the viewing angles where
+	/// the built-in curves are sampled.
+	/// @param curves The built-in curves of the metal, f.e. from fitMetal().
+	/// @param options How to sample the curves.
+	/// @param fit The parameters; receives the errors.
+	static void computeErrors(const PresetCurves &curves, const FitOptions &options, Fit &fit) {
+		METALNESS_TRACE_SCOPE("ModelSet::computeErrors");
+
+		if (options.errorSampling==curveSampling_uniform) {
+			const int numUniformSamples=(options.numUniformSamples>1)? options.numUniformSamples : 2;
+			double sums[numModels+1]={ 0.0 };
+			float x[errorMatrixBlockSize];
+			Color complex[errorMatrixBlockSize], modelCurve[errorMatrixBlockSize];
+			for (int start=1; start<numUniformSamples; start+=errorMatrixBlockSize) {
+				const int blockSize=(numUniformSamples-start<errorMatrixBlockSize)? numUniformSamples-start : errorMatrixBlockSize;
+				for (int i=0; i<blockSize; i++) {
+					x[i]=float(start+i)/float(numUniformSamples);
+					complex[i]=getComplexFresnel(curves.n, curves.k, x[i]);
+				}
+				for (int j=0; j<numModels; j++) {
+					evalBatch(j, curves.n, curves.k, fit, x, blockSize, modelCurve);
+					for (int i=0; i<blockSize; i++)
+						sums[j]+=(modelCurve[i]-complex[i]).lengthSqr();
+				}
+			}
+			for (int j=0; j<numModels; j++)
+				fit.errors[j]=sqrt(sums[j]/float(numUniformSamples));
+			return;
+		}
+
+		std::vector<float> x;
+		std::vector<Color> complex;
+		getAdaptiveErrorSamples(curves, options, x, complex);
+		computeErrors(curves.n, curves.k, &x[0], &complex[0], int(x.size()), fit);
+	}
+
+	/// Compute the average errors of the models against sampled values of the complex Fresnel curve with
+	/// the trapezoid rule, the same way as getAverageErrorSqr().
+	/// @param n The n values.
+	/// @param k The k values.
+	/// @param x The sampled cosines, in increasing order.
+	/// @param complex The complex Fresnel reflectance at those cosines.
+	/// @param count The number of samples, at least 2.
+	/// @param fit The parameters; receives the errors.
+	static void computeErrors(const Color &n, const Color &k, const float *x, const Color *complex, int count, Fit &fit) {
+		std::vector<Color> modelCurve(count);
+		for (int j=0; j<numModels; j++) {
+			evalBatch(j, n, k, fit, x, count, &modelCurve[0]);
+			fit.errors[j]=getSampledError(x, complex, &modelCurve[0], count);
+		}
+	}
+
+	/// Point the extra model fields of a result to the names, labels and errors of the models.
+	static void setResultErrors(const Fit &fit, PresetResult &result) {
+		result.numExtraModels=numModels;
+		result.extraModelNames=getNames();
+		result.extraModelLabels=getLabels();
+		result.extraErrors=fit.errors;
+	}
+};
+
+/// The generalized Schlick approximation of the MaterialX generalized_schlick_bsdf with a white color at
+/// grazing angles, f0+(1-f0)*(1-c)^p, with f0 and the exponent p as the parameters. It is not built in,
+/// but registered in metalness.cpp as an example of a model that only declares evalValue() and gets its
+/// derivatives from FresnelModel.
+struct GeneralizedSchlickModel: FresnelModel<GeneralizedSchlickModel> {
+	static const int numParams=2;
+
+	GeneralizedSchlickModel(float, float) {}
+
+	float evalValue(const float *params, float c) const {
+		return params[0]+(1.0f-params[0])*powf(1.0f-c, params[1]);
+	}
+
+	/// f0 is a reflectance; the exponent is 5 for Schlick's approximation.
+	static float getMinParam(int i) { return (i==0)? 0.0f : 1.0f; }
+	static float getMaxParam(int i) { return (i==0)? 1.0f : 20.0f; }
+
+	static const char* getName(void) { return "generalized_schlick"; }
+	static const char* getLabel(void) { return "Generalized Schlick"; }
+
+	/// Match the complex Fresnel curve along the normal and at f82Cosine.
+	static void getInitialParams(const Color &n, const Color &k, Color *params) {
+		const Color f0=getComplexFresnel(n, k, 1.0f);
+		const Color f82=getComplexFresnel(n, k, f82Cosine);
+		params[0]=f0;
+		for (int i=0; i<3; i++) {
+			const float t=(f0[i]<1.0f)? (f82[i]-f0[i])/(1.0f-f0[i]) : 0.0f;
+			params[1][i]=(t>0.0f && t<1.0f)? clamp(logf(t)/logf(1.0f-f82Cosine), getMinParam(1), getMaxParam(1)) : 5.0f;
+		}
+	}
+};
+
+#endif // METALNESS_MODELS_H
@@ -0,0 +1,290 @@
+/// @file Hardware performance counters for the hot stages of the fitting and drawing code, read with
+/// perf_event_open on Linux: cycles, instructions (and so IPC), cache and branch misses, and the CPU time,
+/// summed per stage together with the wall time.
+///
+/// The counters are compiled in only when METALNESS_PERF is defined on Linux; otherwise the macro below
+/// expands to nothing. When compiled in, a stage reads the counters at its start and at its end with a
+/// system call, so the stages are placed around work that takes at least tens of microseconds.
+///
+/// METALNESS_PERF_STAGE(name) Count the events of the calling thread in the rest of the enclosing block
+/// for the stage with the given name, which must be a string literal.
+///
+/// Counters that the processor, the virtual machine or the kernel settings do not allow are left out;
+/// if none can be opened, a warning is printed once and the stages only measure the wall time. Counting
+/// needs /proc/sys/kernel/perf_event_paranoid to be 2 or lower, which is the default on most systems.
+///
+/// Events that are specific to a processor model can be added with the METALNESS_PERF_RAW environment
+/// variable, as a comma separated list of name=code pairs with the raw event codes of the processor. For
+/// example, the utilization of the vector units on recent Intel processors can be counted with
+///
+/// METALNESS_PERF_RAW=fp_scalar=0x02c7,fp_128_packed=0x08c7,fp_256_packed=0x20c7
+///
+/// which are the single precision events of FP_ARITH_INST_RETIRED.
+
+#ifndef METALNESS_PERF_H
+#define METALNESS_PERF_H
+
+#if defined(METALNESS_PERF) && defined(__linux__)
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// The maximum number of counters in a group.
+const int maxPerfCounters=16;
+
+/// A counter to open.
+struct PerfCounterConfig {
+	std::string name; ///< The name in the report.
+	uint32_t type; ///< PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE or PERF_TYPE_RAW.
+	uint64_t config; ///< The event.
+};
+
+/// Get the counters to open: the generic hardware events, the CPU time, and the raw events from the
+/// METALNESS_PERF_RAW environment variable.
+inline std::vector<PerfCounterConfig> getPerfCounterConfigs(void) {
+	std::vector<PerfCounterConfig> configs;
+	const PerfCounterConfig generic[]={
+		{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ "cache_references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+		{ "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	};
+	configs.assign(generic, generic+sizeof(generic)/sizeof(generic[0]));
+
+	const char *raw=getenv("METALNESS_PERF_RAW");
+	std::string item;
+	for (const char *c=raw; c; c++) {
+		if (*c==',' || *c=='\0') {
+			const size_t equals=item.find('=');
+			if (equals!=std::string::npos && int(configs.size())<maxPerfCounters) {
+				PerfCounterConfig config;
+				config.name=item.substr(0, equals);
+				config.type=PERF_TYPE_RAW;
+				config.config=strtoull(item.c_str()+equals+1, NULL, 0);
+				configs.push_back(config);
+			} else if (!item.empty()) {
+				fprintf(stderr, "Ignoring the raw event %s in METALNESS_PERF_RAW\n", item.c_str());
+			}
+			item.clear();
+			if (*c=='\0')
+				break;
+		} else {
+			item+=*c;
+		}
+	}
+	return configs;
+}
+
+/// The counters of the events of one thread. The generic events and the raw events are opened as two
+/// groups, so that the counters in a group count the same instructions, and a group never needs more
+/// counters than the processor has.
+class PerfCounterGroup {
+public:
+	PerfCounterGroup(void) {
+		const std::vector<PerfCounterConfig> configs=getPerfCounterConfigs();
+		int firstError=0;
+		int leader=-1;
+		bool raw=false;
+		for (size_t i=0; i<configs.size(); i++) {
+			// The raw events start a new group.
+			if (configs[i].type==PERF_TYPE_RAW && !raw) {
+				raw=true;
+				leader=-1;
+			}
+
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size=sizeof(attr);
+			attr.type=configs[i].type;
+			attr.config=configs[i].config;
+			attr.exclude_kernel=1;
+			attr.exclude_hv=1;
+			attr.read_format=PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			const int fd=int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+			if (fd<0) {
+				if (!firstError)
+					firstError=errno;
+				continue;
+			}
+			if (leader<0) {
+				leader=fd;
+				leaders.push_back(fd);
+				groupSizes.push_back(0);
+			}
+			groupSizes.back()++;
+			fds.push_back(fd);
+			names.push_back(configs[i].name);
+		}
+
+		static std::once_flag warnOnce;
+		std::call_once(warnOnce, [this, firstError]() {
+			if (fds.empty()) {
+				fprintf(stderr, "Cannot open any performance counters (%s); only the wall time is measured. "
+					"Check /proc/sys/kernel/perf_event_paranoid.\n", strerror(firstError));
+			} else if (firstError) {
+				fprintf(stderr, "Some performance counters are not available (%s); counting", strerror(firstError));
+				for (size_t i=0; i<names.size(); i++)
+					fprintf(stderr, " %s", names[i].c_str());
+				fprintf(stderr, "\n");
+			}
+		});
+
+		for (size_t g=0; g<leaders.size(); g++) {
+			ioctl(leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	~PerfCounterGroup(void) {
+		for (size_t i=0; i<fds.size(); i++)
+			close(fds[i]);
+	}
+
+	/// Read the current values of the counters, scaled up for the time that the kernel did not count them
+	/// because other programs or groups used the processor counters.
+	/// @param values Receives the values, in the order of getNames().
+	/// @return false if the counters cannot be read.
+	bool read(double *values) const {
+		if (fds.empty())
+			return false;
+
+		int index=0;
+		for (size_t g=0; g<leaders.size(); g++) {
+			uint64_t buffer[3+maxPerfCounters];
+			const ssize_t size=::read(leaders[g], buffer, sizeof(buffer));
+			if (size<ssize_t(3*sizeof(uint64_t)) || buffer[0]!=uint64_t(groupSizes[g]))
+				return false;
+
+			const double scale=(buffer[2]>0)? double(buffer[1])/double(buffer[2]) : 0.0;
+			for (int i=0; i<groupSizes[g]; i++)
+				values[index++]=double(buffer[3+i])*scale;
+		}
+		return true;
+	}
+
+	/// The names of the opened counters.
+	const std::vector<std::string>& getNames(void) const {
+		return names;
+	}
+
+private:
+	std::vector<int> leaders; ///< The group leaders.
+	std::vector<int> groupSizes; ///< The number of counters in each group.
+	std::vector<int> fds; ///< The counters, in the order of the groups.
+	std::vector<std::string> names; ///< The names of the counters.
+};
+
+/// The counter group of the calling thread, opened on the first call from that thread.
+inline const PerfCounterGroup& getPerfCounterGroup(void) {
+	thread_local PerfCounterGroup group;
+	return group;
+}
+
+/// The sums of the counters of one stage over all threads.
+struct PerfStageStats {
+	long long calls; ///< The number of times the stage ran.
+	double wallSeconds; ///< The total wall time.
+	std::map<std::string, double> counters; ///< The totals of the counters, by name.
+
+	PerfStageStats(void):calls(0), wallSeconds(0.0) {}
+};
+
+/// The stage statistics of the whole program.
+struct PerfLog {
+	std::mutex mutex; ///< Guards the statistics.
+	std::map<std::string, PerfStageStats> stages; ///< The statistics, by stage name.
+};
+
+inline PerfLog& getPerfLog(void) {
+	static PerfLog log;
+	return log;
+}
+
+/// Counts the events between its construction and destruction; use METALNESS_PERF_STAGE.
+class PerfStage {
+public:
+	PerfStage(const char *name):name(name), group(getPerfCounterGroup()), numCounters(0) {
+		if (group.read(startValues))
+			numCounters=int(group.getNames().size());
+		start=std::chrono::steady_clock::now();
+	}
+
+	~PerfStage(void) {
+		const std::chrono::steady_clock::time_point end=std::chrono::steady_clock::now();
+		double endValues[maxPerfCounters];
+		const bool ok=(numCounters>0 && group.read(endValues));
+
+		PerfLog &log=getPerfLog();
+		std::lock_guard<std::mutex> lock(log.mutex);
+		PerfStageStats &stats=log.stages[name];
+		stats.calls++;
+		stats.wallSeconds+=double(std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count())*1e-9;
+		for (int i=0; ok && i<numCounters; i++)
+			stats.counters[group.getNames()[i]]+=endValues[i]-startValues[i];
+	}
+
+private:
+	const char *name;
+	const PerfCounterGroup &group;
+	int numCounters;
+	double startValues[maxPerfCounters];
+	std::chrono::steady_clock::time_point start;
+};
+
+/// Write the statistics of all stages as JSON, one stage per line, with the derived instructions per
+/// cycle and cache miss rate when their counters are available.
+/// @param fp The output file.
+inline void writePerfReport(FILE *fp) {
+	PerfLog &log=getPerfLog();
+	std::lock_guard<std::mutex> lock(log.mutex);
+
+	fprintf(fp, "{\"stages\": [\n");
+	for (std::map<std::string, PerfStageStats>::const_iterator it=log.stages.begin(); it!=log.stages.end(); ++it) {
+		const PerfStageStats &stats=it->second;
+		fprintf(fp, "{\"stage\": \"%s\", \"calls\": %lld, \"wall_ms\": %.6g", it->first.c_str(), stats.calls, stats.wallSeconds*1e3);
+		for (std::map<std::string, double>::const_iterator c=stats.counters.begin(); c!=stats.counters.end(); ++c)
+			fprintf(fp, ", \"%s\": %.0f", c->first.c_str(), c->second);
+
+		const std::map<std::string, double>::const_iterator cycles=stats.counters.find("cycles");
+		const std::map<std::string, double>::const_iterator instructions=stats.counters.find("instructions");
+		if (cycles!=stats.counters.end() && instructions!=stats.counters.end() && cycles->second>0.0)
+			fprintf(fp, ", \"ipc\": %.4g", instructions->second/cycles->second);
+
+		const std::map<std::string, double>::const_iterator references=stats.counters.find("cache_references");
+		const std::map<std::string, double>::const_iterator misses=stats.counters.find("cache_misses");
+		if (references!=stats.counters.end() && misses!=stats.counters.end() && references->second>0.0)
+			fprintf(fp, ", \"cache_miss_rate\": %.4g", misses->second/references->second);
+
+		std::map<std::string, PerfStageStats>::const_iterator next=it;
+		fprintf(fp, "}%s\n", (++next!=log.stages.end())? "," : "");
+	}
+	fprintf(fp, "]}\n");
+}
+
+#define METALNESS_PERF_CONCAT_IMPL(a, b) a##b
+#define METALNESS_PERF_CONCAT(a, b) METALNESS_PERF_CONCAT_IMPL(a, b)
+#define METALNESS_PERF_STAGE(name) PerfStage METALNESS_PERF_CONCAT(perfStage, __LINE__)(name)
+
+#else // METALNESS_PERF
+
+#define METALNESS_PERF_STAGE(name)
+
+#endif // METALNESS_PERF
+
+#endif // METALNESS_PERF_H
@@ -0,0 +1,91 @@
+/// @file Reference versions of the Fresnel curves in metalness_core.h, written as templates so that they can
+/// be evaluated in double, long double or, with GCC and Clang on most 64-bit platforms, __float128
+/// precision. They compute the same formulas as the float kernels, without the clamping of intermediate
+/// values that only guards against rounding, and are used by the benchmarks and the checks to measure the
+/// accuracy of the float kernels and of the fitting.
+
+#ifndef METALNESS_REFERENCE_H
+#define METALNESS_REFERENCE_H
+
+#include <math.h>
+
+inline double refSqrt(double x) { return sqrt(x); }
+inline long double refSqrt(long double x) { return sqrtl(x); }
+
+#if defined(__SIZEOF_FLOAT128__) && (defined(__GNUC__) || defined(__clang__))
+#define METALNESS_HAS_FLOAT128
+
+/// The square root in quadruple precision, without libquadmath: the long double square root refined with
+/// two Newton steps, each of which doubles the number of correct bits.
+inline __float128 refSqrt(__float128 x) {
+	if (x<=0)
+		return 0;
+	__float128 y=sqrtl((long double) x);
+	y=(y+x/y)*__float128(0.5);
+	y=(y+x/y)*__float128(0.5);
+	return y;
+}
+#endif
+
+/// Reference version of complexFresnel().
+template<class T>
+T refComplexFresnel(T n, T k, T c) {
+	const T nk2=n*n+k*k;
+	const T rs=(nk2-T(2)*n*c+c*c)/(nk2+T(2)*n*c+c*c);
+	const T rp=(nk2*c*c-T(2)*n*c+T(1))/(nk2*c*c+T(2)*n*c+T(1));
+	return T(0.5)*(rs+rp);
+}
+
+/// Reference version of getVRayFresnelCoeff(): the dielectric Fresnel coefficient for light coming from
+/// outside the surface.
+template<class T>
+T refVRayFresnelCoeff(T ior, T c) {
+	const T sinOut2=(T(1)-c*c)/(ior*ior);
+	if (sinOut2>=T(1))
+		return T(1);
+	const T cosOut=refSqrt(T(1)-sinOut2);
+	const T rs=(c-ior*cosOut)/(c+ior*cosOut);
+	const T rp=(ior*c-cosOut)/(ior*c+cosOut);
+	return T(0.5)*(rs*rs+rp*rp);
+}
+
+/// Reference version of the VRayMtl metallic Fresnel for one wavelength, see getVRayMetallicFresnel().
+template<class T>
+T refVRayMetallicFresnel(T base, T reflection, T ior, T c) {
+	const T f=refVRayFresnelCoeff(ior, c);
+	return base*(T(1)-f)+reflection*f;
+}
+
+/// Reference version of olefresnel().
+template<class T>
+T refOleFresnel(T r, T g, T c) {
+	if (r<T(0)) r=T(0);
+	if (r>T(0.99)) r=T(0.99);
+
+	const T sqrtR=refSqrt(r);
+	const T nMin=(T(1)-r)/(T(1)+r);
+	const T nMax=(T(1)+sqrtR)/(T(1)-sqrtR);
+	const T n=nMin*g+(T(1)-g)*nMax;
+	const T k2=((n+T(1))*(n+T(1))*r-(n-T(1))*(n-T(1)))/(T(1)-r);
+
+	const T nk2=n*n+k2;
+	const T rs=(nk2-T(2)*n*c+c*c)/(nk2+T(2)*n*c+c*c);
+	const T rp=(nk2*c*c-T(2)*n*c+T(1))/(nk2*c*c+T(2)*n*c+T(1));
+	return T(0.5)*(rs+rp);
+}
+
+/// Reference version of f82TintFresnel().
+template<class T>
+T refF82TintFresnel(T f0, T tint, T c) {
+	const T cBar=T(1)/T(7);
+	const T mBar=T(1)-cBar;
+	const T mBar6=mBar*mBar*mBar*mBar*mBar*mBar;
+	const T schlickBar=f0+(T(1)-f0)*mBar*mBar*mBar*mBar*mBar;
+	const T b=schlickBar*(T(1)-tint)/(cBar*mBar6);
+
+	const T m=T(1)-c;
+	const T m5=m*m*m*m*m;
+	return f0+(T(1)-f0)*m5-b*c*m5*m;
+}
+
+#endif // METALNESS_REFERENCE_H
@@ -0,0 +1,369 @@
+/// @file Implementation of the functions declared in metalness_report.h.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "metalness_report.h"
+#include "metalness_perf.h"
+#include "metalness_trace.h"
+#include "font5x7.h"
+
+/// Fill a rectangle in an image with a solid color. The rectangle must be inside the image.
+/// @param pixels The image pixels.
+/// @param width The width of the image.
+/// @param x0 The left edge of the rectangle (inclusive).
+/// @param y0 The top edge of the rectangle (inclusive).
+/// @param x1 The right edge of the rectangle (exclusive).
+/// @param y1 The bottom edge of the rectangle (exclusive).
+/// @param color The color to fill with.
+static void fillRect(RGB32 *pixels, int width, int x0, int y0, int x1, int y1, RGB32 color) {
+	for (int y=y0; y<y1; y++) {
+		RGB32 *row=pixels+y*width;
+		for (int x=x0; x<x1; x++)
+			row[x]=color;
+	}
+}
+
+/// Draw a text string with the embedded 5x7 font. Characters outside the font are drawn as '?'.
+/// The text is clipped to maxWidth pixels.
+/// @param pixels The image pixels.
+/// @param width The width of the image.
+/// @param x The left edge of the text.
+/// @param y The top edge of the text.
+/// @param maxWidth The maximum width of the text in pixels.
+/// @param text The text to draw.
+/// @param color The color of the text.
+/// @param scale Each font pixel is drawn as a scale x scale block.
+static void drawText(RGB32 *pixels, int width, int x, int y, int maxWidth, const char *text, RGB32 color, int scale) {
+	const int charWidth=(font5x7_width+1)*scale;
+	for (int i=0; text[i] && (i+1)*charWidth<=maxWidth+scale; i++) {
+		int ch=(unsigned char) text[i];
+		if (ch<font5x7_first || ch>font5x7_last)
+			ch='?';
+
+		const unsigned char *glyph=font5x7[ch-font5x7_first];
+		for (int gy=0; gy<font5x7_height; gy++) {
+			for (int gx=0; gx<font5x7_width; gx++) {
+				if (glyph[gy] & (0x10>>gx)) {
+					const int px=x+i*charWidth+gx*scale;
+					const int py=y+gy*scale;
+					fillRect(pixels, width, px, py, px+scale, py+scale, color);
+				}
+			}
+		}
+	}
+}
+
+const int swatchFontScale=2; ///< Size of a font pixel in the swatch table.
+const int swatchCharWidth=(font5x7_width+1)*swatchFontScale; ///< Width of one character cell.
+const int swatchRowHeight=(font5x7_height+5)*swatchFontScale; ///< Height of one table row.
+const int swatchPadding=6; ///< Space between the cell border and the cell contents.
+
+/// The columns of the swatch table.
+enum SwatchColumn {
+	swatchColumn_name=0,
+	swatchColumn_base,
+	swatchColumn_reflection,
+	swatchColumn_ior,
+	swatchColumn_vrayError,
+	swatchColumn_oleError,
+	swatchColumn_f82Error,
+	swatchColumn_schlickError,
+	swatchColumn_lazanyiError,
+
+	swatchColumn_last,
+};
+
+static const char *swatchColumnTitles[swatchColumn_last]={ "Name", "Base", "Reflection", "IOR", "V-Ray error", "Ole error", "F82 error", "Schlick error", "Lazanyi error" };
+static const int swatchColumnChars[swatchColumn_last]={ 14, 10, 10, 8, 11, 11, 11, 13, 13 }; ///< Column widths in characters.
+
+/// Compute the left edge of a swatch table column.
+static int getSwatchColumnX(int column) {
+	int x=0;
+	for (int i=0; i<column; i++)
+		x+=swatchColumnChars[i]*swatchCharWidth+2*swatchPadding;
+	return x;
+}
+
+void getSwatchTableSize(int count, int &width, int &height) {
+	width=getSwatchColumnX(swatchColumn_last);
+	height=(count+1)*swatchRowHeight;
+}
+
+void drawSwatchTableRow(RGB32 *pixels, int width, const PresetResult *results, int row) {
+	METALNESS_PERF_STAGE("rasterization");
+
+	const RGB32 headerColor=Color(0.8f, 0.8f, 0.8f).toRGB32();
+	const RGB32 evenColor=Color(1.0f, 1.0f, 1.0f).toRGB32();
+	const RGB32 oddColor=Color(0.94f, 0.94f, 0.94f).toRGB32();
+	const RGB32 lineColor=Color(0.6f, 0.6f, 0.6f).toRGB32();
+	const RGB32 textColor=Color(0.1f, 0.1f, 0.1f).toRGB32();
+
+	const int y0=row*swatchRowHeight;
+	const int y1=y0+swatchRowHeight;
+	const int textY=y0+(swatchRowHeight-font5x7_height*swatchFontScale)/2;
+
+	fillRect(pixels, width, 0, y0, width, y1-1, row==0? headerColor : ((row&1)? evenColor : oddColor));
+	fillRect(pixels, width, 0, y1-1, width, y1, lineColor);
+
+	for (int column=0; column<swatchColumn_last; column++) {
+		const int x0=getSwatchColumnX(column);
+		const int x1=getSwatchColumnX(column+1);
+		const int cellWidth=x1-x0-2*swatchPadding;
+		if (column>0)
+			fillRect(pixels, width, x0, y0, x0+1, y1, lineColor);
+
+		if (row==0) {
+			drawText(pixels, width, x0+swatchPadding, textY, cellWidth, swatchColumnTitles[column], textColor, swatchFontScale);
+			continue;
+		}
+
+		const PresetResult &result=results[row-1];
+		char text[64]="";
+		switch (column) {
+			case swatchColumn_name:
+				drawText(pixels, width, x0+swatchPadding, textY, cellWidth, result.name, textColor, swatchFontScale);
+				break;
+			case swatchColumn_base:
+			case swatchColumn_reflection: {
+				// Swatches are shown in sRGB display color space, like the color in the CSV file.
+				Color swatch=(column==swatchColumn_base)? result.base : result.reflection;
+				swatch.encodeToSRGB();
+				fillRect(pixels, width, x0+swatchPadding, y0+4, x1-swatchPadding, y1-5, lineColor);
+				fillRect(pixels, width, x0+swatchPadding+1, y0+5, x1-swatchPadding-1, y1-6, swatch.toRGB32());
+				break;
+			}
+			case swatchColumn_ior:
+				sprintf(text, "%g", result.ior);
+				break;
+			case swatchColumn_vrayError:
+				sprintf(text, "%g", result.vrayError);
+				break;
+			case swatchColumn_oleError:
+				sprintf(text, "%g", result.oleError);
+				break;
+			case swatchColumn_f82Error:
+				sprintf(text, "%g", result.f82Error);
+				break;
+			case swatchColumn_schlickError:
+				sprintf(text, "%g", result.schlickError);
+				break;
+			case swatchColumn_lazanyiError:
+				sprintf(text, "%g", result.lazanyiError);
+				break;
+		}
+		if (text[0])
+			drawText(pixels, width, x0+swatchPadding, textY, cellWidth, text, textColor, swatchFontScale);
+	}
+}
+
+void renderSwatchTable(RGB32 *pixels, int width, const PresetResult *results, int count, int numThreads) {
+	METALNESS_TRACE_SCOPE("renderSwatchTable");
+
+	parallelFor(count+1, numThreads, [=](int row) {
+		drawSwatchTableRow(pixels, width, results, row);
+	});
+}
+
+/// Write a little-endian integer with the given number of bytes to a file.
+static void writeLE(FILE *fp, unsigned int value, int numBytes) {
+	for (int i=0; i<numBytes; i++)
+		fputc((value>>(i*8)) & 0xff, fp);
+}
+
+bool writeBMP(FILE *fp, const RGB32 *pixels, int width, int height) {
+	METALNESS_TRACE_SCOPE("writeBMP");
+
+	const unsigned int headersSize=14+40;
+	const unsigned int imageSize=unsigned(width)*unsigned(height)*4;
+
+	// BITMAPFILEHEADER
+	fputc('B', fp);
+	fputc('M', fp);
+	writeLE(fp, headersSize+imageSize, 4);
+	writeLE(fp, 0, 4);
+	writeLE(fp, headersSize, 4);
+
+	// BITMAPINFOHEADER; a positive height means that the rows are stored bottom to top.
+	writeLE(fp, 40, 4);
+	writeLE(fp, unsigned(width), 4);
+	writeLE(fp, unsigned(height), 4);
+	writeLE(fp, 1, 2);
+	writeLE(fp, 32, 2);
+	writeLE(fp, 0, 4); // BI_RGB
+	writeLE(fp, imageSize, 4);
+	writeLE(fp, 2835, 4); // 72 DPI
+	writeLE(fp, 2835, 4);
+	writeLE(fp, 0, 4);
+	writeLE(fp, 0, 4);
+
+	std::vector<unsigned char> rowBytes(width*4);
+	for (int y=height-1; y>=0; y--) {
+		const RGB32 *row=pixels+y*width;
+		for (int x=0; x<width; x++) {
+			const unsigned int c=unsigned(row[x]);
+			rowBytes[x*4+0]=(unsigned char) (c & 0xff);
+			rowBytes[x*4+1]=(unsigned char) ((c>>8) & 0xff);
+			rowBytes[x*4+2]=(unsigned char) ((c>>16) & 0xff);
+			rowBytes[x*4+3]=0;
+		}
+		fwrite(&rowBytes[0], 1, rowBytes.size(), fp);
+	}
+
+	return ferror(fp)==0;
+}
+
+bool saveBMP(const char *fileName, const RGB32 *pixels, int width, int height) {
+	FILE *fp=fopen(fileName, "wb");
+	if (!fp)
+		return false;
+
+	const bool ok=writeBMP(fp, pixels, width, height);
+	return (fclose(fp)==0) && ok;
+}
+
+static const char *csvColumnTitles[numCSVColumns]={
+	"Name", "Diffuse red", "Diffuse green", "Diffuse blue", "Reflection red", "Reflection green", "Reflection blue",
+	"IOR", "Color (web sRGB)", "V-Ray error", "Ole error", "F82 error", "Schlick error", "Lazanyi error"
+};
+
+const char* getCSVColumnTitle(int column) {
+	return csvColumnTitles[column];
+}
+
+void writeCSVHeader(FILE *fp, const char *separator, const char *const *extraModelLabels, int numExtraModels) {
+	for (int i=0; i<numCSVColumns; i++)
+		fprintf(fp, "%s%s", i>0? separator : "", csvColumnTitles[i]);
+	for (int i=0; i<numExtraModels; i++)
+		fprintf(fp, "%s%s error", separator, extraModelLabels[i]);
+	fprintf(fp, "\n");
+}
+
+/// Write a number for a CSV or TSV line; NaN is written as nan whatever its sign bit, so that the same
+/// failure always gives the same text.
+static void writeCSVNumber(FILE *fp, double value) {
+	if (value!=value) fprintf(fp, "nan");
+	else fprintf(fp, "%g", value);
+}
+
+void writeCSVLine(FILE *fp, const PresetResult &result, const char *separator) {
+	METALNESS_TRACE_SCOPE("writeCSVLine");
+
+	const Color &base=result.base;
+	const Color &reflection=result.reflection;
+
+	// Compute the base color in sRGB display color space so that colors can be picked from
+	// the web page, f.e. with the 3ds Max color picker tool, which will do the inverse sRGB conversion
+	// automatically.
+	Color base_sRGB=base;
+	base_sRGB.encodeToSRGB();
+
+	const char *s=separator;
+	fprintf(
+		fp,
+		"%s%s%g%s%g%s%g%s%g%s%g%s%g%s",
+		result.name, s,
+		floorf(base.r*255.0f), s, floorf(base.g*255.0f), s, floorf(base.b*255.0f), s,
+		floorf(reflection.r*255.0f), s, floorf(reflection.g*255.0f), s, floorf(reflection.b*255.0f), s
+	);
+	writeCSVNumber(fp, result.ior);
+	fprintf(fp, "%s%x", s, int(base_sRGB.toRGB32()));
+	const double errors[]={ result.vrayError, result.oleError, result.f82Error, result.schlickError, result.lazanyiError };
+	for (int i=0; i<int(sizeof(errors)/sizeof(errors[0])); i++) {
+		fprintf(fp, "%s", s);
+		writeCSVNumber(fp, errors[i]);
+	}
+	for (int i=0; i<result.numExtraModels; i++) {
+		fprintf(fp, "%s", s);
+		writeCSVNumber(fp, result.extraErrors[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+bool saveSwatchTable(const char *fileName, const PresetResult *results, int count) {
+	int tableWidth=0, tableHeight=0;
+	getSwatchTableSize(count, tableWidth, tableHeight);
+
+	RGB32 *table=new RGB32[tableWidth*tableHeight];
+	renderSwatchTable(table, tableWidth, results, count, 0);
+	const bool ok=saveBMP(fileName, table, tableWidth, tableHeight);
+	delete[] table;
+	return ok;
+}
+
+void writeErrorMatrix(FILE *fp, const char *const *names, int count, const CurveModel *models, int numModels, const double *errors, const char *separator) {
+	fprintf(fp, "Model");
+	for (int i=0; i<count; i++)
+		fprintf(fp, "%s%s", separator, names[i]);
+	fprintf(fp, "\n");
+
+	for (int m=0; m<numModels; m++) {
+		fprintf(fp, "%s", getCurveModelName(models[m]));
+		for (int i=0; i<count; i++)
+			fprintf(fp, "%s%g", separator, errors[m*count+i]);
+		fprintf(fp, "\n");
+	}
+}
+
+void writeJSONString(FILE *fp, const char *str) {
+	fputc('"', fp);
+	for (const char *c=str; *c; c++) {
+		const unsigned char ch=(unsigned char) *c;
+		if (ch=='"' || ch=='\\') fprintf(fp, "\\%c", ch);
+		else if (ch<0x20) fprintf(fp, "\\u%04x", ch);
+		else fputc(ch, fp);
+	}
+	fputc('"', fp);
+}
+
+/// Write a number as JSON; NaN and infinity, which JSON cannot represent, are written as null.
+static void writeJSONNumber(FILE *fp, double value) {
+	if (isfinite(value)) fprintf(fp, "%.9g", value);
+	else fprintf(fp, "null");
+}
+
+/// Write the red, green and blue values of a color as a JSON array.
+static void writeJSONColor(FILE *fp, const Color &c) {
+	for (int i=0; i<3; i++) {
+		fprintf(fp, (i==0)? "[" : ", ");
+		writeJSONNumber(fp, c[i]);
+	}
+	fprintf(fp, "]");
+}
+
+void writeJSONLine(FILE *fp, const PresetResult &result) {
+	METALNESS_TRACE_SCOPE("writeJSONLine");
+
+	Color base_sRGB=result.base;
+	base_sRGB.encodeToSRGB();
+
+	fprintf(fp, "{\"name\": ");
+	writeJSONString(fp, result.name);
+	fprintf(fp, ", \"n\": ");
+	writeJSONColor(fp, result.n);
+	fprintf(fp, ", \"k\": ");
+	writeJSONColor(fp, result.k);
+	fprintf(fp, ", \"base\": ");
+	writeJSONColor(fp, result.base);
+	fprintf(fp, ", \"reflection\": ");
+	writeJSONColor(fp, result.reflection);
+	fprintf(fp, ", \"ior\": ");
+	writeJSONNumber(fp, result.ior);
+	fprintf(fp, ", \"color_srgb\": \"%06x\"", int(base_sRGB.toRGB32()));
+	const char *const errorNames[]={ "vray", "ole", "f82", "schlick", "lazanyi" };
+	const double errors[]={ result.vrayError, result.oleError, result.f82Error, result.schlickError, result.lazanyiError };
+	for (int i=0; i<int(sizeof(errors)/sizeof(errors[0])); i++) {
+		fprintf(fp, ", \"%s_error\": ", errorNames[i]);
+		writeJSONNumber(fp, errors[i]);
+	}
+	for (int i=0; i<result.numExtraModels; i++) {
+		fprintf(fp, ", ");
+		writeJSONString(fp, (std::string(result.extraModelNames[i])+"_error").c_str());
+		fprintf(fp, ": ");
+		writeJSONNumber(fp, result.extraErrors[i]);
+	}
+	fprintf(fp, "}\n");
+}
@@ -0,0 +1,91 @@
+/// @file Output of fitted metals as reports: CSV and JSON lines, and a swatch table image similar to the
+/// spreadsheet in example_output/metalness_spreadsheet.png, saved as a BMP file. These are used by the
+/// program in metalness.cpp and by the benchmarks.
+
+#ifndef METALNESS_REPORT_H
+#define METALNESS_REPORT_H
+
+#include <stdio.h>
+
+#include "metalness_core.h"
+
+/// Compute the size of the swatch table image for the given number of entries.
+/// @param count The number of table entries (without the header row).
+/// @param width The width of the image in pixels.
+/// @param height The height of the image in pixels.
+void getSwatchTableSize(int count, int &width, int &height);
+
+/// Draw one row of the swatch table. Only the pixels of the row are touched, so different
+/// rows can be drawn concurrently into the same image.
+/// @param pixels The table image, with a size returned by getSwatchTableSize().
+/// @param width The width of the table image.
+/// @param results The table entries.
+/// @param row The row to draw; row 0 is the header, row i+1 is for results[i].
+void drawSwatchTableRow(RGB32 *pixels, int width, const PresetResult *results, int row);
+
+/// Draw a table with the name, base and reflection color swatches, IOR and errors for each result.
+/// The rows are drawn in parallel.
+/// @param pixels The table image, with a size returned by getSwatchTableSize().
+/// @param width The width of the table image.
+/// @param results The table entries.
+/// @param count The number of table entries.
+/// @param numThreads The number of threads to use; 0 means one thread per logical processor.
+void renderSwatchTable(RGB32 *pixels, int width, const PresetResult *results, int count, int numThreads);
+
+/// Write an image as an uncompressed 32-bit BMP file to an open file.
+/// @param fp The output file, opened in binary mode.
+/// @param pixels The image pixels, top row first.
+/// @param width The width of the image.
+/// @param height The height of the image.
+/// @return true if the image was written successfully and false otherwise.
+bool writeBMP(FILE *fp, const RGB32 *pixels, int width, int height);
+
+/// Save an image as an uncompressed 32-bit BMP file.
+/// @param fileName The output file name.
+/// @param pixels The image pixels, top row first.
+/// @param width The width of the image.
+/// @param height The height of the image.
+/// @return true if the file was written successfully and false otherwise.
+bool saveBMP(const char *fileName, const RGB32 *pixels, int width, int height);
+
+/// Draw the swatch table with the results and save it as a BMP file.
+/// @return true if the file was written successfully and false otherwise.
+bool saveSwatchTable(const char *fileName, const PresetResult *results, int count);
+
+/// The number of columns in the CSV file with the results.
+const int numCSVColumns=14;
+
+/// Get the title of a column of the CSV file with the results.
+/// @param column The column, from 0 (the name of the metal) to numCSVColumns-1.
+const char* getCSVColumnTitle(int column);
+
+/// Write the header line of the CSV file with the results.
+/// @param separator The separator between the columns.
+/// @param extraModelLabels The labels of the models of a ModelSet, which get an error column each after
+/// the numCSVColumns columns; see PresetResult::extraErrors.
+/// @param numExtraModels The number of those models.
+void writeCSVHeader(FILE *fp, const char *separator=", ", const char *const *extraModelLabels=NULL, int numExtraModels=0);
+
+/// Write the results for one metal as a line in the CSV file, with the errors of the models of a ModelSet
+/// in the last columns. An IOR or error that could not be computed is written as nan, where the JSON lines
+/// have null.
+/// @param separator The separator between the columns.
+void writeCSVLine(FILE *fp, const PresetResult &result, const char *separator=", ");
+
+/// Write the errors of several models for several metals as a CSV file with one line per model and one
+/// column per metal.
+/// @param names The names of the metals.
+/// @param count The number of metals.
+/// @param models The models.
+/// @param numModels The number of models.
+/// @param errors The errors, see computeErrorMatrix().
+/// @param separator The separator between the columns.
+void writeErrorMatrix(FILE *fp, const char *const *names, int count, const CurveModel *models, int numModels, const double *errors, const char *separator=", ");
+
+/// Write a string as a JSON string literal.
+void writeJSONString(FILE *fp, const char *str);
+
+/// Write the results for one metal as a JSON object on a single line, with full precision values.
+void writeJSONLine(FILE *fp, const PresetResult &result);
+
+#endif // METALNESS_REPORT_H
@@ -0,0 +1,319 @@
+/// @file Implementation of the functions declared in metalness_shadergen.h.
+
+#include <ctype.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "metalness_shadergen.h"
+
+/// The constants that the generated code uses for one metal. All curves are written in terms of values
+/// that do not depend on the viewing angle, so that the shaders do as little work as possible.
+struct ShaderMetalConstants {
+	Color complexA; ///< n*n+k*k for the complex Fresnel curve.
+	Color complexB; ///< 2*n for the complex Fresnel curve.
+	Color oleA; ///< n*n+k*k for the n and k values that Ole's Fresnel derives from the base color and the edge tint.
+	Color oleB; ///< 2*n for the n value that Ole's Fresnel derives from the base color and the edge tint.
+	Color vrayBase; ///< The base color of the VRayMtl metallic Fresnel.
+	Color vrayTint; ///< The reflection color minus the base color.
+	float vrayIor; ///< The IOR of the VRayMtl metallic Fresnel.
+	float vrayInvIor2; ///< 1/(IOR*IOR).
+};
+
+/// Derive the constants for the generated code from the fitted settings of a metal.
+static ShaderMetalConstants getShaderMetalConstants(const PresetResult &result) {
+	ShaderMetalConstants constants;
+	const Color &edgeTint=result.edgeTint;
+	for (int i=0; i<3; i++) {
+		const float n=result.n[i];
+		const float k=result.k[i];
+		constants.complexA[i]=n*n+k*k;
+		constants.complexB[i]=2.0f*n;
+
+		// The same derivation as in olefresnel().
+		const float r=clamp(result.base[i], 0.0f, 0.99f);
+		const float oleN=get_n(r, edgeTint[i]);
+		const float oleK2=get_k2(r, oleN);
+		constants.oleA[i]=oleN*oleN+oleK2;
+		constants.oleB[i]=2.0f*oleN;
+	}
+	constants.vrayBase=result.base;
+	constants.vrayTint=result.reflection-result.base;
+	constants.vrayIor=result.ior;
+	constants.vrayInvIor2=1.0f/(result.ior*result.ior);
+	return constants;
+}
+
+/// The parts of the syntax that differ between the shader languages.
+struct ShaderSyntax {
+	const char *name; ///< The name of the language.
+	const char *colorType; ///< The type for RGB values.
+	const char *functionPrefix; ///< Written before each function.
+	const char *constantPrefix; ///< Written before global constants.
+	const char *prelude; ///< Type definitions and helper functions.
+	bool hasTables; ///< True if the language supports global constant arrays.
+};
+
+static const ShaderSyntax shaderSyntaxes[shaderLanguage_last]={
+	{
+		"C++", "MetalnessColor", "inline ", "static const ",
+		"#include <math.h>\n"
+		"\n"
+		"struct MetalnessColor {\n"
+		"\tfloat r, g, b;\n"
+		"\tMetalnessColor(float r, float g, float b):r(r), g(g), b(b) {}\n"
+		"};\n"
+		"\n"
+		"inline MetalnessColor operator+(const MetalnessColor &a, const MetalnessColor &b) { return MetalnessColor(a.r+b.r, a.g+b.g, a.b+b.b); }\n"
+		"inline MetalnessColor operator-(const MetalnessColor &a, const MetalnessColor &b) { return MetalnessColor(a.r-b.r, a.g-b.g, a.b-b.b); }\n"
+		"inline MetalnessColor operator/(const MetalnessColor &a, const MetalnessColor &b) { return MetalnessColor(a.r/b.r, a.g/b.g, a.b/b.b); }\n"
+		"inline MetalnessColor operator+(const MetalnessColor &a, float f) { return MetalnessColor(a.r+f, a.g+f, a.b+f); }\n"
+		"inline MetalnessColor operator*(const MetalnessColor &a, float f) { return MetalnessColor(a.r*f, a.g*f, a.b*f); }\n"
+		"inline MetalnessColor operator*(float f, const MetalnessColor &a) { return a*f; }\n"
+		"\n"
+		"inline float metalness_saturate(float x) { return x<0.0f? 0.0f : (x>1.0f? 1.0f : x); }\n"
+		"inline MetalnessColor metalness_saturate(const MetalnessColor &c) { return MetalnessColor(metalness_saturate(c.r), metalness_saturate(c.g), metalness_saturate(c.b)); }\n",
+		true
+	},
+	{
+		"GLSL", "vec3", "", "const ",
+		"float metalness_saturate(float x) { return clamp(x, 0.0, 1.0); }\n"
+		"vec3 metalness_saturate(vec3 x) { return clamp(x, 0.0, 1.0); }\n",
+		true
+	},
+	{
+		"HLSL", "float3", "", "static const ",
+		"float metalness_saturate(float x) { return saturate(x); }\n"
+		"float3 metalness_saturate(float3 x) { return saturate(x); }\n",
+		true
+	},
+	{
+		"OSL", "color", "", "",
+		"float metalness_saturate(float x) { return clamp(x, 0.0, 1.0); }\n"
+		"color metalness_saturate(color x) { return clamp(x, color(0.0), color(1.0)); }\n",
+		false
+	},
+};
+
+bool findShaderLanguage(const char *name, ShaderLanguage &language) {
+	static const struct {
+		const char *name;
+		ShaderLanguage language;
+	} names[]={
+		{ "cpp", shaderLanguage_cpp }, { "h", shaderLanguage_cpp }, { "hpp", shaderLanguage_cpp },
+		{ "glsl", shaderLanguage_glsl },
+		{ "hlsl", shaderLanguage_hlsl },
+		{ "osl", shaderLanguage_osl },
+	};
+
+	// Use the extension for file names.
+	const char *dot=strrchr(name, '.');
+	const char *key=dot? dot+1 : name;
+
+	for (size_t i=0; i<sizeof(names)/sizeof(names[0]); i++) {
+		if (strcmp(key, names[i].name)==0) {
+			language=names[i].language;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Format a float so that it reads back to the same value and is a floating point literal in all
+/// shader languages.
+static std::string formatFloat(float f) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.9g", f);
+	if (!strpbrk(buf, ".en"))
+		strcat(buf, ".0");
+	return buf;
+}
+
+/// Format a color as a constructor call in the given language.
+static std::string formatColor(const ShaderSyntax &syntax, const Color &c) {
+	return std::string(syntax.colorType)+"("+formatFloat(c.r)+", "+formatFloat(c.g)+", "+formatFloat(c.b)+")";
+}
+
+void getMetalIdentifiers(const char * const *names, int count, std::vector<std::string> &identifiers) {
+	identifiers.resize(count);
+	for (int i=0; i<count; i++) {
+		std::string id;
+		for (const char *c=names[i]; c && *c; c++) {
+			if (isalnum((unsigned char) *c))
+				id+=char(tolower((unsigned char) *c));
+			else if (!id.empty() && id[id.size()-1]!='_')
+				id+='_';
+		}
+		while (!id.empty() && id[id.size()-1]=='_')
+			id.erase(id.size()-1);
+		if (id.empty() || isdigit((unsigned char) id[0]))
+			id="metal_"+id;
+
+		// Make duplicate names unique.
+		std::string unique=id;
+		for (int suffix=2; ; suffix++) {
+			bool found=false;
+			for (int j=0; j<i && !found; j++)
+				found=(identifiers[j]==unique);
+			if (!found)
+				break;
+			unique=id+"_"+std::to_string(suffix);
+		}
+		identifiers[i]=unique;
+	}
+}
+
+/// Return the upper case version of an identifier, for the index macros.
+static std::string getMacroName(const std::string &id) {
+	std::string macro=id;
+	for (size_t i=0; i<macro.size(); i++)
+		macro[i]=char(toupper((unsigned char) macro[i]));
+	return macro;
+}
+
+/// Write the language-independent curve functions. Only the type names and the function prefix differ
+/// between the languages.
+static void writeCurveFunctions(FILE *fp, const ShaderSyntax &syntax) {
+	const char *c3=syntax.colorType;
+	const char *fn=syntax.functionPrefix;
+
+	fprintf(fp,
+		"// The Fresnel reflectance of a conductor, with a=n*n+k*k and b=2*n, see complexFresnel() in metalness_core.h.\n"
+		"%s%s metalness_conductorFresnel(%s a, %s b, float c) {\n"
+		"\tfloat c2=c*c;\n"
+		"\t%s rs=(a-b*c+c2)/(a+b*c+c2);\n"
+		"\t%s rp=(a*c2-b*c+1.0)/(a*c2+b*c+1.0);\n"
+		"\treturn metalness_saturate(0.5*(rs+rp));\n"
+		"}\n"
+		"\n",
+		fn, c3, c3, c3, c3, c3
+	);
+
+	fprintf(fp,
+		"// The VRayMtl metallic Fresnel: a blend from the base color to the reflection color with the\n"
+		"// dielectric Fresnel coefficient for the IOR, see getVRayMetallicFresnel() in metalness_core.h.\n"
+		"%s%s metalness_vrayFresnel(%s base, %s tint, float ior, float invIor2, float c) {\n"
+		"\tfloat sinOut2=invIor2*(1.0-c*c);\n"
+		"\tfloat f=1.0;\n"
+		"\tif (sinOut2<1.0) {\n"
+		"\t\tfloat cosOut=sqrt(1.0-sinOut2);\n"
+		"\t\tfloat rs=(c-ior*cosOut)/(c+ior*cosOut);\n"
+		"\t\tfloat rp=(ior*c-cosOut)/(ior*c+cosOut);\n"
+		"\t\tf=metalness_saturate(0.5*(rs*rs+rp*rp));\n"
+		"\t}\n"
+		"\treturn base+tint*f;\n"
+		"}\n"
+		"\n",
+		fn, c3, c3, c3
+	);
+}
+
+void writeShaderCode(FILE *fp, ShaderLanguage language, const PresetResult *results, int count) {
+	const ShaderSyntax &syntax=shaderSyntaxes[language];
+	const char *c3=syntax.colorType;
+	const char *fn=syntax.functionPrefix;
+
+	std::vector<const char*> names(count);
+	for (int i=0; i<count; i++)
+		names[i]=results[i].name;
+	std::vector<std::string> ids;
+	getMetalIdentifiers(count>0? &names[0] : NULL, count, ids);
+
+	std::vector<ShaderMetalConstants> constants(count);
+	for (int i=0; i<count; i++)
+		constants[i]=getShaderMetalConstants(results[i]);
+
+	fprintf(fp,
+		"// %s code generated by the metalness program with the fitted settings of %d metals.\n"
+		"// metalness_complex(), metalness_vray() and metalness_ole() evaluate the complex Fresnel curve of a\n"
+		"// metal, the VRayMtl metallic Fresnel with the fitted base color, reflection color and IOR, and Ole\n"
+		"// Gulbrandsen's metallic Fresnel with the fitted edge tint (formula 15 of his paper, or least squares).\n"
+		"// The metal is given as an index macro, f.e. METALNESS_%s; each metal also has the same functions with\n"
+		"// its constants folded in.\n"
+		"\n",
+		syntax.name, count, count>0? getMacroName(ids[0]).c_str() : "NAME"
+	);
+
+	if (language==shaderLanguage_cpp)
+		fprintf(fp, "#ifndef METALNESS_SHADER_METALS_H\n#define METALNESS_SHADER_METALS_H\n\n");
+
+	fprintf(fp, "%s\n", syntax.prelude);
+	writeCurveFunctions(fp, syntax);
+
+	// Index macros.
+	for (int i=0; i<count; i++)
+		fprintf(fp, "#define METALNESS_%s %d\n", getMacroName(ids[i]).c_str(), i);
+	fprintf(fp, "#define METALNESS_METAL_COUNT %d\n\n", count);
+
+	// Functions for each metal with the constants folded in.
+	for (int i=0; i<count; i++) {
+		const PresetResult &r=results[i];
+		const ShaderMetalConstants &m=constants[i];
+		const char *id=ids[i].c_str();
+		fprintf(fp,
+			"// %s: n=(%g, %g, %g), k=(%g, %g, %g), IOR %g; average errors: VRayMtl %g, Ole %g.\n",
+			r.name, r.n.r, r.n.g, r.n.b, r.k.r, r.k.g, r.k.b, r.ior, r.vrayError, r.oleError
+		);
+		fprintf(fp, "%s%s metalness_%s_complex(float cosTheta) { return metalness_conductorFresnel(%s, %s, cosTheta); }\n",
+			fn, c3, id, formatColor(syntax, m.complexA).c_str(), formatColor(syntax, m.complexB).c_str());
+		fprintf(fp, "%s%s metalness_%s_vray(float cosTheta) { return metalness_vrayFresnel(%s, %s, %s, %s, cosTheta); }\n",
+			fn, c3, id, formatColor(syntax, m.vrayBase).c_str(), formatColor(syntax, m.vrayTint).c_str(),
+			formatFloat(m.vrayIor).c_str(), formatFloat(m.vrayInvIor2).c_str());
+		fprintf(fp, "%s%s metalness_%s_ole(float cosTheta) { return metalness_conductorFresnel(%s, %s, cosTheta); }\n\n",
+			fn, c3, id, formatColor(syntax, m.oleA).c_str(), formatColor(syntax, m.oleB).c_str());
+	}
+
+	// Functions that take the metal index.
+	if (syntax.hasTables && count>0) {
+		fprintf(fp,
+			"struct MetalnessMetal {\n"
+			"\t%s complexA, complexB; // n*n+k*k and 2*n.\n"
+			"\t%s oleA, oleB; // n*n+k*k and 2*n for the n and k values of Ole's Fresnel.\n"
+			"\t%s vrayBase, vrayTint; // The base color, and the reflection color minus the base color.\n"
+			"\tfloat vrayIor, vrayInvIor2; // The IOR and 1/(IOR*IOR).\n"
+			"};\n"
+			"\n",
+			c3, c3, c3
+		);
+
+		if (language==shaderLanguage_glsl)
+			fprintf(fp, "const MetalnessMetal metalnessMetals[%d]=MetalnessMetal[%d](\n", count, count);
+		else
+			fprintf(fp, "%sMetalnessMetal metalnessMetals[%d]={\n", syntax.constantPrefix, count);
+
+		for (int i=0; i<count; i++) {
+			const ShaderMetalConstants &m=constants[i];
+			fprintf(fp, "\t%s%s, %s, %s, %s, %s, %s, %s, %s%s%s // %s\n",
+				language==shaderLanguage_glsl? "MetalnessMetal(" : "{ ",
+				formatColor(syntax, m.complexA).c_str(), formatColor(syntax, m.complexB).c_str(),
+				formatColor(syntax, m.oleA).c_str(), formatColor(syntax, m.oleB).c_str(),
+				formatColor(syntax, m.vrayBase).c_str(), formatColor(syntax, m.vrayTint).c_str(),
+				formatFloat(m.vrayIor).c_str(), formatFloat(m.vrayInvIor2).c_str(),
+				language==shaderLanguage_glsl? ")" : " }",
+				i+1<count? "," : "",
+				results[i].name
+			);
+		}
+		fprintf(fp, "%s\n\n", language==shaderLanguage_glsl? ");" : "};");
+
+		fprintf(fp,
+			"%s%s metalness_complex(int metal, float cosTheta) { return metalness_conductorFresnel(metalnessMetals[metal].complexA, metalnessMetals[metal].complexB, cosTheta); }\n"
+			"%s%s metalness_vray(int metal, float cosTheta) { return metalness_vrayFresnel(metalnessMetals[metal].vrayBase, metalnessMetals[metal].vrayTint, metalnessMetals[metal].vrayIor, metalnessMetals[metal].vrayInvIor2, cosTheta); }\n"
+			"%s%s metalness_ole(int metal, float cosTheta) { return metalness_conductorFresnel(metalnessMetals[metal].oleA, metalnessMetals[metal].oleB, cosTheta); }\n",
+			fn, c3, fn, c3, fn, c3
+		);
+	} else {
+		// Without constant arrays, select the function of the metal.
+		const char *curves[]={ "complex", "vray", "ole" };
+		for (int c=0; c<3; c++) {
+			fprintf(fp, "%s%s metalness_%s(int metal, float cosTheta) {\n", fn, c3, curves[c]);
+			for (int i=0; i<count; i++)
+				fprintf(fp, "\tif (metal==%d) return metalness_%s_%s(cosTheta);\n", i, ids[i].c_str(), curves[c]);
+			fprintf(fp, "\treturn %s(0.0, 0.0, 0.0);\n}\n%s", c3, c<2? "\n" : "");
+		}
+	}
+
+	if (language==shaderLanguage_cpp)
+		fprintf(fp, "\n#endif // METALNESS_SHADER_METALS_H\n");
+}
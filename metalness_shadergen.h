@@ -0,0 +1,54 @@
+/// @file Generation of shader source code with the fitted settings of metals, so that shaders can use the
+/// VRayMtl, Ole Gulbrandsen's and the complex Fresnel curves of the metals without deriving the parameters
+/// at render time.
+
+#ifndef METALNESS_SHADERGEN_H
+#define METALNESS_SHADERGEN_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "metalness_core.h"
+
+/// The languages for which shader code can be generated.
+enum ShaderLanguage {
+	shaderLanguage_cpp=0, ///< A C++ header.
+	shaderLanguage_glsl, ///< GLSL 1.30 or later.
+	shaderLanguage_hlsl, ///< HLSL shader model 4 or later.
+	shaderLanguage_osl, ///< Open Shading Language.
+
+	shaderLanguage_last,
+};
+
+/// Find the shader language with the given name (cpp, glsl, hlsl or osl), or the language for the
+/// extension of a file name (.h, .hpp, .cpp, .glsl, .hlsl, .osl).
+/// @param name The language name or the file name.
+/// @param language Receives the language.
+/// @return true if the language was recognized.
+bool findShaderLanguage(const char *name, ShaderLanguage &language);
+
+/// Make identifiers for code and material files from the names of metals: lower case letters, digits
+/// and underscores, unique within the set.
+/// @param names The names of the metals.
+/// @param count The number of metals.
+/// @param identifiers Receives the identifiers.
+void getMetalIdentifiers(const char * const *names, int count, std::vector<std::string> &identifiers);
+
+/// Write shader code for a set of fitted metals. The code has a table with constants for each metal,
+/// derived once from the fitted settings, and functions that evaluate the curves for a metal index:
+///
+/// metalness_complex(int metal, float cosTheta) The complex Fresnel curve for the n and k values.
+/// metalness_vray(int metal, float cosTheta) The VRayMtl metallic Fresnel with the fitted settings.
+/// metalness_ole(int metal, float cosTheta) Ole Gulbrandsen's metallic Fresnel with the fitted edge tint.
+///
+/// and for each metal, the same functions with the constants folded in, f.e. metalness_gold_vray(float cosTheta).
+/// Each metal also gets an index macro, f.e. METALNESS_GOLD.
+/// @param fp The output file.
+/// @param language The language of the code.
+/// @param results The fitted settings of the metals.
+/// @param count The number of metals.
+void writeShaderCode(FILE *fp, ShaderLanguage language, const PresetResult *results, int count);
+
+#endif // METALNESS_SHADERGEN_H
@@ -0,0 +1,252 @@
+/// @file Lightweight instrumentation: scoped timers and counters that are recorded per thread and can be
+/// written as a Chrome trace (open it in chrome://tracing or https://ui.perfetto.dev) to see where the
+/// time goes, on which thread and for which metal.
+///
+/// The instrumentation is compiled in only when METALNESS_TRACE is defined; otherwise the macros below
+/// expand to nothing and cost nothing. When compiled in, a scope costs two clock reads and appends one
+/// event to a buffer of the calling thread, without locking.
+///
+/// METALNESS_TRACE_SCOPE(name) Time the rest of the enclosing block as an event with the given name.
+/// METALNESS_TRACE_SCOPE_DETAIL(name, detail) The same, with a detail string such as the name of a metal.
+/// METALNESS_TRACE_COUNTER(name, value) Record the value of a counter at this time.
+/// METALNESS_TRACE_THREAD_NAME(name) Name the calling thread in the trace.
+///
+/// The names must be string literals or otherwise outlive the trace; the details are copied.
+
+#ifndef METALNESS_TRACE_H
+#define METALNESS_TRACE_H
+
+#ifdef METALNESS_TRACE
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// The kinds of trace events, named after the phases of the Chrome trace format.
+enum TraceEventPhase {
+	traceEventPhase_complete=0, ///< A timed scope.
+	traceEventPhase_counter, ///< The value of a counter.
+};
+
+/// One recorded event.
+struct TraceEvent {
+	const char *name; ///< The name of the scope or counter.
+	char detail[32]; ///< The detail of a scope, if any.
+	long long start; ///< The start time in nanoseconds since the start of the trace.
+	long long duration; ///< The duration in nanoseconds, for scopes.
+	double value; ///< The value, for counters.
+	TraceEventPhase phase; ///< The kind of event.
+};
+
+/// The events of one thread. Only that thread appends to it while tracing.
+struct TraceThreadBuffer {
+	int threadId; ///< A small number that identifies the thread in the trace.
+	std::string threadName; ///< The name of the thread, if set.
+	std::vector<TraceEvent> events; ///< The recorded events.
+};
+
+/// The buffers of all threads that recorded events. The buffers are kept after their threads exit, so
+/// that the trace can be written at the end of the program.
+struct TraceLog {
+	std::mutex mutex; ///< Guards the list of buffers.
+	std::vector<TraceThreadBuffer*> threads; ///< The buffers, in the order of the first event of each thread.
+	const std::chrono::steady_clock::time_point start; ///< The start time of the trace.
+
+	TraceLog(void):start(std::chrono::steady_clock::now()) {}
+};
+
+inline TraceLog& getTraceLog(void) {
+	static TraceLog log;
+	return log;
+}
+
+/// Get the buffer of the calling thread, registering it on the first call from that thread.
+inline TraceThreadBuffer& getTraceThreadBuffer(void) {
+	thread_local TraceThreadBuffer *buffer=NULL;
+	if (!buffer) {
+		TraceLog &log=getTraceLog();
+		std::lock_guard<std::mutex> lock(log.mutex);
+		buffer=new TraceThreadBuffer();
+		buffer->threadId=int(log.threads.size())+1;
+		buffer->events.reserve(1024);
+		log.threads.push_back(buffer);
+	}
+	return *buffer;
+}
+
+/// The current time in nanoseconds since the start of the trace.
+inline long long getTraceTime(void) {
+	return (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-getTraceLog().start).count();
+}
+
+/// Records the time between its construction and destruction; use METALNESS_TRACE_SCOPE.
+class TraceScope {
+public:
+	TraceScope(const char *name, const char *detail=NULL):name(name), detail(detail), start(getTraceTime()) {}
+
+	~TraceScope(void) {
+		TraceEvent event;
+		event.name=name;
+		event.detail[0]='\0';
+		if (detail) {
+			strncpy(event.detail, detail, sizeof(event.detail)-1);
+			event.detail[sizeof(event.detail)-1]='\0';
+		}
+		event.start=start;
+		event.duration=getTraceTime()-start;
+		event.value=0.0;
+		event.phase=traceEventPhase_complete;
+		getTraceThreadBuffer().events.push_back(event);
+	}
+
+private:
+	const char *name;
+	const char *detail;
+	const long long start;
+};
+
+/// Record the value of a counter; use METALNESS_TRACE_COUNTER.
+inline void traceCounter(const char *name, double value) {
+	TraceEvent event;
+	event.name=name;
+	event.detail[0]='\0';
+	event.start=getTraceTime();
+	event.duration=0;
+	event.value=value;
+	event.phase=traceEventPhase_counter;
+	getTraceThreadBuffer().events.push_back(event);
+}
+
+/// Name the calling thread in the trace; use METALNESS_TRACE_THREAD_NAME.
+inline void traceThreadName(const char *name) {
+	getTraceThreadBuffer().threadName=name;
+}
+
+/// Write a string as a JSON string literal.
+inline void writeTraceString(FILE *fp, const char *str) {
+	fputc('"', fp);
+	for (const char *c=str; *c; c++) {
+		const unsigned char ch=(unsigned char) *c;
+		if (ch=='"' || ch=='\\') fprintf(fp, "\\%c", ch);
+		else if (ch<0x20) fprintf(fp, "\\u%04x", ch);
+		else fputc(ch, fp);
+	}
+	fputc('"', fp);
+}
+
+/// Write all recorded events in the Chrome trace event format. Call it when no other threads record events.
+/// @param fp The output file.
+inline void writeChromeTrace(FILE *fp) {
+	TraceLog &log=getTraceLog();
+	std::lock_guard<std::mutex> lock(log.mutex);
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	bool first=true;
+	for (size_t t=0; t<log.threads.size(); t++) {
+		const TraceThreadBuffer &thread=*log.threads[t];
+		if (!thread.threadName.empty()) {
+			fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", first? "" : ",\n", thread.threadId);
+			writeTraceString(fp, thread.threadName.c_str());
+			fprintf(fp, "}}");
+			first=false;
+		}
+
+		for (size_t i=0; i<thread.events.size(); i++) {
+			const TraceEvent &event=thread.events[i];
+			fprintf(fp, "%s{\"name\": ", first? "" : ",\n");
+			writeTraceString(fp, event.name);
+			if (event.phase==traceEventPhase_counter) {
+				fprintf(fp, ", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"value\": %.9g}}", double(event.start)*1e-3, thread.threadId, event.value);
+			} else {
+				fprintf(fp, ", \"cat\": \"metalness\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d",
+					double(event.start)*1e-3, double(event.duration)*1e-3, thread.threadId);
+				if (event.detail[0]) {
+					fprintf(fp, ", \"args\": {\"detail\": ");
+					writeTraceString(fp, event.detail);
+					fprintf(fp, "}");
+				}
+				fprintf(fp, "}");
+			}
+			first=false;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+}
+
+/// Write all recorded events to a Chrome trace file, see writeChromeTrace().
+/// @return true if the file was written successfully and false otherwise.
+inline bool saveChromeTrace(const char *fileName) {
+	FILE *fp=fopen(fileName, "wt");
+	if (!fp)
+		return false;
+	writeChromeTrace(fp);
+	const bool ok=(ferror(fp)==0);
+	return (fclose(fp)==0) && ok;
+}
+
+/// Write a table with the number of calls, the total, mean and maximum time of each scope name over all
+/// threads, slowest total first. The maximum shows stragglers, along with the detail of the slowest call.
+/// @param fp The output file.
+inline void writeTraceSummary(FILE *fp) {
+	struct ScopeStats {
+		long long count, total, max;
+		std::string maxDetail;
+		ScopeStats(void):count(0), total(0), max(0) {}
+	};
+
+	std::map<std::string, ScopeStats> stats;
+	{
+		TraceLog &log=getTraceLog();
+		std::lock_guard<std::mutex> lock(log.mutex);
+		for (size_t t=0; t<log.threads.size(); t++) {
+			const std::vector<TraceEvent> &events=log.threads[t]->events;
+			for (size_t i=0; i<events.size(); i++) {
+				if (events[i].phase!=traceEventPhase_complete)
+					continue;
+				ScopeStats &s=stats[events[i].name];
+				s.count++;
+				s.total+=events[i].duration;
+				if (events[i].duration>=s.max) {
+					s.max=events[i].duration;
+					s.maxDetail=events[i].detail;
+				}
+			}
+		}
+	}
+
+	std::vector<std::pair<std::string, ScopeStats> > sorted(stats.begin(), stats.end());
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, ScopeStats> &a, const std::pair<std::string, ScopeStats> &b) {
+		return a.second.total>b.second.total;
+	});
+
+	fprintf(fp, "%-24s %10s %12s %12s %12s  %s\n", "Scope", "Calls", "Total ms", "Mean us", "Max us", "Slowest");
+	for (size_t i=0; i<sorted.size(); i++) {
+		const ScopeStats &s=sorted[i].second;
+		fprintf(fp, "%-24s %10lld %12.3f %12.3f %12.3f  %s\n", sorted[i].first.c_str(), s.count, double(s.total)*1e-6,
+			double(s.total)*1e-3/double(s.count), double(s.max)*1e-3, s.maxDetail.c_str());
+	}
+}
+
+#define METALNESS_TRACE_CONCAT_IMPL(a, b) a##b
+#define METALNESS_TRACE_CONCAT(a, b) METALNESS_TRACE_CONCAT_IMPL(a, b)
+#define METALNESS_TRACE_SCOPE(name) TraceScope METALNESS_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define METALNESS_TRACE_SCOPE_DETAIL(name, detail) TraceScope METALNESS_TRACE_CONCAT(traceScope, __LINE__)(name, detail)
+#define METALNESS_TRACE_COUNTER(name, value) traceCounter(name, double(value))
+#define METALNESS_TRACE_THREAD_NAME(name) traceThreadName(name)
+
+#else // METALNESS_TRACE
+
+#define METALNESS_TRACE_SCOPE(name)
+#define METALNESS_TRACE_SCOPE_DETAIL(name, detail)
+#define METALNESS_TRACE_COUNTER(name, value)
+#define METALNESS_TRACE_THREAD_NAME(name)
+
+#endif // METALNESS_TRACE
+
+#endif // METALNESS_TRACE_H
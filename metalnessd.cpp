@@ -0,0 +1,886 @@
+/// @file A local service that fits VRayMtl settings to metals on request, so that plugins do not have to
+/// start a process or run the IOR search for every material. Clients connect to a Unix domain socket and
+/// send requests, one per line; the service answers each request with one line, in the order of the
+/// requests on that connection. Values are separated by spaces.
+///
+/// Requests:
+///
+/// fit n_r n_g n_b k_r k_g k_b
+///     Fit the VRayMtl settings to a metal. Answer:
+///     ok base_r base_g base_b reflection_r reflection_g reflection_b ior vray_error ole_error
+///
+/// eval n_r n_g n_b k_r k_g k_b cos_theta
+///     Evaluate the complex Fresnel curve, the fitted VRayMtl metallic Fresnel and Ole Gulbrandsen's
+///     metallic Fresnel for a metal at the given viewing angle cosine. Answer:
+///     ok complex_r complex_g complex_b vray_r vray_g vray_b ole_r ole_g ole_b
+///
+/// stats
+///     Answer: ok requests fits cache_hits cache_entries batches
+///
+/// quit
+///     Close the connection.
+///
+/// Malformed requests are answered with "error <message>". As for the metalness command line, the values
+/// must be finite, the n values positive and the k values not negative.
+///
+/// Fit results are kept in a cache with the least recently used entries dropped first, so repeated
+/// requests for the same metal are answered without fitting. Requests for cached metals are answered
+/// right away by the thread that serves the clients. The other metals are fitted on a background
+/// thread: all metals that arrive while a batch is fitted are fitted together in the next batch on all
+/// threads, so that many clients or many pipelined requests on one connection are served in batches.
+/// The answers on one connection stay in the order of the requests, so a request for a cached metal
+/// waits for earlier requests on the same connection that need a fit, but not for those of other
+/// connections.
+///
+/// This program uses POSIX sockets and works on Linux and macOS. To build it, type
+///
+/// g++ -O2 -std=c++14 metalnessd.cpp metalness_core.cpp -o metalnessd -pthread
+///
+/// and run it with --help for the options. For a quick test, use f.e.
+///
+/// echo "fit 0.15557 0.42415 1.3831 3.6024 2.4721 1.9155" | socat - UNIX-CONNECT:/tmp/metalnessd.sock
+///
+/// metalnessd --self-test runs the batching, the cache and the answers over socket pairs and reports
+/// whether every request was answered correctly, and a request for a cached metal without waiting for
+/// the fits of another client.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "metalness_core.h"
+
+/// The n and k values of a metal, used as the key of the fit cache. Compared bit by bit, so
+/// that requests with the same text always map to the same entry.
+struct MetalKey {
+	float values[6]; ///< n and k for red/green/blue.
+
+	bool operator==(const MetalKey &other) const {
+		return memcmp(values, other.values, sizeof(values))==0;
+	}
+
+	Color getN(void) const { return Color(values[0], values[1], values[2]); }
+	Color getK(void) const { return Color(values[3], values[4], values[5]); }
+};
+
+struct MetalKeyHash {
+	size_t operator()(const MetalKey &key) const {
+		// FNV-1a over the bytes of the values.
+		const unsigned char *bytes=(const unsigned char*) key.values;
+		size_t hash=2166136261u;
+		for (size_t i=0; i<sizeof(key.values); i++)
+			hash=(hash^bytes[i])*16777619u;
+		return hash;
+	}
+};
+
+/// The fitted settings for a metal.
+struct FitResult {
+	PresetCurves curves; ///< The fitted settings and the n and k values.
+	double vrayError; ///< The average error of the VRayMtl metallic Fresnel curve.
+	double oleError; ///< The average error of Ole Gulbrandsen's metallic Fresnel curve.
+};
+
+/// A cache of fit results that drops the least recently used entries when full.
+class FitCache {
+public:
+	/// @param maxEntries The maximum number of cached results.
+	FitCache(size_t maxEntries):maxEntries(maxEntries) {}
+
+	/// Return the cached result for a metal and mark it as recently used, or NULL if there is none.
+	const FitResult* find(const MetalKey &key) {
+		Map::iterator it=map.find(key);
+		if (it==map.end())
+			return NULL;
+		entries.splice(entries.begin(), entries, it->second);
+		return &it->second->second;
+	}
+
+	/// Add a result, dropping the least recently used one if the cache is full.
+	void insert(const MetalKey &key, const FitResult &result) {
+		if (find(key))
+			return;
+		entries.push_front(std::make_pair(key, result));
+		map[key]=entries.begin();
+		if (entries.size()>maxEntries) {
+			map.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	size_t size(void) const { return entries.size(); }
+
+private:
+	typedef std::list<std::pair<MetalKey, FitResult> > EntryList;
+	typedef std::unordered_map<MetalKey, EntryList::iterator, MetalKeyHash> Map;
+
+	EntryList entries; ///< The entries, most recently used first.
+	Map map; ///< The entries by key.
+	size_t maxEntries;
+};
+
+/// The request types.
+enum RequestType {
+	requestType_fit=0,
+	requestType_eval,
+	requestType_stats,
+	requestType_quit,
+	requestType_error, ///< A malformed request; the answer is the error message.
+};
+
+/// A parsed request.
+struct Request {
+	RequestType type;
+	MetalKey key; ///< The metal for fit and eval requests.
+	float cosTheta; ///< The viewing angle cosine for eval requests.
+	std::string error; ///< The error message for malformed requests.
+	bool hasResult; ///< True once the fit result of the metal of a fit or eval request is known.
+	FitResult result; ///< The fit result, if hasResult is true.
+
+	Request(void):type(requestType_error), cosTheta(0.0f), hasResult(false) {}
+};
+
+/// A connected client.
+struct Client {
+	int fd; ///< The socket, or -1 if the connection is closed.
+	std::string input; ///< Received data that does not form a complete line yet.
+	std::string output; ///< Answers that could not be sent yet.
+	std::deque<Request> pending; ///< The requests that were not answered yet, in the order they arrived.
+	bool closing; ///< True to close the connection once all requests are answered and the answers sent.
+
+	Client(void):fd(-1), closing(false) {}
+};
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SIGPIPE is ignored anyway.
+#endif
+
+/// The longest accepted request line; longer lines close the connection.
+const size_t maxRequestLength=4096;
+
+/// Set by the signal handlers to stop the service.
+static volatile sig_atomic_t stopRequested=0;
+
+static void onStopSignal(int) {
+	stopRequested=1;
+}
+
+/// Parse one request line.
+/// @param line The line without the line break.
+/// @param request Receives the type and the arguments of the request.
+void parseRequest(const char *line, Request &request) {
+	std::vector<std::string> tokens;
+	const char *c=line;
+	while (*c) {
+		while (*c==' ' || *c=='\t')
+			c++;
+		const char *start=c;
+		while (*c && *c!=' ' && *c!='\t')
+			c++;
+		if (c>start)
+			tokens.push_back(std::string(start, c));
+	}
+
+	if (tokens.empty()) {
+		request.type=requestType_error;
+		request.error="empty request";
+		return;
+	}
+
+	const std::string &command=tokens[0];
+	size_t expectedValues=0;
+	if (command=="fit") {
+		request.type=requestType_fit;
+		expectedValues=6;
+	} else if (command=="eval") {
+		request.type=requestType_eval;
+		expectedValues=7;
+	} else if (command=="stats") {
+		request.type=requestType_stats;
+	} else if (command=="quit") {
+		request.type=requestType_quit;
+	} else {
+		request.type=requestType_error;
+		request.error="unknown request \""+command+"\"";
+		return;
+	}
+
+	float values[7];
+	bool valid=(tokens.size()==expectedValues+1);
+	for (size_t i=0; valid && i<expectedValues; i++) {
+		const char *str=tokens[i+1].c_str();
+		char *end=NULL;
+		values[i]=strtof(str, &end);
+		valid=(end!=str && *end=='\0' && isfinite(values[i]));
+	}
+
+	if (!valid) {
+		request.type=requestType_error;
+		if (command=="fit") request.error="expected: fit n_r n_g n_b k_r k_g k_b";
+		else if (command=="eval") request.error="expected: eval n_r n_g n_b k_r k_g k_b cos_theta";
+		else request.error="unexpected arguments for "+command;
+		return;
+	}
+
+	// The same limits as for the metals of the metalness command line.
+	for (size_t i=0; i<6 && i<expectedValues; i++) {
+		if ((i<3 && values[i]<=0.0f) || values[i]<0.0f) {
+			request.type=requestType_error;
+			request.error=(i<3)? "the n values must be positive" : "the k values must not be negative";
+			return;
+		}
+		request.key.values[i]=values[i];
+	}
+	if (request.type==requestType_eval)
+		request.cosTheta=clamp(values[6], 0.0f, 1.0f);
+}
+
+/// Append formatted text to a string.
+void appendf(std::string &str, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void appendf(std::string &str, const char *format, ...) {
+	char buf[512];
+	va_list args;
+	va_start(args, format);
+	const int len=vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (len>0)
+		str.append(buf, size_t(len)<sizeof(buf)? size_t(len) : sizeof(buf)-1);
+}
+
+/// Counters reported by the stats request.
+struct ServiceStats {
+	unsigned long long numRequests; ///< All requests, including malformed ones.
+	unsigned long long numFits; ///< Metals that were fitted.
+	unsigned long long numCacheHits; ///< Metals of fit and eval requests found in the cache, once per round of requests.
+	unsigned long long numBatches; ///< Groups of metals that were fitted together.
+};
+
+/// Create the listening socket.
+/// @param path The file name of the socket; an existing socket file is replaced.
+/// @return The socket, or -1 on failure.
+int createServerSocket(const char *path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	if (strlen(path)>=sizeof(addr.sun_path)) {
+		fprintf(stderr, "The socket path %s is too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	const int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd<0) {
+		perror("socket");
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(fd, (sockaddr*) &addr, sizeof(addr))<0 || listen(fd, 64)<0) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
+/// Send as much of the pending output of a client as the socket accepts.
+void flushClient(Client &client) {
+	while (!client.output.empty()) {
+		const ssize_t sent=send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+		if (sent>0) {
+			client.output.erase(0, size_t(sent));
+		} else if (sent<0 && errno==EINTR) {
+			continue;
+		} else {
+			if (sent<0 && errno!=EAGAIN && errno!=EWOULDBLOCK) {
+				// The client went away; drop what it did not read.
+				client.output.clear();
+				client.closing=true;
+			}
+			break;
+		}
+	}
+}
+
+/// Read everything available from a client and add the complete lines to its pending requests.
+/// @return The number of requests that were added.
+size_t readClient(Client &client) {
+	const size_t numPending=client.pending.size();
+	char buf[65536];
+	while (true) {
+		const ssize_t received=recv(client.fd, buf, sizeof(buf), 0);
+		if (received>0) {
+			client.input.append(buf, size_t(received));
+		} else if (received<0 && errno==EINTR) {
+			continue;
+		} else {
+			if (received==0 || (errno!=EAGAIN && errno!=EWOULDBLOCK))
+				client.closing=true; // The client closed its end, or the connection failed.
+			break;
+		}
+	}
+
+	// If the client closed its end, the last request does not need a line break.
+	if (client.closing && !client.input.empty() && client.input[client.input.size()-1]!='\n')
+		client.input+='\n';
+
+	size_t lineStart=0;
+	while (true) {
+		const size_t lineEnd=client.input.find('\n', lineStart);
+		if (lineEnd==std::string::npos)
+			break;
+
+		std::string line=client.input.substr(lineStart, lineEnd-lineStart);
+		lineStart=lineEnd+1;
+		if (!line.empty() && line[line.size()-1]=='\r')
+			line.erase(line.size()-1);
+		if (line.find_first_not_of(" \t")==std::string::npos)
+			continue;
+
+		Request request;
+		parseRequest(line.c_str(), request);
+		client.pending.push_back(request);
+	}
+	client.input.erase(0, lineStart);
+
+	if (client.input.size()>maxRequestLength) {
+		Request request;
+		request.type=requestType_error;
+		request.error="request too long";
+		client.pending.push_back(request);
+		client.input.clear();
+		client.closing=true;
+	}
+	return client.pending.size()-numPending;
+}
+
+/// Fit a metal and compute the errors of the fitted curves.
+void fitMetalKey(const MetalKey &key, const FitOptions &options, FitResult &result) {
+	fitMetal(key.getN(), key.getK(), result.curves, options);
+	CurveErrors errors;
+	computeCurveErrors(result.curves, options, errors);
+	result.vrayError=errors.vray;
+	result.oleError=errors.ole;
+}
+
+/// The fit results of several metals.
+typedef std::unordered_map<MetalKey, FitResult, MetalKeyHash> BatchResults;
+
+/// Fits metals on a background thread, so that the thread that serves the clients can answer requests for
+/// cached metals while a fit is running. All metals that are submitted while a batch is fitted are fitted
+/// together in the next batch on all threads.
+class FitWorker {
+public:
+	/// Start the thread.
+	/// @param options The options for fitting and computing the errors.
+	/// @param numThreads The number of threads for fitting a batch; 0 means one per logical processor.
+	FitWorker(const FitOptions &options, int numThreads):options(options), numThreads(numThreads), numBatches(0), stopping(false) {
+		if (pipe(wakeFds)<0) {
+			perror("pipe");
+			wakeFds[0]=wakeFds[1]=-1;
+			return;
+		}
+		for (int i=0; i<2; i++)
+			fcntl(wakeFds[i], F_SETFL, fcntl(wakeFds[i], F_GETFL, 0) | O_NONBLOCK);
+		thread=std::thread(&FitWorker::workerThread, this);
+	}
+
+	/// Stop the thread after the batch that is being fitted.
+	~FitWorker(void) {
+		if (thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping=true;
+				queueChanged.notify_all();
+			}
+			thread.join();
+		}
+		for (int i=0; i<2; i++) {
+			if (wakeFds[i]>=0)
+				close(wakeFds[i]);
+		}
+	}
+
+	/// Return false if the thread could not be started.
+	bool isRunning(void) const { return thread.joinable(); }
+
+	/// The end of a pipe that becomes readable when results are ready, for poll().
+	int getWakeFd(void) const { return wakeFds[0]; }
+
+	/// Queue metals for fitting.
+	void submit(const std::vector<MetalKey> &keys) {
+		if (keys.empty())
+			return;
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.insert(queue.end(), keys.begin(), keys.end());
+		queueChanged.notify_all();
+	}
+
+	/// Take the results that are ready.
+	/// @param results Receives the fitted metals and their results.
+	/// @param batches Receives the number of batches they were fitted in.
+	void collect(std::vector<std::pair<MetalKey, FitResult> > &results, unsigned long long &batches) {
+		char buf[256];
+		while (read(wakeFds[0], buf, sizeof(buf))>0) {}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		results.clear();
+		results.swap(finished);
+		batches=numBatches;
+		numBatches=0;
+	}
+
+private:
+	void workerThread(void) {
+		while (true) {
+			std::vector<MetalKey> keys;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				queueChanged.wait(lock, [this]() { return !queue.empty() || stopping; });
+				if (stopping)
+					return;
+				keys.swap(queue);
+			}
+
+			std::vector<FitResult> fitted(keys.size());
+			parallelFor(int(keys.size()), numThreads, [this, &keys, &fitted](int i) {
+				fitMetalKey(keys[i], options, fitted[i]);
+			});
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t i=0; i<keys.size(); i++)
+					finished.push_back(std::make_pair(keys[i], fitted[i]));
+				numBatches++;
+			}
+
+			// Wake up poll(); if the pipe is full, it is readable anyway.
+			const char byte=0;
+			if (write(wakeFds[1], &byte, 1)<0) {}
+		}
+	}
+
+	const FitOptions options;
+	const int numThreads;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable queueChanged; ///< Signaled when metals are queued or the thread should stop.
+	std::vector<MetalKey> queue; ///< Metals waiting for the next batch.
+	std::vector<std::pair<MetalKey, FitResult> > finished; ///< Results that were not collected yet.
+	unsigned long long numBatches; ///< The number of batches fitted since the last collect().
+	bool stopping; ///< True to stop the thread.
+	int wakeFds[2]; ///< A pipe that the thread writes to when results are ready.
+};
+
+/// The state of the service that all clients share.
+struct Service {
+	FitCache cache; ///< The fit results of recently requested metals.
+	FitWorker worker; ///< Fits the metals that are not in the cache.
+	std::unordered_set<MetalKey, MetalKeyHash> fitting; ///< Metals that were submitted to the worker and whose results did not arrive yet.
+	ServiceStats stats;
+
+	Service(size_t cacheSize, const FitOptions &options, int numThreads):cache(cacheSize), worker(options, numThreads) {
+		memset(&stats, 0, sizeof(stats));
+	}
+};
+
+/// Return true if a request needs the fit result of its metal.
+inline bool needsFitResult(const Request &request) {
+	return request.type==requestType_fit || request.type==requestType_eval;
+}
+
+/// Write the answer to a request.
+/// @param request The request; fit and eval requests must have their fit result.
+void answerRequest(const Request &request, const Service &service, Client &client) {
+	const ServiceStats &stats=service.stats;
+	switch (request.type) {
+		case requestType_fit: {
+			const PresetCurves &c=request.result.curves;
+			appendf(client.output, "ok %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+				c.base.r, c.base.g, c.base.b, c.reflection.r, c.reflection.g, c.reflection.b, c.ior, request.result.vrayError, request.result.oleError);
+			break;
+		}
+		case requestType_eval: {
+			const CurveSample sample=evalCurves(request.result.curves, request.cosTheta);
+			appendf(client.output, "ok %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+				sample.complex.r, sample.complex.g, sample.complex.b,
+				sample.vray.r, sample.vray.g, sample.vray.b,
+				sample.ole.r, sample.ole.g, sample.ole.b);
+			break;
+		}
+		case requestType_stats:
+			appendf(client.output, "ok %llu %llu %llu %llu %llu\n", stats.numRequests, stats.numFits, stats.numCacheHits, (unsigned long long) service.cache.size(), stats.numBatches);
+			break;
+		case requestType_quit:
+			client.closing=true;
+			break;
+		case requestType_error:
+			appendf(client.output, "error %s\n", request.error.c_str());
+			break;
+	}
+}
+
+/// Answer the pending requests of all clients in order, as far as their fit results are known. Requests
+/// for metals in the cache get their results right away; the metals of the other fit and eval requests are
+/// submitted to the worker in one batch, unless they are being fitted already.
+void answerClients(std::vector<Client> &clients, Service &service) {
+	std::unordered_set<MetalKey, MetalKeyHash> hits; // Count each metal once per round of requests.
+	std::vector<MetalKey> toFit;
+	for (size_t i=0; i<clients.size(); i++) {
+		Client &client=clients[i];
+		for (size_t j=0; j<client.pending.size(); j++) {
+			Request &request=client.pending[j];
+			if (!needsFitResult(request) || request.hasResult)
+				continue;
+			const FitResult *cached=service.cache.find(request.key);
+			if (cached) {
+				request.result=*cached;
+				request.hasResult=true;
+				if (hits.insert(request.key).second)
+					service.stats.numCacheHits++;
+			} else if (service.fitting.insert(request.key).second) {
+				toFit.push_back(request.key);
+			}
+		}
+
+		while (!client.pending.empty()) {
+			const Request &request=client.pending.front();
+			if (needsFitResult(request) && !request.hasResult)
+				break;
+			answerRequest(request, service, client);
+			client.pending.pop_front();
+		}
+	}
+	service.worker.submit(toFit);
+}
+
+/// Give the results that the worker finished to the requests that wait for them, and add them to the
+/// cache.
+void receiveResults(std::vector<Client> &clients, Service &service) {
+	std::vector<std::pair<MetalKey, FitResult> > finished;
+	unsigned long long batches=0;
+	service.worker.collect(finished, batches);
+	if (finished.empty())
+		return;
+
+	BatchResults results;
+	for (size_t i=0; i<finished.size(); i++) {
+		results.insert(finished[i]);
+		service.cache.insert(finished[i].first, finished[i].second);
+		service.fitting.erase(finished[i].first);
+	}
+	service.stats.numFits+=finished.size();
+	service.stats.numBatches+=batches;
+
+	// The results go to the requests directly, since the cache may drop them again before earlier
+	// requests of the same client are answered.
+	for (size_t i=0; i<clients.size(); i++) {
+		for (size_t j=0; j<clients[i].pending.size(); j++) {
+			Request &request=clients[i].pending[j];
+			if (!needsFitResult(request) || request.hasResult)
+				continue;
+			BatchResults::const_iterator it=results.find(request.key);
+			if (it!=results.end()) {
+				request.result=it->second;
+				request.hasResult=true;
+			}
+		}
+	}
+}
+
+/// Read the answers from the other end of a client socket until the service closes it.
+std::vector<std::string> readAnswers(int fd) {
+	std::string output;
+	char buf[4096];
+	ssize_t received;
+	while ((received=read(fd, buf, sizeof(buf)))>0)
+		output.append(buf, size_t(received));
+
+	std::vector<std::string> answers;
+	for (size_t start=0, end; (end=output.find('\n', start))!=std::string::npos; start=end+1)
+		answers.push_back(output.substr(start, end-start));
+	return answers;
+}
+
+/// Send requests from two clients through socket pairs: one batch with more metals than the cache can hold
+/// and with malformed requests, and one request for a cached metal that must be answered while the batch
+/// is fitted. Check that every request is answered, that repeated requests for a metal get the same
+/// answer, and that malformed requests are answered with errors.
+/// @return true if the check passed.
+bool runSelfTest(const FitOptions &options, int numThreads) {
+	const char *const lines[]={
+		"fit 0.15557 0.42415 1.3831 3.6024 2.4721 1.9155",
+		"fit 0.27105 0.67693 1.3164 3.6092 2.6247 2.2921",
+		"eval 1.5 0.98 0.6 3.4 3.2 3.1 0.5",
+		"fit 0.15557 0.42415 1.3831 3.6024 2.4721 1.9155",
+		"stats",
+	};
+	const char *const badLines[]={
+		"fit -0.2 0.42415 1.3831 3.6024 2.4721 1.9155",
+		"fit 0.15557 0.42415 1.3831 3.6024 -2.4721 1.9155",
+		"eval 1.5 0.98 0.6 3.4 3.2 inf 0.5",
+	};
+	const char *const cachedLine="fit 0.2 0.9 1.1 3.9 2.4 2.2";
+	const int numLines=int(sizeof(lines)/sizeof(lines[0]));
+	const int numBadLines=int(sizeof(badLines)/sizeof(badLines[0]));
+	std::string input;
+	for (int i=0; i<numLines; i++)
+		input+=std::string(lines[i])+"\n";
+	for (int i=0; i<numBadLines; i++)
+		input+=std::string(badLines[i])+"\n";
+	// A line that starts with a zero byte has no tokens.
+	input+=std::string("\0 fit\n", 6);
+	const std::string inputs[2]={ input, std::string(cachedLine)+"\n" };
+
+	// A cache that holds one result, for a batch with three metals.
+	Service service(1, options, numThreads);
+	if (!service.worker.isRunning())
+		return false;
+	Request cachedRequest;
+	parseRequest(cachedLine, cachedRequest);
+	FitResult cachedResult;
+	fitMetalKey(cachedRequest.key, options, cachedResult);
+	service.cache.insert(cachedRequest.key, cachedResult);
+
+	std::vector<Client> clients(2);
+	int peerFds[2];
+	for (int i=0; i<2; i++) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)<0) {
+			perror("socketpair");
+			return false;
+		}
+		fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+		clients[i].fd=fds[0];
+		clients[i].closing=false;
+		peerFds[i]=fds[1];
+		if (write(fds[1], inputs[i].data(), inputs[i].size())!=ssize_t(inputs[i].size()) || shutdown(fds[1], SHUT_WR)<0) {
+			perror("write");
+			return false;
+		}
+	}
+
+	for (int i=0; i<2; i++)
+		service.stats.numRequests+=readClient(clients[i]);
+	answerClients(clients, service);
+	const bool cachedFirst=(clients[1].pending.empty() && !clients[0].pending.empty());
+
+	while (!clients[0].pending.empty()) {
+		pollfd wakePoll={ service.worker.getWakeFd(), POLLIN, 0 };
+		if (poll(&wakePoll, 1, -1)<0 && errno!=EINTR) {
+			perror("poll");
+			return false;
+		}
+		receiveResults(clients, service);
+		answerClients(clients, service);
+	}
+
+	std::vector<std::string> answers[2];
+	for (int i=0; i<2; i++) {
+		flushClient(clients[i]);
+		close(clients[i].fd);
+		answers[i]=readAnswers(peerFds[i]);
+		close(peerFds[i]);
+	}
+
+	bool ok=cachedFirst && int(answers[0].size())==numLines+numBadLines+1 && answers[1].size()==1;
+	for (size_t i=0; ok && i<answers[0].size(); i++) {
+		const char *prefix=(int(i)<numLines)? "ok " : "error ";
+		ok=(answers[0][i].compare(0, strlen(prefix), prefix)==0);
+	}
+	ok=ok && answers[0][0]==answers[0][3] && answers[1][0].compare(0, 3, "ok ")==0;
+	fprintf(stderr, "metalnessd: self-test %s\n", ok? "passed" : "failed");
+	if (!ok) {
+		if (!cachedFirst)
+			fprintf(stderr, "The request for the cached metal waited for the fits of the other client.\n");
+		for (int i=0; i<2; i++) {
+			for (size_t j=0; j<answers[i].size(); j++)
+				fprintf(stderr, "%d: %s\n", i, answers[i][j].c_str());
+		}
+	}
+	return ok;
+}
+
+void printUsage(void) {
+	fprintf(stderr,
+		"Usage: metalnessd [options]\n"
+		"\n"
+		"Fits VRayMtl settings to metals for clients that connect to a Unix domain socket; see the start of\n"
+		"metalnessd.cpp for the protocol.\n"
+		"\n"
+		"Options:\n"
+		"  --socket <path>         The socket file (default /tmp/metalnessd.sock).\n"
+		"  --threads <n>           Threads for fitting batches; 0 means one per processor (default 0).\n"
+		"  --cache-size <n>        The maximum number of cached fits (default 100000).\n"
+		"  --solver brute|coarse   The IOR search (default brute), see metalness --help.\n"
+		"  --sampling adaptive|uniform\n"
+		"                          Sampling of the curves for the errors (default adaptive).\n"
+		"  --self-test             Answer a batch with more metals than the cache holds and a cached metal of\n"
+		"                          another client without a socket file, check the answers and exit; the\n"
+		"                          other options apply.\n"
+		"  --help                  Show this help.\n"
+	);
+}
+
+int main(int argc, char *argv[]) {
+	const char *socketPath="/tmp/metalnessd.sock";
+	int numThreads=0;
+	size_t cacheSize=100000;
+	FitOptions options;
+	bool selfTest=false;
+
+	for (int i=1; i<argc; i++) {
+		const std::string arg=argv[i];
+		if (arg=="--help" || arg=="-h") {
+			printUsage();
+			return 0;
+		}
+		if (arg=="--self-test") {
+			selfTest=true;
+			continue;
+		}
+		if (i+1>=argc) {
+			fprintf(stderr, "Unknown option or missing value: %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+
+		const char *value=argv[++i];
+		if (arg=="--socket") {
+			socketPath=value;
+		} else if (arg=="--threads") {
+			numThreads=atoi(value);
+		} else if (arg=="--cache-size") {
+			cacheSize=size_t(strtoul(value, NULL, 10));
+			if (cacheSize<1)
+				cacheSize=1;
+		} else if (arg=="--solver") {
+			if (strcmp(value, "brute")==0) options.solver=iorSolver_bruteForce;
+			else if (strcmp(value, "coarse")==0) options.solver=iorSolver_coarseToFine;
+			else { fprintf(stderr, "Unknown solver %s\n", value); return 1; }
+		} else if (arg=="--sampling") {
+			if (strcmp(value, "adaptive")==0) options.errorSampling=curveSampling_adaptive;
+			else if (strcmp(value, "uniform")==0) options.errorSampling=curveSampling_uniform;
+			else { fprintf(stderr, "Unknown sampling %s\n", value); return 1; }
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (selfTest) {
+		signal(SIGPIPE, SIG_IGN);
+		return runSelfTest(options, numThreads)? 0 : 1;
+	}
+
+	const int serverFd=createServerSocket(socketPath);
+	if (serverFd<0)
+		return 1;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler=onStopSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "metalnessd: listening on %s\n", socketPath);
+
+	Service service(cacheSize, options, numThreads);
+	if (!service.worker.isRunning()) {
+		close(serverFd);
+		unlink(socketPath);
+		return 1;
+	}
+
+	std::vector<Client> clients;
+	std::vector<pollfd> pollFds;
+
+	while (!stopRequested) {
+		// Wait for new connections, requests, fit results, or sockets that can take more answers.
+		pollFds.clear();
+		pollfd serverPoll={ serverFd, POLLIN, 0 };
+		pollFds.push_back(serverPoll);
+		pollfd workerPoll={ service.worker.getWakeFd(), POLLIN, 0 };
+		pollFds.push_back(workerPoll);
+		for (size_t i=0; i<clients.size(); i++) {
+			// Closing clients that wait for fits are left out, so that a hung up socket does not wake poll().
+			const Client &client=clients[i];
+			pollfd clientPoll={ (client.closing && client.output.empty())? -1 : client.fd, short(client.closing? 0 : POLLIN), 0 };
+			if (!client.output.empty())
+				clientPoll.events|=POLLOUT;
+			pollFds.push_back(clientPoll);
+		}
+
+		if (poll(&pollFds[0], pollFds.size(), -1)<0) {
+			if (errno==EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (pollFds[1].revents & POLLIN)
+			receiveResults(clients, service);
+		for (size_t i=0; i<clients.size(); i++) {
+			const short events=pollFds[i+2].revents;
+			if (!clients[i].closing && (events & (POLLIN | POLLHUP | POLLERR)))
+				service.stats.numRequests+=readClient(clients[i]);
+		}
+
+		// Answer what is known; the metals of all clients that are not in the cache are fitted in one batch.
+		answerClients(clients, service);
+
+		// Send the answers and drop closed connections.
+		size_t numOpen=0;
+		for (size_t i=0; i<clients.size(); i++) {
+			flushClient(clients[i]);
+			if (clients[i].closing && clients[i].output.empty() && clients[i].pending.empty()) {
+				close(clients[i].fd);
+				continue;
+			}
+			clients[numOpen++]=clients[i];
+		}
+		clients.resize(numOpen);
+
+		// Accept new connections last, so that the client indices above match pollFds.
+		if (pollFds[0].revents & POLLIN) {
+			while (true) {
+				const int fd=accept(serverFd, NULL, NULL);
+				if (fd<0)
+					break;
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+				Client client;
+				client.fd=fd;
+				clients.push_back(client);
+			}
+		}
+	}
+
+	for (size_t i=0; i<clients.size(); i++)
+		close(clients[i].fd);
+	close(serverFd);
+	unlink(socketPath);
+	fprintf(stderr, "metalnessd: stopped\n");
+	return 0;
+}
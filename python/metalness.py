@@ -0,0 +1,251 @@
+"""Python bindings for the metalness library (see metalness_api.h).
+
+The functions work on NumPy arrays. Inputs that are already C-contiguous float32 arrays of the
+right shape are passed to the library without copying, and the results are written directly into
+the returned arrays (or into the arrays given with out=). The library is called through ctypes,
+which releases the GIL for the duration of each call, and the batch work is split across
+num_threads threads inside the library (0 means one thread per logical processor).
+
+Build the library first, see the start of metalness_api.h. The library is looked up in the
+METALNESS_LIBRARY environment variable, next to this file, and in the parent folder.
+
+Example:
+
+    import numpy as np
+    import metalness
+
+    cos_theta = np.linspace(0.0, 1.0, 1000000, dtype=np.float32)
+    f = metalness.complex_fresnel(np.full_like(cos_theta, 0.15557), np.full_like(cos_theta, 3.6024), cos_theta)
+    fits = metalness.fit(*metalness.presets_nk())
+    print(fits['ior'])
+"""
+
+import ctypes
+import os
+import sys
+
+import numpy as np
+
+__all__ = [
+    'FIT_DTYPE',
+    'complex_fresnel',
+    'ole_fresnel',
+    'vray_fresnel',
+    'ole_from_nk',
+    'nk_from_ole',
+    'find_ior',
+    'fit',
+    'f82_tint_fresnel',
+    'f82_tint_fit',
+    'presets',
+    'presets_nk',
+]
+
+# Matches metalness_fit_result in metalness_api.h.
+FIT_DTYPE = np.dtype([
+    ('base', np.float32, (3,)),
+    ('reflection', np.float32, (3,)),
+    ('edge_tint', np.float32, (3,)),
+    ('ior', np.float32),
+    ('vray_error', np.float32),
+    ('ole_error', np.float32),
+])
+
+_REQUIRED_API_VERSION = 3
+
+
+def _library_names():
+    if sys.platform == 'win32':
+        return ['metalness.dll']
+    if sys.platform == 'darwin':
+        return ['libmetalness.dylib']
+    return ['libmetalness.so']
+
+
+def _load_library():
+    candidates = []
+    if os.environ.get('METALNESS_LIBRARY'):
+        candidates.append(os.environ['METALNESS_LIBRARY'])
+    here = os.path.dirname(os.path.abspath(__file__))
+    for folder in (here, os.path.dirname(here)):
+        candidates.extend(os.path.join(folder, name) for name in _library_names())
+
+    for path in candidates:
+        if os.path.exists(path):
+            return ctypes.CDLL(path)
+    raise ImportError('Cannot find the metalness library; tried: ' + ', '.join(candidates))
+
+
+_lib = _load_library()
+
+_float_p = ctypes.POINTER(ctypes.c_float)
+_char_p_p = ctypes.POINTER(ctypes.c_char_p)
+_size_t = ctypes.c_size_t
+_int = ctypes.c_int
+
+_lib.metalness_api_version.argtypes = []
+_lib.metalness_api_version.restype = _int
+if _lib.metalness_api_version() < _REQUIRED_API_VERSION:
+    raise ImportError('The metalness library is too old: API version %d, need %d'
+                      % (_lib.metalness_api_version(), _REQUIRED_API_VERSION))
+
+for _name, _num_inputs, _num_outputs in (
+        ('metalness_complex_fresnel_batch', 3, 1),
+        ('metalness_ole_fresnel_batch', 3, 1),
+        ('metalness_vray_fresnel_batch', 4, 1),
+        ('metalness_f82_tint_fresnel_batch', 3, 1),
+        ('metalness_ole_from_nk_batch', 2, 2),
+        ('metalness_nk_from_ole_batch', 2, 2),
+        ('metalness_find_ior_batch', 2, 1),
+        ('metalness_fit_batch', 2, 1),
+        ('metalness_f82_tint_fit_batch', 2, 2)):
+    _func = getattr(_lib, _name)
+    _func.argtypes = [ctypes.c_void_p] * (_num_inputs + _num_outputs) + [_size_t, _int]
+    _func.restype = _int
+
+_lib.metalness_preset_count.argtypes = []
+_lib.metalness_preset_count.restype = _int
+_lib.metalness_preset.argtypes = [_int, _char_p_p, _float_p, _float_p]
+_lib.metalness_preset.restype = _int
+
+
+def _as_input(a, shape=None):
+    """Return a C-contiguous float32 view of a, copying only if needed."""
+    a = np.ascontiguousarray(a, dtype=np.float32)
+    if shape is not None and a.shape != shape:
+        a = np.ascontiguousarray(np.broadcast_to(a, shape))
+    return a
+
+
+def _as_output(out, shape, dtype=np.float32):
+    """Return out if it can receive the results directly, or a new array."""
+    if out is None:
+        return np.empty(shape, dtype=dtype)
+    if out.shape != shape or out.dtype != dtype or not out.flags['C_CONTIGUOUS'] or not out.flags['WRITEABLE']:
+        raise ValueError('out must be a writeable C-contiguous %s array of shape %s' % (np.dtype(dtype).name, shape))
+    return out
+
+
+def _ptr(a):
+    return a.ctypes.data
+
+
+def _check(code):
+    if code != 0:
+        raise ValueError('metalness library call failed with code %d' % code)
+
+
+def _elementwise(func, inputs, out, num_threads):
+    shape = np.broadcast_shapes(*(np.shape(a) for a in inputs))
+    arrays = [_as_input(a, shape) for a in inputs]
+    result = _as_output(out, shape)
+    _check(func(*[_ptr(a) for a in arrays], _ptr(result), result.size, num_threads))
+    return result
+
+
+def complex_fresnel(n, k, cos_theta, out=None, num_threads=0):
+    """Complex Fresnel reflectance for n and k values at the given viewing angle cosines."""
+    return _elementwise(_lib.metalness_complex_fresnel_batch, (n, k, cos_theta), out, num_threads)
+
+
+def ole_fresnel(r, g, cos_theta, out=None, num_threads=0):
+    """Ole Gulbrandsen's artist-friendly metallic Fresnel for base reflectance r and edge tint g."""
+    return _elementwise(_lib.metalness_ole_fresnel_batch, (r, g, cos_theta), out, num_threads)
+
+
+def vray_fresnel(base, reflection, ior, cos_theta, out=None, num_threads=0):
+    """The VRayMtl metallic Fresnel for the given base and reflection colors and IOR."""
+    return _elementwise(_lib.metalness_vray_fresnel_batch, (base, reflection, ior, cos_theta), out, num_threads)
+
+
+def _convert(func, a, b, num_threads):
+    shape = np.broadcast_shapes(np.shape(a), np.shape(b))
+    a = _as_input(a, shape)
+    b = _as_input(b, shape)
+    out_a = np.empty(shape, dtype=np.float32)
+    out_b = np.empty(shape, dtype=np.float32)
+    _check(func(_ptr(a), _ptr(b), _ptr(out_a), _ptr(out_b), out_a.size, num_threads))
+    return out_a, out_b
+
+
+def ole_from_nk(n, k, num_threads=0):
+    """Convert n and k values to Ole Gulbrandsen's (r, g) parameters."""
+    return _convert(_lib.metalness_ole_from_nk_batch, n, k, num_threads)
+
+
+def nk_from_ole(r, g, num_threads=0):
+    """Convert Ole Gulbrandsen's (r, g) parameters to n and k values."""
+    return _convert(_lib.metalness_nk_from_ole_batch, r, g, num_threads)
+
+
+def _as_rgb_array(a):
+    a = _as_input(a)
+    if a.ndim == 1:
+        a = a.reshape(1, 3)
+    if a.ndim != 2 or a.shape[1] != 3:
+        raise ValueError('expected an array of shape (count, 3) with red/green/blue values')
+    return a
+
+
+def find_ior(n, k, out=None, num_threads=0):
+    """Find the VRayMtl IOR for each metal; n and k have shape (count, 3)."""
+    n = _as_rgb_array(n)
+    k = _as_rgb_array(k)
+    if n.shape != k.shape:
+        raise ValueError('n and k must have the same shape')
+    result = _as_output(out, (n.shape[0],))
+    _check(_lib.metalness_find_ior_batch(_ptr(n), _ptr(k), _ptr(result), result.size, num_threads))
+    return result
+
+
+def fit(n, k, out=None, num_threads=0):
+    """Fit the VRayMtl settings for each metal; n and k have shape (count, 3).
+
+    Returns a structured array with FIT_DTYPE fields: base, reflection, edge_tint, ior,
+    vray_error and ole_error.
+    """
+    n = _as_rgb_array(n)
+    k = _as_rgb_array(k)
+    if n.shape != k.shape:
+        raise ValueError('n and k must have the same shape')
+    result = _as_output(out, (n.shape[0],), FIT_DTYPE)
+    _check(_lib.metalness_fit_batch(_ptr(n), _ptr(k), _ptr(result), result.size, num_threads))
+    return result
+
+
+def f82_tint_fresnel(f0, tint, cos_theta, out=None, num_threads=0):
+    """The F82-tint metallic Fresnel of Standard Surface and OpenPBR for base color f0 and specular color tint."""
+    return _elementwise(_lib.metalness_f82_tint_fresnel_batch, (f0, tint, cos_theta), out, num_threads)
+
+
+def f82_tint_fit(n, k, num_threads=0):
+    """Fit the F82-tint base and specular colors for each metal; n and k have shape (count, 3).
+
+    Returns two arrays of shape (count, 3): the base colors and the specular colors.
+    """
+    n = _as_rgb_array(n)
+    k = _as_rgb_array(k)
+    if n.shape != k.shape:
+        raise ValueError('n and k must have the same shape')
+    f0 = np.empty(n.shape, dtype=np.float32)
+    tint = np.empty(n.shape, dtype=np.float32)
+    _check(_lib.metalness_f82_tint_fit_batch(_ptr(n), _ptr(k), _ptr(f0), _ptr(tint), n.shape[0], num_threads))
+    return f0, tint
+
+
+def presets():
+    """Return the built-in metal presets as a list of (name, n, k) tuples."""
+    result = []
+    for i in range(_lib.metalness_preset_count()):
+        name = ctypes.c_char_p()
+        n = (ctypes.c_float * 3)()
+        k = (ctypes.c_float * 3)()
+        _check(_lib.metalness_preset(i, ctypes.byref(name), n, k))
+        result.append((name.value.decode('utf-8'), np.array(n, dtype=np.float32), np.array(k, dtype=np.float32)))
+    return result
+
+
+def presets_nk():
+    """Return the n and k values of the built-in presets as two arrays of shape (count, 3)."""
+    items = presets()
+    return np.array([n for _, n, _ in items]), np.array([k for _, _, k in items])
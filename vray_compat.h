@@ -0,0 +1,150 @@
+/// @file Minimal portable stand-ins for the parts of the V-Ray SDK (utils.h and misc_ray.h) that the
+/// metalness code uses. This allows the metalness computations to be built and run without the SDK,
+/// f.e. on Linux machines. The implementations follow the SDK ones closely so that the results match;
+/// see example_output/metal_presets.csv for reference values produced with the SDK.
+
+#ifndef METALNESS_VRAY_COMPAT_H
+#define METALNESS_VRAY_COMPAT_H
+
+#include <math.h>
+#include <thread>
+#include <chrono>
+
+namespace VUtils {
+
+/// A color packed as 0x00RRGGBB, the same layout as the 32-bit Windows DIBs.
+typedef unsigned int RGB32;
+
+inline int fast_floor(float x) {
+	int i=int(x);
+	return (x<float(i))? i-1 : i;
+}
+
+template<class T>
+inline T clamp(T x, T minValue, T maxValue) {
+	return x<minValue? minValue : (x>maxValue? maxValue : x);
+}
+
+inline void msSleep(int milliseconds) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+/// An RGB color with floating-point components.
+struct Color {
+	float r, g, b;
+
+	Color(void) {}
+	Color(float ir, float ig, float ib):r(ir), g(ig), b(ib) {}
+
+	float& operator[](int i) { return (&r)[i]; }
+	const float& operator[](int i) const { return (&r)[i]; }
+
+	Color operator+(const Color &c) const { return Color(r+c.r, g+c.g, b+c.b); }
+	Color operator-(const Color &c) const { return Color(r-c.r, g-c.g, b-c.b); }
+	Color operator*(const Color &c) const { return Color(r*c.r, g*c.g, b*c.b); }
+	Color operator*(float f) const { return Color(r*f, g*f, b*f); }
+	Color operator/(float f) const { return Color(r/f, g/f, b/f); }
+	Color& operator+=(const Color &c) { r+=c.r; g+=c.g; b+=c.b; return *this; }
+	Color& operator-=(const Color &c) { r-=c.r; g-=c.g; b-=c.b; return *this; }
+	Color& operator*=(float f) { r*=f; g*=f; b*=f; return *this; }
+
+	float lengthSqr(void) const { return r*r+g*g+b*b; }
+
+	/// Convert the color from linear to sRGB display space.
+	void encodeToSRGB(void) {
+		r=encodeToSRGB(r);
+		g=encodeToSRGB(g);
+		b=encodeToSRGB(b);
+	}
+
+	static float encodeToSRGB(float x) {
+		if (x<=0.0031308f) return x*12.92f;
+		return 1.055f*powf(x, 1.0f/2.4f)-0.055f;
+	}
+
+	/// Convert to 8 bits per channel, 0x00RRGGBB.
+	RGB32 toRGB32(void) const {
+		const RGB32 ir=RGB32(clamp(fast_floor(r*256.0f), 0, 255));
+		const RGB32 ig=RGB32(clamp(fast_floor(g*256.0f), 0, 255));
+		const RGB32 ib=RGB32(clamp(fast_floor(b*256.0f), 0, 255));
+		return (ir<<16) | (ig<<8) | ib;
+	}
+};
+
+inline Color operator*(float f, const Color &c) { return c*f; }
+
+namespace simd {
+
+/// A 3D vector; only the operations needed for refraction and Fresnel are provided.
+struct Vector3f {
+	float x, y, z;
+
+	Vector3f(void) {}
+	Vector3f(float ix, float iy, float iz):x(ix), y(iy), z(iz) {}
+
+	Vector3f operator+(const Vector3f &v) const { return Vector3f(x+v.x, y+v.y, z+v.z); }
+	Vector3f operator-(const Vector3f &v) const { return Vector3f(x-v.x, y-v.y, z-v.z); }
+	Vector3f operator*(float f) const { return Vector3f(x*f, y*f, z*f); }
+};
+
+inline float dotf(const Vector3f &a, const Vector3f &b) {
+	return a.x*b.x+a.y*b.y+a.z*b.z;
+}
+
+} // namespace simd
+
+/// Compute the direction of a ray refracted at an interface.
+/// @param viewDir The incoming direction, pointing towards the surface.
+/// @param normal The surface normal.
+/// @param ior The relative index of refraction of the interface.
+/// @param internalReflection Set to true if there is total internal reflection.
+/// @return The refracted direction, or the zero vector on total internal reflection.
+inline simd::Vector3f getRefractDir(const simd::Vector3f &viewDir, const simd::Vector3f &normal, float ior, bool &internalReflection) {
+	float cosIn=-simd::dotf(viewDir, normal);
+	simd::Vector3f n=normal;
+	float eta=1.0f/ior;
+	if (cosIn<0.0f) {
+		// Leaving the medium.
+		cosIn=-cosIn;
+		n=normal*(-1.0f);
+		eta=ior;
+	}
+
+	const float sinOut2=eta*eta*(1.0f-cosIn*cosIn);
+	if (sinOut2>=1.0f) {
+		internalReflection=true;
+		return simd::Vector3f(0.0f, 0.0f, 0.0f);
+	}
+
+	internalReflection=false;
+	const float cosOut=sqrtf(1.0f-sinOut2);
+	return viewDir*eta+n*(eta*cosIn-cosOut);
+}
+
+/// Compute the Fresnel reflection coefficient for unpolarized light at a dielectric interface.
+/// @param viewDir The incoming direction, pointing towards the surface.
+/// @param normal The surface normal.
+/// @param refractDir The refracted direction as computed by getRefractDir().
+/// @param ior The relative index of refraction of the interface.
+/// @return The fraction of reflected light.
+inline float getFresnelCoeff(const simd::Vector3f &viewDir, const simd::Vector3f &normal, const simd::Vector3f &refractDir, float ior) {
+	const float cosIn=fabsf(simd::dotf(viewDir, normal));
+	const float cosOut=fabsf(simd::dotf(refractDir, normal));
+	if (cosOut<=0.0f)
+		return 1.0f;
+
+	// Indices on the incoming and the outgoing sides.
+	float n1=1.0f, n2=ior;
+	if (simd::dotf(viewDir, normal)>0.0f) {
+		n1=ior;
+		n2=1.0f;
+	}
+
+	const float rs=(n1*cosIn-n2*cosOut)/(n1*cosIn+n2*cosOut);
+	const float rp=(n2*cosIn-n1*cosOut)/(n2*cosIn+n1*cosOut);
+	return clamp(0.5f*(rs*rs+rp*rp), 0.0f, 1.0f);
+}
+
+} // namespace VUtils
+
+#endif // METALNESS_VRAY_COMPAT_H